@@ -0,0 +1,76 @@
+#ifndef CAPABILITY_CACHE_H
+#define CAPABILITY_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <linux/videodev2.h>
+
+// Frame sizes of one pixel format. Discrete sizes are listed; stepwise and continuous ranges are kept as the range.
+struct FormatInfo
+{
+  uint32_t fourcc = 0;
+  std::string description;
+  uint32_t size_type = V4L2_FRMSIZE_TYPE_DISCRETE;
+  std::vector<std::pair<int, int>> sizes;
+  struct v4l2_frmsize_stepwise stepwise = {};
+
+  // The discrete sizes, or common sizes that fall on the stepwise range (always including its maximum).
+  std::vector<std::pair<int, int>> candidate_sizes() const;
+};
+
+// What a cache entry belongs to. Entries are keyed by driver, bus_info and card, and only served while the driver
+// version and the device firmware revision still match.
+struct deviceIdentity
+{
+  std::string driver;
+  std::string bus_info;
+  std::string card;
+  uint32_t version = 0;
+  std::string firmware;  // USB bcdDevice when available.
+};
+
+// On-disk cache of device capabilities, so a camera that was seen before is listed without enumerating its formats
+// and frame sizes again. Frame rates are only probed for the sizes actually selected and are cached as they are found.
+// The cache lives in $XDG_CACHE_HOME/v4l2_gui/capabilities (~/.cache when unset) and is rewritten atomically whenever
+// it changes. Safe to use from several threads and processes; the last writer wins.
+class capability_cache
+{
+public:
+  capability_cache();
+  explicit capability_cache(const std::string& path);
+
+  static std::string default_path();
+
+  bool lookup_formats(const deviceIdentity& identity, std::vector<FormatInfo>& formats);
+  void store_formats(const deviceIdentity& identity, const std::vector<FormatInfo>& formats);
+
+  bool lookup_rates(const deviceIdentity& identity, uint32_t fourcc, int width, int height, std::vector<float>& fps);
+  void store_rates(const deviceIdentity& identity, uint32_t fourcc, int width, int height,
+                   const std::vector<float>& fps);
+
+private:
+  struct entry
+  {
+    deviceIdentity identity;
+    std::vector<FormatInfo> formats;
+    std::map<std::string, std::vector<float>> rates;  // Keyed by rate_key().
+  };
+
+  static std::string device_key(const deviceIdentity& identity);
+  static std::string rate_key(uint32_t fourcc, int width, int height);
+
+  entry* find(const deviceIdentity& identity);
+  void load();
+  void save();
+
+  std::mutex mutex;
+  std::string path;
+  bool loaded;
+  std::map<std::string, entry> entries;
+};
+
+#endif
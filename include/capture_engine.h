@@ -0,0 +1,88 @@
+#ifndef CAPTURE_ENGINE_H
+#define CAPTURE_ENGINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "usb_camera.h"
+#include "debug.h"
+
+// Services many capture sources (cameras or replayed recordings) from a single epoll reactor thread.
+//
+// Each camera is registered with EPOLLONESHOT, so at most one dequeue/decode is in flight per camera and its frames
+// are always published in order by one thread at a time. Ready cameras are handed to a fixed pool of decode workers
+// (or serviced on the reactor thread itself when the pool is empty) and re-armed once their buffer is requeued. The
+// number of threads stays at 1 + worker_count no matter how many cameras are added. Every camera keeps its own frame
+// buffer, so consumers read frames from the source returned by addCamera() / addSource() exactly as with a standalone
+// stream.
+class CaptureEngine
+{
+public:
+  explicit CaptureEngine(int worker_count = 2);
+  ~CaptureEngine();
+
+  void start();
+  void stop();
+
+  // Opens and starts streaming a camera. Returns nullptr on failure. The engine owns the returned camera.
+  usb_cam* addCamera(const m_deviceConfig& config);
+
+  // Same for any other source, e.g. a replay_source. Returns nullptr on failure, otherwise the source, now owned by
+  // the engine.
+  capture_source* addSource(std::unique_ptr<capture_source> source, const m_deviceConfig& config);
+
+  // Stops servicing a camera or source, waits for any in-flight work on it and closes it.
+  void removeCamera(capture_source* camera);
+
+  size_t cameraCount();
+  size_t threadCount() const;
+
+private:
+  struct cameraEntry
+  {
+    uint64_t id;
+    std::unique_ptr<capture_source> camera;
+    bool busy;
+    bool removed;  // Unregistered by removeCamera(); an in-flight job must not re-arm it.
+  };
+
+  struct job
+  {
+    std::shared_ptr<cameraEntry> entry;
+    uint32_t events;
+  };
+
+  void reactorLoop();
+  void workerLoop();
+  void runJob(const job& j);
+  void rearm(const cameraEntry& entry);
+
+  int epoll_fd;
+  int wake_fd;
+  int worker_count;
+
+  std::mutex mutex;
+  std::condition_variable job_ready;
+  std::condition_variable job_done;
+  std::map<uint64_t, std::shared_ptr<cameraEntry>> cameras;
+  std::deque<job> jobs;
+  uint64_t next_id;
+
+  std::atomic<bool> running;
+  std::thread reactor_thread;
+  std::vector<std::thread> workers;
+
+  static const int MAX_EVENTS = 16;
+  static const int EPOLL_TIMEOUT_MS = 200;
+};
+
+#endif
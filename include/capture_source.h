@@ -0,0 +1,150 @@
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <linux/videodev2.h>
+#include <opencv2/core.hpp>
+#include "frame_buffer.h"
+#include "frame_stats.h"
+#include "frame_decoder.h"
+
+enum bufferMemory
+{
+  MEMORY_MMAP,     // Driver-allocated buffers mapped into our address space.
+  MEMORY_USERPTR,  // Page-aligned buffers we allocate and hand to the driver.
+  MEMORY_DMABUF    // Driver-allocated buffers, additionally exported as DMABUF fds with VIDIOC_EXPBUF.
+};
+
+struct m_deviceConfig
+{
+  std::string path;
+  std::string device_name;
+  std::string format;
+  uint32_t fourcc = 0;  // Takes precedence over format when set.
+  std::pair<int, int> resolution;
+  float fps;
+
+  // 2 minimizes latency, 8-16 absorbs bursts at high frame rates. The driver may adjust the count.
+  int buffer_count = 4;
+  bufferMemory memory = MEMORY_MMAP;
+};
+
+// A dequeued V4L2 buffer. Only valid for the duration of the raw frame callback; the buffer is requeued afterwards.
+struct rawFrame
+{
+  const uint8_t* data;
+  size_t bytesused;
+  uint32_t index;
+  int dmabuf_fd;  // -1 unless streaming with MEMORY_DMABUF.
+  uint32_t sequence;
+  uint32_t flags;
+  int64_t timestamp_ns;
+  int64_t dequeue_ns;
+};
+
+// A decoded frame and where it came from. Times are in nanoseconds; timestamp_ns is the driver's buffer timestamp,
+// which is on CLOCK_MONOTONIC when flags has V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC set. dequeue_ns is CLOCK_MONOTONIC.
+struct frameData
+{
+  cv::Mat image;
+  uint32_t sequence = 0;
+  uint32_t flags = 0;
+  int64_t timestamp_ns = 0;
+  int64_t dequeue_ns = 0;
+  int64_t decode_ns = 0;
+};
+
+// Where frames come from: a V4L2 device (usb_cam) or a recorded frame file (replay_source).
+//
+// A source only opens its stream, services its fd when it is ready and passes each raw buffer to deliver(), which runs
+// the stages every source shares: the raw frame callback, decode, stats and the handoff to the consumer. The capture
+// thread and its stop protocol live here too, so every source shuts down the same way. Everything downstream talks to
+// this interface, so a recording can stand in for a camera when load testing, profiling or benchmarking the pipeline.
+class capture_source
+{
+public:
+  capture_source();
+  virtual ~capture_source();
+
+  // Streams on a capture thread owned by the source, which polls device_fd() and calls service() until it fails or
+  // stop_stream() is called. The thread clears streaming when the stream ends on its own; start_stream() then reaps
+  // the old stream before opening a new one.
+  void start_stream(const m_deviceConfig& config);
+
+  // Wakes and joins the capture thread, if any, and closes the stream. Returns within one poll timeout even when the
+  // source has stopped delivering. Safe to call when nothing is open.
+  void stop_stream();
+
+  // Externally driven streaming, used by CaptureEngine to service many sources from one thread. open_stream() starts
+  // streaming without spawning a capture thread; the owner then polls device_fd() and calls service() with the
+  // returned events until it returns false. stop_stream() tears the stream down once the owner has stopped calling
+  // service(). device_fd() is -1 while no stream is open.
+  virtual bool open_stream(const m_deviceConfig& config) = 0;
+  virtual int device_fd() const = 0;
+  virtual bool service(short revents) = 0;
+
+  // Called on the capture thread each time a new decoded frame has been published for acquire_frame(). Keep it
+  // cheap; it is meant to wake the consumer, not to process the frame. Set before start_stream().
+  void set_frame_callback(std::function<void()> callback);
+
+  // Called on the capture thread for every captured buffer, before it is decoded and released. Lets other consumers
+  // use the buffer (or its DMABUF fd) without a copy. Set before start_stream().
+  void set_raw_frame_callback(std::function<void(const rawFrame&)> callback);
+
+  // Takes the most recently captured frame without copying pixel data. Returns true if the frame is new since the
+  // previous call. Must only be called from a single consumer thread.
+  bool acquire_frame(frameData& frame);
+
+  // Size of the box frames are displayed in. Compressed formats are decoded at the smallest size that still fills it,
+  // 0x0 (the default) decodes at full resolution. Can be changed at any time from any thread.
+  void set_target_size(int width, int height);
+
+  // Tells the stats that a frame acquired with acquire_frame() has been shown, for delivered fps and latency.
+  void mark_presented(const frameData& frame);
+  captureStats get_stats();
+
+  // Format negotiated by the last start_stream()/open_stream().
+  struct v4l2_pix_format get_format() const;
+
+  std::atomic<bool> streaming;
+
+protected:
+  // Sets the format of the frames about to be delivered and resets the stats. Call once per stream, before the first
+  // deliver().
+  void begin_stream(const struct v4l2_pix_format& format);
+
+  // Runs the shared stages on one captured buffer, on whichever thread services the source.
+  void deliver(const rawFrame& raw);
+
+  // Undoes open_stream(): stops the device, releases its buffers and closes device_fd(). stop_stream() calls it once
+  // nothing services the source any more. Subclasses call stop_stream() from their destructor, while this can still
+  // be dispatched to them.
+  virtual void close_stream() = 0;
+
+  struct v4l2_pix_format m_pixfmt;
+
+private:
+  capture_source(const capture_source&);
+  capture_source& operator=(const capture_source&);
+
+  void capture_loop();
+
+  triple_buffer<frameData> m_frames;
+  frame_stats m_stats;
+  frame_decoder m_decoder;
+  std::function<void(const rawFrame&)> m_raw_callback;
+  std::function<void()> m_frame_callback;
+  std::thread m_thread;
+  int m_wake_fd;
+
+  // Upper bound on how long the capture thread sleeps between checks of the streaming flag.
+  static const int POLL_TIMEOUT_MS = 200;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef CONTROL_WRITER_H
+#define CONTROL_WRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "usb_camera.h"
+
+// Applies control changes to a usb_cam on its own thread, so the caller never waits for a control transfer.
+//
+// Each control has a latest-value-wins mailbox: while a batch is in flight, further set() calls for the same control
+// just overwrite the pending value, so a slider drag collapses into a handful of writes. Pending writes are applied
+// in one set_controls() batch in the order the controls were first touched, then read back, and the values the
+// device actually took (clamped or rounded) are reported through the value callback. Reads and resets are queued the
+// same way. An optional rate cap spaces batches out for devices that choke on back-to-back control requests.
+//
+// The camera's control table must not change while the writer runs: start() after the stream is open and stop()
+// before it is closed.
+class control_writer
+{
+public:
+  explicit control_writer(usb_cam* camera);
+  ~control_writer();
+
+  void start();
+  void stop();
+
+  // Non-blocking; callable from any thread.
+  void set(uint32_t id, int32_t value);
+  void read(const std::vector<uint32_t>& ids);
+  void reset_to_default();
+
+  // Maximum number of batches per second, 0 for no limit. Takes effect on the next batch.
+  void set_max_rate(double batches_per_second);
+
+  // Called on the writer thread with each value read back after a batch, unless a newer value for the same control
+  // is already queued. Set before start().
+  void set_value_callback(std::function<void(uint32_t id, int32_t value)> callback);
+
+private:
+  control_writer(const control_writer&);
+  control_writer& operator=(const control_writer&);
+
+  void run();
+
+  usb_cam* camera;
+  std::function<void(uint32_t, int32_t)> m_callback;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<std::pair<uint32_t, int32_t>> pending_writes;
+  std::set<uint32_t> pending_reads;
+  bool pending_reset;
+  std::chrono::steady_clock::duration min_interval;
+
+  bool running;
+  std::thread worker;
+};
+
+#endif
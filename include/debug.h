@@ -1,29 +1,29 @@
 #ifndef DEBUG_H
 #define DEBUG_H
-#include <iostream>
 
-#ifdef DEBUG
-#define CERR(x) std::cerr << x
-#define CERR_ENDL(x) std::cerr << x << std::endl
-#define COUT(x) std::cout << x
-#define COUT_ENDL(x) std::cout << x << std::endl
-#else
-#define CERR(x)                                                                                                        \
-  do                                                                                                                   \
-  {                                                                                                                    \
-  } while (0)
-#define CERR_ENDL(x)                                                                                                   \
-  do                                                                                                                   \
-  {                                                                                                                    \
-  } while (0)
-#define COUT(x)                                                                                                        \
-  do                                                                                                                   \
-  {                                                                                                                    \
-  } while (0)
-#define COUT_ENDL(x)                                                                                                   \
+#include "logger.h"
+
+// Logging macros. x is a stream expression, e.g. CERR_ENDL("Failed to open " << path << ": " << strerror(errno)).
+// Messages go through the asynchronous logger (see logger.h): formatting only happens when the level is enabled and the
+// call site is within its rate limit, and the caller never waits for the terminal.
+#define LOG_AT_LEVEL(level, x)                                                                                         \
   do                                                                                                                   \
   {                                                                                                                    \
+    if (logger::enabled(level))                                                                                        \
+    {                                                                                                                  \
+      static log_site log_call_site(__FILE__, __LINE__);                                                               \
+      uint64_t log_suppressed = 0;                                                                                     \
+      if (log_call_site.allow(log_suppressed))                                                                         \
+      {                                                                                                                \
+        logger::stream() << x;                                                                                         \
+        logger::instance().write(level, log_call_site, log_suppressed);                                                \
+      }                                                                                                                \
+    }                                                                                                                  \
   } while (0)
-#endif
 
-#endif
\ No newline at end of file
+#define CERR_ENDL(x) LOG_AT_LEVEL(LOG_LEVEL_ERROR, x)
+#define WARN_ENDL(x) LOG_AT_LEVEL(LOG_LEVEL_WARNING, x)
+#define COUT_ENDL(x) LOG_AT_LEVEL(LOG_LEVEL_INFO, x)
+#define DEBUG_ENDL(x) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, x)
+
+#endif
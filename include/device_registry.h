@@ -0,0 +1,66 @@
+#ifndef DEVICE_REGISTRY_H
+#define DEVICE_REGISTRY_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "usb_camera.h"
+
+enum deviceEvent
+{
+  DEVICE_ADDED,
+  DEVICE_REMOVED
+};
+
+// Tracks the V4L2 capture nodes present on the system.
+//
+// Devices are enumerated from /sys/class/video4linux. Only the primary node of each device (sysfs "index" 0) is
+// considered; this drops the metadata nodes UVC cameras create alongside their video node, as well as vbi, radio and
+// subdevice nodes without opening them. Each remaining node is opened once, when it is first seen, for a
+// VIDIOC_QUERYCAP that drops output-only and mem-to-mem nodes; the result is kept with the node until it is removed.
+// Nodes that cannot be opened are listed anyway. While started, a thread listens for kernel uevents on a netlink
+// socket and reports cameras as they are plugged in or removed.
+class device_registry
+{
+public:
+  device_registry();
+  ~device_registry();
+
+  // One-off enumeration, sorted by node number.
+  static std::vector<deviceData> enumerate();
+
+  // Enumerates and starts watching for hotplug. Returns false if the uevent socket cannot be opened, in which case
+  // devices() still holds the devices found at startup.
+  bool start();
+  void stop();
+
+  // Snapshot of the currently known devices, sorted by node number.
+  std::vector<deviceData> devices();
+
+  // Called on the monitor thread whenever a capture device appears or disappears. Set before start().
+  void set_callback(std::function<void(deviceEvent, const deviceData&)> callback);
+
+private:
+  device_registry(const device_registry&);
+  device_registry& operator=(const device_registry&);
+
+  static bool read_node(const std::string& name, deviceData& device);
+  void monitor_loop();
+  void handle_uevent(const char* message, size_t size);
+
+  std::mutex mutex;
+  std::map<std::string, deviceData> known;
+  std::function<void(deviceEvent, const deviceData&)> m_callback;
+
+  std::atomic<bool> running;
+  std::thread monitor_thread;
+  int netlink_fd;
+  int wake_fd;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+// Lock-free single-producer / single-consumer triple buffer.
+//
+// The producer always owns the back slot and the consumer always owns the front slot; the middle slot is handed
+// over with a single atomic exchange. Neither side ever blocks or waits for the other, and slots are swapped by
+// index so the payload is never copied. If the producer publishes faster than the consumer reads, older frames are
+// silently replaced by the latest one.
+template <typename T>
+class triple_buffer
+{
+public:
+  triple_buffer() : back(0), middle(1), front(2)
+  {
+  }
+
+  // Producer side: the slot to fill before calling publish().
+  T& write_slot()
+  {
+    return slots[back];
+  }
+
+  // Producer side: hand the back slot to the consumer and take over the previous middle slot.
+  void publish()
+  {
+    uint8_t prev = middle.exchange(back | FRESH_BIT, std::memory_order_acq_rel);
+    back = prev & INDEX_MASK;
+  }
+
+  // Consumer side: swap in the latest published slot. Returns true if it was published since the last call.
+  bool update()
+  {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH_BIT))
+    {
+      return false;
+    }
+
+    uint8_t prev = middle.exchange(front, std::memory_order_acq_rel);
+    front = prev & INDEX_MASK;
+    return true;
+  }
+
+  // Consumer side: the slot returned by the last update(). Stays valid until the next update().
+  const T& read_slot() const
+  {
+    return slots[front];
+  }
+
+  // Resets every slot. Only safe while neither the producer nor the consumer is active.
+  void clear()
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      slots[i] = T();
+    }
+    back = 0;
+    middle.store(1, std::memory_order_relaxed);
+    front = 2;
+  }
+
+private:
+  static const uint8_t INDEX_MASK = 0x3;
+  static const uint8_t FRESH_BIT = 0x4;
+
+  // Each side's private index is padded onto its own cache line so the two threads do not false-share. Padding
+  // rather than alignas keeps the owning class at normal alignment for plain operator new.
+  T slots[3];
+  uint8_t back;
+  char pad0[64];
+  std::atomic<uint8_t> middle;
+  char pad1[64];
+  uint8_t front;
+};
+
+#endif
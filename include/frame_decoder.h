@@ -0,0 +1,48 @@
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+#include "mjpeg_decoder.h"
+#include "h264_decoder.h"
+
+// Turns raw V4L2 buffers of one negotiated format into displayable images.
+//
+// MJPEG goes through mjpeg_decoder and H.264 through h264_decoder at the current target size, uncompressed formats
+// through convert_to_rgb32() at full resolution. This is the decode stage usb_cam runs on every dequeued buffer; it is
+// kept separate so the benchmark and replay tools exercise exactly the same code path without a device.
+class frame_decoder
+{
+public:
+  frame_decoder();
+
+  // Returns true if decode() can handle the given V4L2 fourcc.
+  static bool supported(uint32_t fourcc);
+
+  // Format of the buffers passed to decode(). Must not be called concurrently with decode().
+  void set_format(uint32_t fourcc, int width, int height, int bytesperline);
+
+  // Size of the box frames are displayed in, 0x0 for full resolution. Can be changed at any time from any thread.
+  void set_target_size(int width, int height);
+
+  // Decodes one buffer. out is always replaced by an image no one else refers to, so it can be handed over as-is.
+  bool decode(const uint8_t* data, size_t size, cv::Mat& out);
+
+private:
+  frame_decoder(const frame_decoder&);
+  frame_decoder& operator=(const frame_decoder&);
+
+  mjpeg_decoder mjpeg;
+  h264_decoder h264;
+  uint32_t fourcc;
+  int width;
+  int height;
+  int bytesperline;
+  std::atomic<int> target_width;
+  std::atomic<int> target_height;
+};
+
+#endif
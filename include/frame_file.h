@@ -0,0 +1,85 @@
+#ifndef FRAME_FILE_H
+#define FRAME_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Raw frame dump format, used to record camera output as-is and replay it without hardware.
+//
+// A 48-byte header (magic "V4L2FRM1", fourcc, width, height, bytesperline) is followed by one record per frame: a
+// 16-byte record header (timestamp_ns, sequence, size) and the unmodified V4L2 buffer payload, padded to 8 bytes.
+// All fields are little-endian.
+
+struct frameFileHeader
+{
+  char magic[8];
+  uint32_t fourcc;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bytesperline;
+  uint32_t reserved[6];
+};
+
+struct frameFileRecord
+{
+  int64_t timestamp_ns;
+  uint32_t sequence;
+  uint32_t size;
+};
+
+// One frame of a mapped dump. data points into the mapping and stays valid while the reader is open.
+struct frameFileEntry
+{
+  const uint8_t* data;
+  size_t size;
+  int64_t timestamp_ns;
+  uint32_t sequence;
+};
+
+class frame_file_writer
+{
+public:
+  frame_file_writer();
+  ~frame_file_writer();
+
+  bool open(const std::string& path, uint32_t fourcc, uint32_t width, uint32_t height, uint32_t bytesperline);
+  bool write_frame(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence);
+  void close();
+
+  size_t frames_written() const;
+
+private:
+  frame_file_writer(const frame_file_writer&);
+  frame_file_writer& operator=(const frame_file_writer&);
+
+  std::FILE* file;
+  size_t count;
+};
+
+class frame_file_reader
+{
+public:
+  frame_file_reader();
+  ~frame_file_reader();
+
+  // Maps the whole file and indexes its frames. Frame data is never copied.
+  bool open(const std::string& path);
+  void close();
+
+  const frameFileHeader& header() const;
+  const std::vector<frameFileEntry>& frames() const;
+
+private:
+  frame_file_reader(const frame_file_reader&);
+  frame_file_reader& operator=(const frame_file_reader&);
+
+  void* mapping;
+  size_t mapping_size;
+  frameFileHeader file_header;
+  std::vector<frameFileEntry> entries;
+};
+
+#endif
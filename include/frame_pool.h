@@ -0,0 +1,65 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct framePoolStats
+{
+  uint64_t allocations = 0;  // Buffers taken from the heap because none of the right size was free.
+  uint64_t reuses = 0;       // Buffers handed out again from the pool.
+  uint64_t releases = 0;     // Buffers freed because the pool was full.
+  size_t cached_bytes = 0;   // Free buffers currently held.
+};
+
+// Reusable, cache-line aligned pixel buffers for decoded frames.
+//
+// frame_pool is a cv::MatAllocator. Images created through it are ordinary cv::Mats whose reference count decides
+// when the buffer is free: when the last Mat referring to it is released, the buffer (and its UMatData) goes back
+// onto a free list keyed by byte size instead of to the heap, and the next image of that size takes it without
+// allocating. Decoders write into these buffers directly, so once every buffer a stream keeps in flight has been
+// allocated, capture runs without heap allocations.
+//
+// Free buffers are capped at max_cached_bytes; when a released buffer does not fit, buffers of other sizes are
+// dropped first, so a resolution change does not leave the old size pinning memory.
+class frame_pool : public cv::MatAllocator
+{
+public:
+  // The process-wide pool. It is never destroyed, so images may outlive whatever created them.
+  static frame_pool& instance();
+
+  // An uninitialized image backed by a pooled buffer of the process-wide pool.
+  static cv::Mat image(int rows, int cols, int type);
+
+  void set_max_cached_bytes(size_t bytes);
+
+  // Frees every buffer that is not in use.
+  void trim();
+
+  framePoolStats get_stats() const;
+
+  cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                         cv::UMatUsageFlags usage) const override;
+  bool allocate(cv::UMatData* data, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override;
+  void deallocate(cv::UMatData* data) const override;
+
+private:
+  frame_pool();
+  frame_pool(const frame_pool&);
+  frame_pool& operator=(const frame_pool&);
+
+  static const size_t ALIGNMENT = 64;
+
+  void free_buffer(cv::UMatData* data) const;
+
+  mutable std::mutex mutex;
+  mutable std::map<size_t, std::vector<cv::UMatData*>> free_lists;
+  mutable framePoolStats stats;
+  size_t max_cached_bytes;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <cstdint>
+#include <mutex>
+#include <time.h>
+
+inline int64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+struct captureStats
+{
+  double capture_fps;    // Frames dequeued from the driver per second.
+  double delivered_fps;  // Frames shown by the consumer per second.
+
+  uint64_t frames_captured;
+  uint64_t frames_delivered;
+  uint64_t frames_dropped;  // Gaps in the driver's sequence numbers.
+
+  double decode_ms_p50;
+  double decode_ms_p90;
+  double decode_ms_p99;
+
+  double latency_ms_p50;  // Capture timestamp to presentation.
+  double latency_ms_p90;
+  double latency_ms_p99;
+};
+
+// Rolling per-stream statistics over the last WINDOW frames. Recording happens on the capture thread, snapshots are
+// taken from any thread. Storage is fixed-size, so recording never allocates.
+class frame_stats
+{
+public:
+  frame_stats();
+
+  void reset();
+  void record_capture(uint32_t sequence, int64_t timestamp_ns, int64_t decode_ns);
+  void record_present(int64_t present_ns, int64_t latency_ns);
+  captureStats snapshot();
+
+private:
+  static const int WINDOW = 128;
+
+  struct rollingWindow
+  {
+    int64_t values[WINDOW];
+    int count;
+    int next;
+
+    void clear();
+    void push(int64_t value);
+    double rate_per_second() const;
+    double percentile_ms(double p) const;
+  };
+
+  std::mutex mutex;
+  rollingWindow capture_times;
+  rollingWindow present_times;
+  rollingWindow decode_times;
+  rollingWindow latencies;
+
+  bool have_sequence;
+  uint32_t last_sequence;
+  uint64_t frames_captured;
+  uint64_t frames_delivered;
+  uint64_t frames_dropped;
+};
+
+#endif
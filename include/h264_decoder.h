@@ -0,0 +1,48 @@
+#ifndef H264_DECODER_H
+#define H264_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+// H.264 decoder for cameras that stream V4L2_PIX_FMT_H264.
+//
+// Built on libavcodec when it is found at configure time (HAVE_LIBAVCODEC). Each V4L2 buffer is one access unit and is
+// sent to the decoder as a packet; SPS/PPS arrive in-band with the IDR frames, so no extradata is needed and decoding
+// starts at the first keyframe. The decoder runs with frame threading, which adds up to one frame of latency per
+// thread in exchange for keeping up with 4K streams on a single core's budget per frame.
+//
+// Decoded pictures are converted with swscale straight into 4-channel BGRX, scaled down to the target box when one is
+// set, in buffers from frame_pool.
+class h264_decoder
+{
+public:
+  h264_decoder();
+  ~h264_decoder();
+
+  // Returns true if the library was built with an H.264 decoder.
+  static bool available();
+
+  // Drops decoder state, e.g. for a new stream. The next picture is the next keyframe.
+  void reset();
+
+  // Returns false while the decoder has no picture to show yet (before the first keyframe, or while frame threads
+  // fill up) as well as on errors.
+  bool decode(const uint8_t* data, size_t size, int target_width, int target_height, cv::Mat& out);
+
+private:
+  h264_decoder(const h264_decoder&);
+  h264_decoder& operator=(const h264_decoder&);
+
+  bool open();
+  void close();
+
+  // libavcodec / swscale state, kept as plain pointers so this header does not depend on FFmpeg or HAVE_LIBAVCODEC.
+  void* context;
+  void* packet;
+  void* frame;
+  void* scaler;
+  uint64_t errors;
+};
+
+#endif
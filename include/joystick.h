@@ -1,13 +1,12 @@
 #ifndef JOYSTICK_H
 #define JOYSTICK_H
 
-#define NON_DEBUG
-
 #include <iostream>
+#include <functional>
 #include <string>
 #include <thread>
-#include <vector>
 #include <atomic>
+#include <cstdint>
 #include <fcntl.h>
 #include <unistd.h>
 #include <linux/joystick.h>
@@ -15,6 +14,44 @@
 
 #include "debug.h"
 
+// A consistent copy of every axis and button, taken with Joystick::getState().
+struct joystickState
+{
+  static const int MAX_AXES = 64;
+  static const int MAX_BUTTONS = 256;
+
+  uint64_t generation = 0;  // Changes whenever the state does; equal generations mean equal states.
+  bool connected = false;
+  int axis_count = 0;
+  int button_count = 0;
+  int16_t axis[MAX_AXES] = {};
+  uint8_t button[MAX_BUTTONS] = {};
+};
+
+// An axis move or button press/release, as delivered by the event queue.
+struct joystickEvent
+{
+  enum Type : uint8_t
+  {
+    AXIS,
+    BUTTON
+  };
+
+  Type type;
+  uint8_t number;
+  int16_t value;
+  uint32_t time_ms;  // Driver timestamp.
+};
+
+// Reads /dev/input/jsN on its own thread.
+//
+// The thread sleeps in poll() on the device and an eventfd used for shutdown. If the device goes away the state is
+// cleared and the thread retries opening it every RECONNECT_MS until it is back, so the joystick can be unplugged and
+// replugged while the app runs.
+//
+// The current state is published under a sequence lock: getState() never blocks the event thread and always returns
+// a snapshot from a single moment. Consumers that need every edge rather than the latest state can enable the event
+// queue, a lock-free single-consumer ring that drops (and counts) events when the consumer falls behind.
 class Joystick
 {
 public:
@@ -25,18 +62,56 @@ public:
   void startEventThread();
   void stopEventThread();
 
-  std::vector<int> axis;
-  std::vector<int> button;
+  // Copies the latest state. Safe from any thread.
+  void getState(joystickState& state) const;
+
+  // Cheap check for changes since a previous getState().
+  uint64_t generation() const;
+
+  // Called from the event thread on every button press (pressed = true) and release.
+  void setButtonCallback(std::function<void(int button, bool pressed)> callback);
+
+  // Queue edges for pollEvent(). Events are only queued while enabled; one thread may consume them.
+  void enableEventQueue(bool enable);
+  bool pollEvent(joystickEvent& event);
+  uint64_t droppedEvents() const;
 
 private:
+  Joystick(const Joystick&);
+  Joystick& operator=(const Joystick&);
+
   void readEvent();
+  bool openDevice();
+  void closeDevice();
   void initialize();
+  void applyEvent(const struct js_event& event);
+  void beginUpdate();
+  void endUpdate();
+
+  static const int RECONNECT_MS = 1000;
+  static const uint32_t QUEUE_SIZE = 256;  // Power of two.
 
-  int joystick_fd;
   std::string device_path;
+  int joystick_fd;
+  int wake_fd;
 
   std::atomic<bool> running;
   std::thread event_thread;
+  std::function<void(int, bool)> button_callback;
+
+  // Sequence lock: odd while the event thread updates the fields below.
+  std::atomic<uint64_t> sequence;
+  std::atomic<bool> connected;
+  std::atomic<int> axis_count;
+  std::atomic<int> button_count;
+  std::atomic<int16_t> axis_values[joystickState::MAX_AXES];
+  std::atomic<uint8_t> button_values[joystickState::MAX_BUTTONS];
+
+  std::atomic<bool> queue_enabled;
+  joystickEvent queue[QUEUE_SIZE];
+  std::atomic<uint32_t> queue_head;  // Consumer position.
+  std::atomic<uint32_t> queue_tail;  // Producer position.
+  std::atomic<uint64_t> queue_dropped;
 };
 
 #endif
@@ -0,0 +1,116 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+enum logLevel
+{
+  LOG_LEVEL_OFF,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_WARNING,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_DEBUG
+};
+
+// Per call site state of the log macros: at most BURST messages per second get through, the rest are counted and
+// reported with the next message that does.
+class log_site
+{
+public:
+  constexpr log_site(const char* file, int line)
+    : file(file), line(line), window_start_ns(0), in_window(0), suppressed(0)
+  {
+  }
+
+  // Returns false if the message should be dropped; otherwise suppressed_count is how many were dropped since the last
+  // one that got through.
+  bool allow(uint64_t& suppressed_count);
+
+  const char* const file;
+  const int line;
+
+private:
+  static const uint32_t BURST = 5;
+  static const int64_t WINDOW_NS = 1000000000LL;
+
+  std::atomic<int64_t> window_start_ns;
+  std::atomic<uint32_t> in_window;
+  std::atomic<uint64_t> suppressed;
+};
+
+// Asynchronous logger behind the CERR_ENDL / WARN_ENDL / COUT_ENDL / DEBUG_ENDL macros in debug.h.
+//
+// The calling thread formats the message into a fixed thread-local buffer and copies it into a bounded lock-free
+// queue, without allocating; a background thread writes queued messages to stderr. Callers never block on the
+// terminal: if the queue is full the message is dropped and counted. Messages below the current level cost one relaxed
+// load, and each call site is rate-limited, so an error repeated on every frame cannot flood the output or slow down
+// capture.
+//
+// The level starts at info, or at $V4L2_LOG_LEVEL (off, error, warning, info or debug) when set.
+class logger
+{
+public:
+  // The process-wide logger. It is never destroyed; queued messages are written out at exit.
+  static logger& instance();
+
+  static bool enabled(logLevel level)
+  {
+    return level <= current_level.load(std::memory_order_relaxed);
+  }
+  static void set_level(logLevel level);
+  static logLevel level();
+
+  // Parses "off", "error", "warning", "info" or "debug".
+  static bool parse_level(const std::string& text, logLevel& level);
+
+  // Thread-local stream for formatting a message, emptied. Text past MESSAGE_BYTES is cut off.
+  static std::ostream& stream();
+
+  // Queues the message formatted into stream() by this thread.
+  void write(logLevel level, const log_site& site, uint64_t suppressed);
+
+  static const size_t MESSAGE_BYTES = 240;
+
+  // Writes out everything queued so far from the calling thread.
+  void flush();
+
+  uint64_t dropped() const;
+
+private:
+  logger();
+  logger(const logger&);
+  logger& operator=(const logger&);
+
+  struct entry;
+
+  void run();
+  size_t drain(std::FILE* out);
+  static void flush_at_exit();
+
+  static const size_t QUEUE_ENTRIES = 512;  // Power of two.
+
+  static std::atomic<int> current_level;
+
+  // Bounded multi-producer queue: each entry's sequence number says whether it is free for the producer that claimed
+  // its position or holds a message for the consumer.
+  entry* entries;
+  std::atomic<size_t> enqueue_pos;
+  size_t dequeue_pos;
+
+  std::mutex consumer_mutex;  // One consumer at a time: the writer thread or flush().
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  std::atomic<uint64_t> dropped_messages;
+  uint64_t reported_drops;
+  std::thread writer;
+};
+
+#endif
@@ -1,17 +1,24 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
-#define DEBUG
-
 #include <QMainWindow>
-#include <QTimer>
 #include <QGridLayout>
 #include <QSlider>
 #include <QLabel>
 #include <QCheckBox>
+#include <QElapsedTimer>
+#include <atomic>
 #include <iostream>
 #include "usb_camera.h"
+#include "device_registry.h"
+#include "control_writer.h"
+#include "recorder.h"
+#include "pretrigger_buffer.h"
+#include "mjpeg_server.h"
+#include "shm_publisher.h"
 #include "joystick.h"
+#include "ptz_controller.h"
+#include "video_widget.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui
@@ -28,10 +35,20 @@ public:
   MainWindow(QWidget* parent = nullptr);
   ~MainWindow();
 
+  // Serves the camera's MJPEG stream over HTTP while streaming MJPEG, for the lifetime of the window.
+  bool serve_http(const std::string& address, uint16_t port);
+
+  // Publishes every stream to the shared memory ring name for other local processes (see shm_frame.h).
+  void publish_shm(const std::string& name);
+
+  // Writes the span trace to path on exit, and whenever F12 is pressed.
+  void set_trace_file(const QString& path);
+
 private slots:
   void on_stream_clicked();
   void on_reset_clicked();
   void on_quality_currentIndexChanged(int index);
+  void on_format_currentIndexChanged(int index);
   void on_devices_currentIndexChanged(int index);
 
   void on_brightnessSlider_valueChanged(int value);
@@ -53,21 +70,64 @@ private slots:
   void on_zoomSlider_valueChanged(int value);
   void on_focusSlider_valueChanged(int value);
   void on_focusAuto_stateChanged(int arg1);
+  void on_fastScaling_stateChanged(int arg1);
+  void on_record_clicked();
+  void on_saveIncident_clicked();
 
 private slots:
   void update_frame();
+  void handle_device_event(int type, int id, int value);
+  void handle_hotplug(int event, const QString& path);
+  void handle_control_value(int control_id, int value);
+  void trigger_incident();
 
 private:
   Ui::MainWindow* ui;
   usb_cam* m_camera;
+  device_registry* m_registry;
+  control_writer* m_controls;
+  recorder* m_recorder;
+  pretrigger_buffer* m_pretrigger;
   Joystick* m_joystick;
-  QTimer* streamTimer;
+  ptz_controller* m_ptz;
+  mjpeg_server* m_http;
+  shm_publisher* m_shm;
+  std::string shm_name;
+  std::atomic<bool> frame_pending;
+  std::atomic<bool> http_publish;
+  std::atomic<bool> shm_publish;
 
   std::vector<deviceData> devices;
   m_deviceInfo device_info;
+  std::vector<std::pair<int, int>> frame_sizes;
+  std::vector<float> frame_rates;
+  m_deviceConfig stream_config;
+  // Timestamps of the frame last handed to the video widget, reported as presented once it is painted.
+  frameData shown_frame;
+  // What the STREAM/STOP button shows. The camera's own streaming flag drops as soon as its capture loop ends, e.g.
+  // on a resolution change that still has to be handled here.
+  bool stream_on;
+
+  QString hud_text;
+  QElapsedTimer hud_timer;
+  static const int HUD_REFRESH_MS = 250;
+
+  // The pre-trigger ring keeps this much video while streaming; SAVE adds the following POST_TRIGGER_SECONDS.
+  static constexpr double PRETRIGGER_SECONDS = 10.0;
+  static const size_t PRETRIGGER_BYTES = 128 << 20;
+  static constexpr double POST_TRIGGER_SECONDS = 5.0;
+  static const int INCIDENT_BUTTON = 0;
+  static const int FIRST_PRESET_BUTTON = 1;
 
+  void populate_devices();
+  void start_controls();
+  void stop_controls();
   void read_device_value();
+  void update_hud();
+  void stop_recording();
+  void start_stream(const m_deviceConfig& config);
+  void stop_stream();
+  void sync_control(int control_id, int value);
   void set_qslider_from_query(QSlider* slider, QLabel* label, int control_id);
-  void set_qslider_from_query(QSlider* slider, QLabel* label, QCheckBox* check, int control_id_auto, int control_id);
 };
 #endif  // MAINWINDOW_H
@@ -0,0 +1,35 @@
+#ifndef MJPEG_DECODER_H
+#define MJPEG_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <opencv2/core.hpp>
+
+// MJPEG frame decoder that decodes straight to display size.
+//
+// With libjpeg-turbo available the decompressor handle is created once and reused, and each frame is decoded with the
+// smallest DCT scaling factor (1/1, 1/2, 1/4 or 1/8) whose output still covers the image letterboxed into the target
+// box, directly into 4-channel BGRX (QImage::Format_RGB32 layout). Output images come from frame_pool, so a buffer
+// is only recycled once no consumer holds a reference to it anymore. Without libjpeg-turbo it falls back to full-size
+// cv::imdecode into 3-channel BGR.
+class mjpeg_decoder
+{
+public:
+  mjpeg_decoder();
+  ~mjpeg_decoder();
+
+  // A target of 0x0 decodes at full resolution, e.g. for snapshots and recording.
+  bool decode(const uint8_t* data, size_t size, int target_width, int target_height, cv::Mat& out);
+
+private:
+  mjpeg_decoder(const mjpeg_decoder&);
+  mjpeg_decoder& operator=(const mjpeg_decoder&);
+
+  // TurboJPEG state, kept as plain types so this header does not depend on turbojpeg.h or HAVE_TURBOJPEG.
+  void* handle;
+  std::vector<std::pair<int, int>> factors;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef MJPEG_SERVER_H
+#define MJPEG_SERVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct mjpegServerStats
+{
+  uint64_t clients = 0;            // Currently connected viewers.
+  uint64_t frames_published = 0;
+  uint64_t frames_sent = 0;        // Summed over all viewers.
+  uint64_t frames_skipped = 0;     // Frames viewers missed because they were still sending an older one.
+  uint64_t publish_dropped = 0;    // Frames not published because every buffer was pinned by a viewer.
+};
+
+// Serves a camera's MJPEG stream over HTTP as multipart/x-mixed-replace, for viewing from a browser or VLC.
+//
+// publish() copies the camera's JPEG buffer once into a reference-counted frame; every viewer then sends from that
+// same buffer with sendmsg(), so fan-out costs no copies and no JPEG work. Viewers are served by one epoll thread with
+// non-blocking sockets. Each viewer always sends the newest frame once it has finished the previous one and skips
+// whatever was published in between, so a slow viewer only lowers its own frame rate and never holds up capture or
+// other viewers. Viewers that make no progress for STALL_TIMEOUT_MS are disconnected.
+//
+//   GET /             the stream
+//   GET /stream.mjpg  the stream
+//   GET /snapshot.jpg the newest frame as a single JPEG
+class mjpeg_server
+{
+public:
+  mjpeg_server();
+  ~mjpeg_server();
+
+  // address is an IPv4 address to bind, e.g. "127.0.0.1" (local only) or "0.0.0.0". Port 0 picks a free port.
+  bool start(const std::string& address, uint16_t port, size_t max_clients = 64);
+  void stop();
+  bool running() const;
+  uint16_t port() const;
+
+  // Capture thread side. Never blocks on viewers.
+  void publish(const uint8_t* data, size_t size, int64_t timestamp_ns);
+
+  mjpegServerStats get_stats();
+
+  // Parses "ADDRESS:PORT" or "PORT" (binds 127.0.0.1).
+  static bool parse_endpoint(const std::string& text, std::string& address, uint16_t& port);
+
+private:
+  mjpeg_server(const mjpeg_server&);
+  mjpeg_server& operator=(const mjpeg_server&);
+
+  struct frame;
+  struct client;
+
+  void run();
+  frame* acquire_latest();
+  void release(frame* f);
+  void accept_clients();
+  void read_request(client* c);
+  void start_frame(client* c, frame* f);
+  void send_pending(client* c);
+  void set_writable(client* c, bool writable);
+  void close_client(client* c);
+
+  static const int STALL_TIMEOUT_MS = 10000;
+
+  int listen_fd;
+  int epoll_fd;
+  int wake_fd;
+  uint16_t bound_port;
+  size_t max_clients;
+
+  // Frame buffers are recycled once nothing references them. The capture thread only takes unreferenced ones, which
+  // nothing else can reach, so the latest pointer is the only state it shares with the server thread.
+  std::vector<std::unique_ptr<frame>> frames;
+  std::mutex latest_mutex;
+  frame* latest;
+  uint64_t next_sequence;
+
+  std::vector<std::unique_ptr<client>> clients;
+
+  std::atomic<bool> is_running;
+  std::thread server_thread;
+
+  std::atomic<uint64_t> frames_published;
+  std::atomic<uint64_t> frames_sent;
+  std::atomic<uint64_t> frames_skipped;
+  std::atomic<uint64_t> publish_dropped;
+  std::atomic<uint64_t> client_count;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Converters from uncompressed V4L2 pixel formats to 32-bit xRGB.
+//
+// The output layout is B, G, R, 0xff in memory, which is both a CV_8UC4 BGRA cv::Mat and a QImage::Format_RGB32
+// image on little-endian hosts, so a converted frame can be displayed without another swizzle. YUV input is treated
+// as BT.601 limited range. The row kernels use AVX2 or SSE2 when the CPU has them and fall back to scalar code.
+
+// Returns true if convert_to_rgb32() can handle the given V4L2 fourcc.
+bool pixel_format_supported(uint32_t fourcc);
+
+// Converts one frame. src_stride is the driver's bytesperline for the (first) plane, dst_stride is the output row
+// pitch in bytes. Returns false if the format is unsupported or src_size is too small for the given geometry.
+bool convert_to_rgb32(uint32_t fourcc, const uint8_t* src, size_t src_size, int width, int height, int src_stride,
+                      uint8_t* dst, int dst_stride);
+
+// Name of the SIMD path selected at runtime ("avx2", "sse2" or "scalar").
+const char* pixel_format_simd_path();
+
+// Switches to the named path, for checking the paths against each other. Returns false if this CPU cannot run it.
+// Must not be called while a conversion is running.
+bool pixel_format_force_simd_path(const char* name);
+
+#endif
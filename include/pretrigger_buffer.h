@@ -0,0 +1,107 @@
+#ifndef PRETRIGGER_BUFFER_H
+#define PRETRIGGER_BUFFER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/videodev2.h>
+
+#include "usb_camera.h"
+#include "recorder.h"
+
+struct pretriggerStats
+{
+  uint64_t frames_buffered = 0;  // Frames currently held.
+  uint64_t bytes_buffered = 0;
+  uint64_t frames_evicted = 0;
+  uint64_t frames_rejected = 0;  // Larger than the whole arena.
+  uint64_t frames_lost = 0;      // Evicted while a flush still needed them.
+  bool flushing = false;
+};
+
+// Keeps the most recent compressed frames in memory so an event can be saved together with what led up to it.
+//
+// Frames are copied into one arena allocated up front and indexed by a fixed ring of entries; making room only moves
+// the oldest-frame cursor, so capture never allocates once arm() has run. The ring is bounded by bytes, by frame
+// count and by age, whichever is hit first.
+//
+// trigger() saves the buffered frames plus everything captured during the next post_seconds to a file through a
+// recorder (so the container follows the pixel format, see recorder.h). The copy to disk runs on its own thread and
+// reads frames out of the arena as it goes; capture keeps going meanwhile. A trigger during a flush extends it.
+class pretrigger_buffer
+{
+public:
+  pretrigger_buffer();
+  ~pretrigger_buffer();
+
+  // Allocates the arena. format and fps describe the stream and are passed to the recorder on trigger.
+  // A disarmed buffer may be armed while the capture thread is already calling push(), e.g. right after
+  // start_stream() once the format is known; push() ignores frames until arm() returns. disarm(), and arm() on a
+  // buffer that is still armed, must not run concurrently with push(): a push() that saw the buffer armed may still
+  // be copying into the arena. Call disarm() after stop_stream().
+  bool arm(const struct v4l2_pix_format& format, double fps, double seconds, size_t arena_bytes);
+
+  // Stops accepting frames and waits for a running flush to write out what it still has.
+  void disarm();
+  bool armed() const;
+
+  // Capture thread side. Never blocks on disk I/O.
+  void push(const rawFrame& frame);
+
+  // Saves the buffered frames and the next post_seconds of capture to path. Triggers must come from one thread.
+  bool trigger(const std::string& path, double post_seconds);
+  bool flushing() const;
+
+  pretriggerStats get_stats();
+
+private:
+  pretrigger_buffer(const pretrigger_buffer&);
+  pretrigger_buffer& operator=(const pretrigger_buffer&);
+
+  struct entry
+  {
+    size_t offset;
+    size_t size;
+    int64_t timestamp_ns;
+    int64_t dequeue_ns;
+    uint32_t sequence;
+  };
+
+  bool reserve(size_t size, size_t& offset);
+  void evict_oldest();
+  void flush_loop();
+
+  struct v4l2_pix_format format;
+  double fps;
+  int64_t window_ns;
+
+  std::unique_ptr<uint8_t[]> arena;  // Left uninitialized; pages are only touched as frames arrive.
+  size_t arena_size;
+  size_t write_pos;
+  std::vector<entry> index;
+  uint64_t first;  // Number of the oldest frame held; frame n lives in index[n % index.size()].
+  uint64_t count;
+  size_t bytes_used;
+
+  std::vector<uint8_t> scratch;  // Flush thread's copy of the frame it is writing.
+  uint64_t flush_next;           // Next frame number the flush thread writes.
+  int64_t flush_until_ns;        // Flush ends after the first frame dequeued past this time.
+  recorder output;
+
+  mutable std::mutex mutex;
+  std::condition_variable frame_added;
+  std::atomic<bool> is_armed;
+  std::atomic<bool> is_flushing;
+  std::thread flush_thread;
+
+  uint64_t frames_evicted;
+  uint64_t frames_rejected;
+  uint64_t frames_lost;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef PTZ_CONTROLLER_H
+#define PTZ_CONTROLLER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "usb_camera.h"
+#include "joystick.h"
+
+// Drives pan, tilt and zoom from joystick axes at a fixed rate, on its own thread.
+//
+// Axis deflection goes through a deadzone and an expo curve (fine control near the centre, full speed at the stops)
+// and becomes a velocity. Each of pan, tilt and zoom uses the best control the camera has:
+//   speed     V4L2_CID_PAN_SPEED / TILT_SPEED / ZOOM_CONTINUOUS, sent when the speed changes
+//   relative  V4L2_CID_PAN_RELATIVE / TILT_RELATIVE / ZOOM_RELATIVE, one step per tick
+//   absolute  V4L2_CID_PAN_ABSOLUTE / TILT_ABSOLUTE / ZOOM_ABSOLUTE, integrated position, sent only when it moved
+// All of a tick's changes go to the camera in one set_controls() batch. The tick interval follows the measured batch
+// latency, so slow UVC control transfers are not queued faster than the camera takes them.
+//
+// Joystick buttons recall presets: a short press of a preset button moves to the stored absolute position, holding it
+// for PRESET_HOLD_MS stores the current position.
+//
+// Like control_writer, start() after the stream is open and stop() before it is closed.
+class ptz_controller
+{
+public:
+  enum axisMode
+  {
+    PTZ_NONE,
+    PTZ_SPEED,
+    PTZ_RELATIVE,
+    PTZ_ABSOLUTE
+  };
+
+  enum
+  {
+    PAN,
+    TILT,
+    ZOOM,
+    AXES
+  };
+
+  static const int PRESETS = 4;
+
+  ptz_controller(usb_cam* camera, Joystick* joystick);
+  ~ptz_controller();
+
+  void start();
+  void stop();
+  bool running() const;
+
+  // Joystick axis for pan, tilt and zoom; -1 leaves one unmapped. invert flips its direction.
+  void set_axis(int ptz_axis, int joystick_axis, bool invert);
+
+  // deadzone and expo are fractions of full deflection (0-1). Set before start().
+  void set_response(double deadzone, double expo);
+
+  // The first of PRESETS consecutive joystick buttons that select presets, -1 to disable.
+  void set_preset_buttons(int first_button);
+
+  // Handled on the controller thread; return false for an unknown preset or when not running.
+  bool store_preset(int preset);
+  bool recall_preset(int preset);
+
+  axisMode mode(int ptz_axis) const;
+
+  // Average duration of one control batch, in milliseconds.
+  double control_latency_ms() const;
+
+  // Called from the controller thread with every absolute value it sends, so views can follow. Set before start().
+  void set_value_callback(std::function<void(uint32_t id, int32_t value)> callback);
+
+  // Response curve: maps a raw axis value (-32767..32767) to -1..1.
+  static double shape(int value, double deadzone, double expo);
+
+private:
+  ptz_controller(const ptz_controller&);
+  ptz_controller& operator=(const ptz_controller&);
+
+  struct axisControl
+  {
+    axisMode mode = PTZ_NONE;
+    uint32_t id = 0;           // Control driven for this axis.
+    uint32_t absolute_id = 0;  // Absolute control, for presets; 0 if the camera has none.
+    int32_t minimum = 0;
+    int32_t maximum = 0;
+    double rate = 0;           // Units per second at full deflection (relative and absolute modes).
+    double position = 0;       // Absolute mode: integrated target. Relative mode: fraction not yet sent.
+    bool moving = false;
+    int32_t sent = 0;          // Last value sent.
+    int joystick_axis = -1;
+    bool invert = false;
+  };
+
+  struct preset
+  {
+    bool valid = false;
+    std::array<int32_t, AXES> position;
+  };
+
+  void detect_controls();
+  void run();
+  void handle_buttons(int64_t now_ns);
+  void handle_presets();
+  void sync_position(axisControl& axis);
+  void send();
+  void stop_motion();
+
+  static const int PRESET_HOLD_MS = 1000;
+
+  usb_cam* camera;
+  Joystick* joystick;
+  std::function<void(uint32_t, int32_t)> m_callback;
+
+  std::array<axisControl, AXES> axes;
+  double deadzone;
+  double expo;
+  int preset_button;
+  std::array<int64_t, PRESETS> pressed_ns;
+  std::array<preset, PRESETS> presets;
+  std::atomic<int> store_request;   // Preset to store, -1 for none.
+  std::atomic<int> recall_request;  // Preset to recall, -1 for none.
+  std::vector<std::pair<uint32_t, int32_t>> batch;
+
+  std::atomic<int64_t> latency_ns;  // Moving average of one set_controls() batch.
+  std::atomic<bool> is_running;
+  int wake_fd;
+  std::thread worker;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/videodev2.h>
+
+#include "usb_camera.h"
+
+class container_writer;
+
+struct recorderStats
+{
+  uint64_t frames_written = 0;
+  uint64_t frames_dropped = 0;  // Queue was full; the writer could not keep up with the disk.
+  uint64_t bytes_written = 0;
+};
+
+// Records the compressed buffers a camera delivers, without decoding or re-encoding them.
+//
+// push() copies a dequeued buffer into a bounded queue of preallocated slots and returns immediately; if the queue is
+// full the frame is dropped and counted instead of stalling capture. A dedicated thread drains the queue into the
+// container, batching output into large page-aligned write() calls.
+//
+// The container follows the pixel format:
+//   MJPEG  AVI (one video stream, idx1 index), split into new files before the 1 GiB AVI 1.0 limit
+//   H.264  Annex B elementary stream, as the camera sends it
+//   other  frame dump (see frame_file.h)
+// AVI and H.264 get a "<file>.timestamps.txt" sidecar in mkvmerge's timestamp v2 format with each frame's driver
+// timestamp, so the real timing survives, e.g. "mkvmerge -o out.mkv --timestamps 0:rec.avi.timestamps.txt rec.avi".
+class recorder
+{
+public:
+  recorder();
+  ~recorder();
+
+  // fps is the nominal rate written into the container header; the measured rate replaces it on stop().
+  bool start(const std::string& path, const struct v4l2_pix_format& format, double fps, size_t queue_frames = 32);
+
+  // Writes out everything still queued and finalizes the file.
+  void stop();
+
+  bool recording() const;
+
+  // Capture thread side. Never blocks; returns false if the frame was dropped.
+  bool push(const rawFrame& frame);
+  bool push(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence);
+
+  // For producers other than the capture thread: waits for a free slot instead of dropping. Returns false only if the
+  // recorder is stopped.
+  bool push_wait(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence);
+
+  recorderStats get_stats();
+
+private:
+  recorder(const recorder&);
+  recorder& operator=(const recorder&);
+
+  struct slot
+  {
+    std::vector<uint8_t> data;
+    size_t size;
+    int64_t timestamp_ns;
+    uint32_t sequence;
+  };
+
+  void writer_loop();
+  void fill_slot(size_t index, const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence);
+
+  std::unique_ptr<container_writer> container;
+  std::vector<slot> slots;
+  size_t head;  // Next slot the writer takes.
+  size_t tail;  // Next slot the producer fills.
+
+  std::mutex mutex;
+  std::condition_variable frame_ready;
+  std::condition_variable slot_free;
+  std::atomic<bool> running;
+  std::thread writer_thread;
+
+  std::atomic<uint64_t> frames_written;
+  std::atomic<uint64_t> frames_dropped;
+  std::atomic<uint64_t> bytes_written;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef REPLAY_SOURCE_H
+#define REPLAY_SOURCE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "debug.h"
+#include "capture_source.h"
+#include "frame_file.h"
+
+enum replayPacing
+{
+  REPLAY_RECORDED,     // Frames are due at their recorded timestamps, relative to the first one.
+  REPLAY_FIXED_FPS,    // One frame every 1 / config.fps seconds.
+  REPLAY_UNTHROTTLED   // Every frame is due immediately; as fast as decode keeps up.
+};
+
+// Plays a frame dump (see frame_file.h) back as a capture source, so the decode, stats and display stages can be
+// driven without a camera.
+//
+// The file is memory-mapped and its frames are delivered straight from the mapping, exactly as the camera produced
+// them. Pacing uses a CLOCK_MONOTONIC timerfd armed at absolute deadlines, so timing errors never accumulate; if the
+// consumer falls behind, late frames are delivered back to back rather than skipped. Delivered frames carry a
+// monotonic timestamp of when they were due, so latency and fps stats mean the same as for a camera. Several sources
+// can replay the same file at once; the page cache is shared.
+class replay_source : public capture_source
+{
+public:
+  replay_source();
+  ~replay_source();
+
+  // Set before start_stream()/open_stream(). With looping on, the file restarts after its last frame and sequence
+  // numbers keep counting up; otherwise the stream ends and finished() turns true.
+  void set_pacing(replayPacing pacing);
+  void set_loop(bool loop);
+
+  // config.path is the frame file. Format and size come from the file; config.fps is only used by REPLAY_FIXED_FPS,
+  // and to space the end of a one-frame file from its restart. Looping a one-frame file at recorded pace without a
+  // frame rate fails. device_fd() is the pacing timerfd.
+  bool open_stream(const m_deviceConfig& config) override;
+  int device_fd() const override;
+  bool service(short revents) override;
+
+  bool finished() const;
+
+  // Parses "recorded", "fps" or "max".
+  static bool parse_pacing(const std::string& text, replayPacing& pacing);
+
+protected:
+  // Closes the timer and unmaps the file.
+  void close_stream() override;
+
+private:
+  int64_t next_deadline() const;
+  bool arm_timer(int64_t deadline_ns);
+
+  frame_file_reader m_file;
+  replayPacing m_pacing;
+  bool m_loop;
+  double m_fps;
+  std::vector<int64_t> m_offsets;  // Recorded time of each frame since the first, never decreasing.
+  int64_t m_pass_ns;               // Recorded length of one pass through the file, including the last frame.
+  int64_t m_pass_start_ns;         // When the first frame of the current pass is due.
+  size_t m_next;
+  uint64_t m_delivered;
+  uint32_t m_sequence_base;
+  int64_t m_deadline_ns;
+  std::atomic<bool> m_finished;
+  int m_timer_fd;
+};
+
+#endif
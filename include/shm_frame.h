@@ -0,0 +1,233 @@
+#ifndef SHM_FRAME_H
+#define SHM_FRAME_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Shared-memory frame ring, written by shm_publisher and read by any number of local processes.
+//
+// The POSIX shared memory object starts with a 4 KiB header page followed by slot_count page-aligned slots. Each slot
+// is a 64-byte shmFrameSlot with the frame's metadata, followed by up to slot_size bytes of the unmodified V4L2
+// buffer. The publisher fills slots round-robin and then bumps the ring's published count, so the latest frame is
+// always in slot (published - 1) % slot_count.
+//
+// Every slot carries a sequence lock that is odd while the publisher writes it. Readers look at frames in place: they
+// note the lock value, use the frame, and then check the lock is unchanged. A changed lock means the publisher reused
+// the slot meanwhile and whatever was read may be torn. With N slots a reader has N - 1 frame periods to finish with a
+// frame before that happens. Taking the latest frame costs a few loads and no system calls.
+//
+// This header is all a consumer needs; it has no dependencies beyond libc.
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared-memory frames need address-free atomics");
+
+struct shmFrameRingHeader
+{
+  static constexpr uint32_t VERSION = 1;
+
+  char magic[8];  // "V4L2SHM1"
+  uint32_t version;
+  uint32_t slot_count;
+  uint64_t slot_size;    // Payload bytes each slot can hold.
+  uint64_t slot_stride;  // Distance between slots, including the slot header.
+  uint64_t data_offset;  // Offset of the first slot.
+  std::atomic<uint64_t> published;
+  std::atomic<uint32_t> closed;  // Set when the publisher goes away; reopen to follow a new stream.
+};
+
+struct shmFrameSlot
+{
+  static constexpr size_t HEADER_SIZE = 64;
+
+  std::atomic<uint64_t> lock;
+  std::atomic<uint64_t> frame_number;  // 1-based count of frames published, to tell frames apart across slots.
+  std::atomic<int64_t> timestamp_ns;
+  std::atomic<uint32_t> sequence;
+  std::atomic<uint32_t> fourcc;
+  std::atomic<uint32_t> width;
+  std::atomic<uint32_t> height;
+  std::atomic<uint32_t> bytesperline;
+  std::atomic<uint32_t> bytesused;
+};
+
+static_assert(sizeof(shmFrameSlot) <= shmFrameSlot::HEADER_SIZE, "slot header too large");
+
+// A frame as seen in place. data points into the shared mapping and is only trustworthy while
+// shm_frame_reader::valid() still returns true for this view.
+struct shmFrameView
+{
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  uint64_t frame_number = 0;
+  int64_t timestamp_ns = 0;
+  uint32_t sequence = 0;
+  uint32_t fourcc = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t bytesperline = 0;
+
+  const shmFrameSlot* slot = nullptr;
+  uint64_t lock = 0;
+};
+
+class shm_frame_reader
+{
+public:
+  shm_frame_reader() : ring(nullptr), mapping_size(0)
+  {
+  }
+
+  ~shm_frame_reader()
+  {
+    close();
+  }
+
+  // name is the shared memory object name given to the publisher, e.g. "/v4l2-video0".
+  bool open(const std::string& name)
+  {
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+      return false;
+    }
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(shmFrameRingHeader))
+    {
+      mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+      return false;
+    }
+
+    const shmFrameRingHeader* header = static_cast<const shmFrameRingHeader*>(mapping);
+    if (std::memcmp(header->magic, "V4L2SHM1", 8) != 0 || header->version != shmFrameRingHeader::VERSION ||
+        header->slot_count == 0 ||
+        header->data_offset + header->slot_count * header->slot_stride > static_cast<uint64_t>(st.st_size))
+    {
+      munmap(mapping, st.st_size);
+      return false;
+    }
+    ring = header;
+    mapping_size = st.st_size;
+    return true;
+  }
+
+  void close()
+  {
+    if (ring != nullptr)
+    {
+      munmap(const_cast<shmFrameRingHeader*>(ring), mapping_size);
+      ring = nullptr;
+      mapping_size = 0;
+    }
+  }
+
+  bool is_open() const
+  {
+    return ring != nullptr;
+  }
+
+  // True once the publisher has closed the ring; no more frames will arrive in it.
+  bool stale() const
+  {
+    return ring == nullptr || ring->closed.load(std::memory_order_acquire) != 0;
+  }
+
+  uint64_t published() const
+  {
+    return ring == nullptr ? 0 : ring->published.load(std::memory_order_acquire);
+  }
+
+  // Points view at the newest complete frame. Returns false if nothing was published yet or the publisher keeps
+  // lapping the reader.
+  bool latest(shmFrameView& view) const
+  {
+    for (int attempt = 0; ring != nullptr && attempt < 4; ++attempt)
+    {
+      uint64_t count = ring->published.load(std::memory_order_acquire);
+      if (count == 0)
+      {
+        return false;
+      }
+
+      const shmFrameSlot* slot = slot_at((count - 1) % ring->slot_count);
+      uint64_t lock = slot->lock.load(std::memory_order_acquire);
+      if (lock & 1)
+      {
+        continue;
+      }
+
+      view.slot = slot;
+      view.lock = lock;
+      view.frame_number = slot->frame_number.load(std::memory_order_relaxed);
+      view.timestamp_ns = slot->timestamp_ns.load(std::memory_order_relaxed);
+      view.sequence = slot->sequence.load(std::memory_order_relaxed);
+      view.fourcc = slot->fourcc.load(std::memory_order_relaxed);
+      view.width = slot->width.load(std::memory_order_relaxed);
+      view.height = slot->height.load(std::memory_order_relaxed);
+      view.bytesperline = slot->bytesperline.load(std::memory_order_relaxed);
+      view.size = slot->bytesused.load(std::memory_order_relaxed);
+      view.data = reinterpret_cast<const uint8_t*>(slot) + shmFrameSlot::HEADER_SIZE;
+      if (view.size <= ring->slot_size && valid(view))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Returns true if the publisher has not touched the view's slot since latest() returned it, so everything read
+  // through the view so far is a consistent frame.
+  bool valid(const shmFrameView& view) const
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.slot != nullptr && view.slot->lock.load(std::memory_order_relaxed) == view.lock;
+  }
+
+  // Copies the newest frame out, for readers that need to keep it longer than the ring does.
+  bool copy_latest(std::vector<uint8_t>& out, shmFrameView& view) const
+  {
+    for (int attempt = 0; attempt < 4; ++attempt)
+    {
+      if (!latest(view))
+      {
+        return false;
+      }
+      out.resize(view.size);
+      std::memcpy(out.data(), view.data, view.size);
+      if (valid(view))
+      {
+        view.data = out.data();
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  shm_frame_reader(const shm_frame_reader&);
+  shm_frame_reader& operator=(const shm_frame_reader&);
+
+  const shmFrameSlot* slot_at(uint64_t index) const
+  {
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(ring);
+    return reinterpret_cast<const shmFrameSlot*>(base + ring->data_offset + index * ring->slot_stride);
+  }
+
+  const shmFrameRingHeader* ring;
+  size_t mapping_size;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SHM_PUBLISHER_H
+#define SHM_PUBLISHER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <linux/videodev2.h>
+
+#include "shm_frame.h"
+#include "usb_camera.h"
+
+struct shmPublisherStats
+{
+  uint64_t frames_published = 0;
+  uint64_t frames_oversized = 0;  // Larger than a slot; skipped.
+};
+
+// Publishes a camera's buffers into a named POSIX shared-memory ring (see shm_frame.h) so other local processes can
+// use the stream without opening the device, which V4L2 allows only one streaming process to do.
+//
+// publish() runs on the capture thread and costs one copy of the V4L2 buffer into the next slot; it never waits for
+// readers. Readers map the ring with shm_frame_reader and look at frames in place.
+class shm_publisher
+{
+public:
+  shm_publisher();
+  ~shm_publisher();
+
+  // Creates (or replaces) the shared memory object name, e.g. "/v4l2-video0", with slot_count slots big enough for
+  // format.sizeimage. Readers of a replaced ring see it as stale and reopen.
+  bool open(const std::string& name, const struct v4l2_pix_format& format, size_t slot_count = 4);
+
+  // Marks the ring stale and removes the name. Readers that have it mapped keep their last frames.
+  void close();
+
+  bool is_open() const;
+  const std::string& name() const;
+
+  // Capture thread side.
+  bool publish(const rawFrame& frame);
+  bool publish(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence);
+
+  shmPublisherStats get_stats() const;
+
+private:
+  shm_publisher(const shm_publisher&);
+  shm_publisher& operator=(const shm_publisher&);
+
+  shmFrameSlot* slot_at(uint64_t index) const;
+
+  static const size_t PAGE = 4096;
+
+  std::string shm_name;
+  shmFrameRingHeader* ring;
+  size_t mapping_size;
+  struct v4l2_pix_format pix_format;
+  uint64_t published;
+
+  std::atomic<uint64_t> frames_published;
+  std::atomic<uint64_t> frames_oversized;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "frame_stats.h"
+
+// Span tracer for the capture hot path, exported as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+//
+// TRACE_SCOPE("name") records the time from the macro to the end of the enclosing block. Each thread appends to its
+// own ring of the last RING_EVENTS spans with a few relaxed stores, so a span costs two clock reads and no locks or
+// allocations; old spans are overwritten, which keeps the tracer cheap enough to leave on. dump() snapshots every
+// ring into a JSON file at any time, and dump_at_exit() does so when the process exits.
+//
+// Names must be string literals (only the pointer is stored). Without ENABLE_TRACING the macros compile to nothing.
+
+struct traceEvent
+{
+  std::atomic<const char*> name;
+  std::atomic<int64_t> begin_ns;
+  std::atomic<int64_t> end_ns;
+  std::atomic<int32_t> tid;
+};
+
+struct traceRing
+{
+  static const size_t RING_EVENTS = 16384;  // Power of two.
+
+  std::atomic<uint64_t> head;  // Spans written so far.
+  std::atomic<bool> in_use;    // Owned by a live thread; retired rings go to the next new thread.
+  traceEvent events[RING_EVENTS];
+};
+
+class tracer
+{
+public:
+  // The process-wide tracer. It is never destroyed, so threads may record until the very end.
+  static tracer& instance();
+
+  // Recording is on by default when tracing is compiled in.
+  static void set_enabled(bool enabled);
+  static bool enabled()
+  {
+    return is_enabled.load(std::memory_order_relaxed);
+  }
+
+  // Labels the calling thread in the trace.
+  static void set_thread_name(const char* name);
+
+  static void record(const char* name, int64_t begin_ns, int64_t end_ns)
+  {
+    traceRing* ring = local_ring;
+    if (ring == nullptr)
+    {
+      ring = instance().attach_thread();
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    traceEvent& event = ring->events[head & (traceRing::RING_EVENTS - 1)];
+    event.name.store(name, std::memory_order_relaxed);
+    event.begin_ns.store(begin_ns, std::memory_order_relaxed);
+    event.end_ns.store(end_ns, std::memory_order_relaxed);
+    event.tid.store(local_tid, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+  }
+
+  // Writes every span still held by any thread. Safe to call while threads keep recording.
+  bool dump(const std::string& path);
+
+  // Dumps to path when the process exits normally.
+  void dump_at_exit(const std::string& path);
+
+private:
+  tracer();
+  tracer(const tracer&);
+  tracer& operator=(const tracer&);
+
+  traceRing* attach_thread();
+  static void dump_exit_handler();
+
+  static std::atomic<bool> is_enabled;
+  static thread_local traceRing* local_ring;
+  static thread_local int32_t local_tid;
+
+  std::mutex mutex;
+  std::vector<traceRing*> rings;
+  std::map<int32_t, std::string> thread_names;
+  std::string exit_path;
+};
+
+class trace_scope
+{
+public:
+  explicit trace_scope(const char* name) : name(name), begin_ns(tracer::enabled() ? monotonic_ns() : 0)
+  {
+  }
+
+  ~trace_scope()
+  {
+    if (begin_ns != 0)
+    {
+      tracer::record(name, begin_ns, monotonic_ns());
+    }
+  }
+
+private:
+  trace_scope(const trace_scope&);
+  trace_scope& operator=(const trace_scope&);
+
+  const char* name;
+  int64_t begin_ns;
+};
+
+#ifdef ENABLE_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) tracer::set_thread_name(name)
+#else
+#define TRACE_SCOPE(name)                                                                                              \
+  do                                                                                                                   \
+  {                                                                                                                    \
+  } while (0)
+#define TRACE_THREAD_NAME(name)                                                                                        \
+  do                                                                                                                   \
+  {                                                                                                                    \
+  } while (0)
+#endif
+
+#endif
@@ -1,34 +1,21 @@
 #ifndef USB_CAMERA_H
 #define USB_CAMERA_H
 
-#define DEBUG
-
-#include <iostream>
-#include <vector>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <string>
+#include <vector>
 #include <linux/videodev2.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/ioctl.h>
-#include <cstring>
-#include <regex>
-#include <dirent.h>
-#include <thread>
-#include <sys/mman.h>
-#include <atomic>
-#include <opencv2/opencv.hpp>
 #include "debug.h"
+#include "capture_source.h"
+#include "capability_cache.h"
 
 struct deviceData
 {
   std::string path;
   std::string device_name;
-};
-
-struct ResolutionInfo
-{
-  std::pair<int, int> resolution;
-  std::vector<float> fps;
+  std::string bus_path;  // Resolved sysfs path of the parent device, e.g. the USB interface.
 };
 
 struct m_deviceInfo
@@ -36,46 +23,91 @@ struct m_deviceInfo
   std::string device_name;
   std::string driver;
   std::string bus_info;
+  uint32_t version = 0;
 
-  std::vector<std::string> formats;
-  std::vector<ResolutionInfo> resolution_info;
+  std::vector<std::string> formats;  // Descriptions, in the same order as format_info.
+  std::vector<FormatInfo> format_info;
 };
 
-struct m_deviceConfig
+// One entry of the device's control table, read once per stream with VIDIOC_QUERYCTRL / VIDIOC_QUERYMENU.
+struct controlInfo
 {
-  std::string path;
-  std::string device_name;
-  std::string format;
-  std::pair<int, int> resolution;
-  float fps;
+  uint32_t id = 0;
+  uint32_t type = 0;
+  std::string name;
+  int32_t minimum = 0;
+  int32_t maximum = 0;
+  int32_t step = 0;
+  int32_t default_value = 0;
+  uint32_t flags = 0;
+  std::vector<std::pair<int64_t, std::string>> menu;  // Menu index and label, or index and value for integer menus.
 };
 
-class usb_cam
+class usb_cam : public capture_source
 {
 public:
   usb_cam();
   ~usb_cam();
 
+  // Lists capture devices from sysfs without opening them; see device_registry for hotplug tracking.
   std::vector<deviceData> find_device();
+
+  // Formats and frame sizes, served from the capability cache when the device was seen before. Frame intervals are
+  // not enumerated here; ask get_frame_rates() for the size the user actually picks.
   m_deviceInfo get_device_info(const std::string& devicePath);
-  void start_stream(const m_deviceConfig& config);
-  void stop_stream();
+  std::vector<float> get_frame_rates(const std::string& devicePath, uint32_t fourcc, int width, int height);
+
+  // open_stream() configures the device and starts streaming; device_fd() is the device itself.
+  bool open_stream(const m_deviceConfig& config) override;
+  int device_fd() const override;
+  bool service(short revents) override;
+
+  // Called on the capture thread for every dequeued V4L2_EVENT_CTRL / V4L2_EVENT_SOURCE_CHANGE event. A resolution
+  // change ends the capture loop; the owner is expected to restart the stream. Set before start_stream().
+  void set_event_callback(std::function<void(const struct v4l2_event&)> callback);
 
   int set_control(int control_id, int value);
   int get_control(int control_id);
+
+  // Answered from the control table built when the stream was opened; no ioctl.
   bool query_control(int control_id, v4l2_queryctrl& queryctl);
+  const std::vector<controlInfo>& controls() const;
+
+  // Batched control I/O: one VIDIOC_G_EXT_CTRLS / VIDIOC_S_EXT_CTRLS for the whole set. Controls the device does not
+  // have are skipped. If the driver rejects the batch, the controls are retried one at a time. get_controls() returns
+  // the values it could read; set_controls() returns false if any control could not be written.
+  bool get_controls(const std::vector<uint32_t>& ids, std::map<uint32_t, int32_t>& values);
+  bool set_controls(const std::vector<std::pair<uint32_t, int32_t>>& values);
+
+  // Writes the default of every writable control in a single batch.
   void reset_controls_to_default();
 
-  cv::Mat m_image;
-  std::atomic<bool> streaming;
+protected:
+  // STREAMOFF, releases the buffers and closes the device.
+  void close_stream() override;
 
 private:
   std::vector<void*> buffers;
   std::vector<size_t> buffer_lengths;
-  std::thread stream_thread;
+  std::vector<int> dmabuf_fds;
+  bufferMemory m_memory;
+  capability_cache m_capabilities;
+  std::vector<controlInfo> m_controls;
+  std::function<void(const struct v4l2_event&)> m_event_callback;
   int m_fd;
 
+  static const int MIN_BUFFER_COUNT = 2;
+  static const int MAX_BUFFER_COUNT = 32;
+
   int xioctl(int fd, int request, void* arg);
+  bool query_identity(int fd, const std::string& devicePath, deviceIdentity& identity);
+  bool init_buffers(const m_deviceConfig& config);
+  void release_buffers();
+  bool dequeue_frame();
+  void load_controls();
+  const controlInfo* find_control(uint32_t id) const;
+  void subscribe_events();
+  bool handle_events();
   std::string get_control_name(int control_id);
 };
 
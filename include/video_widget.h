@@ -0,0 +1,51 @@
+#ifndef VIDEO_WIDGET_H
+#define VIDEO_WIDGET_H
+
+#include <QFrame>
+#include <QImage>
+#include <QPaintEvent>
+#include <QRect>
+#include <QResizeEvent>
+#include <QString>
+
+// Paints the latest video frame, letterboxed to keep its aspect ratio.
+//
+// The target rectangle is only recomputed when the widget or the source size changes. A frame that already matches
+// the target size (e.g. one decoded at display size) is blitted 1:1; otherwise it is scaled while painting, either
+// smoothly or with nearest-neighbour sampling when fast scaling is enabled.
+//
+// setFrame() only schedules a repaint; framePainted() is emitted once per frame, from the paint event that first
+// draws it. Frames replaced before a repaint are never drawn and never reported.
+class VideoWidget : public QFrame
+{
+  Q_OBJECT
+
+public:
+  explicit VideoWidget(QWidget* parent = nullptr);
+
+  void setFrame(const QImage& image);
+  void setOverlayText(const QString& text);
+  void setFastScaling(bool fast);
+  void clear();
+
+  // Size the current source would be drawn at, useful to decode frames at display size.
+  QSize targetSize() const;
+
+signals:
+  void framePainted();
+
+protected:
+  void paintEvent(QPaintEvent* event) override;
+  void resizeEvent(QResizeEvent* event) override;
+
+private:
+  void updateTargetRect();
+
+  QImage frame;
+  QString overlay_text;
+  QRect target_rect;
+  bool fast_scaling;
+  bool frame_unpainted;
+};
+
+#endif
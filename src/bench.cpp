@@ -0,0 +1,1795 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/videodev2.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "capture_engine.h"
+#include "frame_buffer.h"
+#include "frame_decoder.h"
+#include "frame_file.h"
+#include "frame_stats.h"
+#include "mjpeg_server.h"
+#include "shm_publisher.h"
+#include "trace.h"
+#include "pixel_format.h"
+#include "pretrigger_buffer.h"
+#include "replay_source.h"
+#include "usb_camera.h"
+
+// Replays recorded (or synthetic) frames through the decode and handoff code usb_cam runs on its capture thread and
+// reports per-stage timings and allocation counts as JSON. No camera is needed. With --viewers, MJPEG corpora are also
+// served through mjpeg_server to that many localhost viewers. With --shm-readers, the shared-memory ring is checked
+// for torn reads. With --engine-sources, each corpus is replayed by that many sources on one CaptureEngine. With
+// --stop-latency, stopping a stalled stream is timed. With --device, a real camera is streamed
+// with each buffer memory type to compare what they cost per frame.
+
+namespace
+{
+std::atomic<uint64_t> heap_allocations(0);
+std::atomic<uint64_t> heap_bytes(0);
+}  // namespace
+
+void* operator new(size_t size)
+{
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  heap_bytes.fetch_add(size, std::memory_order_relaxed);
+  void* ptr = std::malloc(size ? size : 1);
+  if (ptr == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+namespace
+{
+// cv::Mat pixel buffers do not go through operator new, so count them at the allocator. Buffers from frame_pool bypass
+// the default allocator, but every pool miss also allocates its UMatData with operator new and is counted there.
+class counting_allocator : public cv::MatAllocator
+{
+public:
+  cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                         cv::UMatUsageFlags usage) const override
+  {
+    cv::UMatData* u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+    if (u != nullptr && data == nullptr)
+    {
+      heap_allocations.fetch_add(1, std::memory_order_relaxed);
+      heap_bytes.fetch_add(u->size, std::memory_order_relaxed);
+    }
+    return u;
+  }
+
+  bool allocate(cv::UMatData* data, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override
+  {
+    return cv::Mat::getStdAllocator()->allocate(data, flags, usage);
+  }
+
+  void deallocate(cv::UMatData* data) const override
+  {
+    cv::Mat::getStdAllocator()->deallocate(data);
+  }
+};
+
+struct allocCount
+{
+  uint64_t allocations;
+  uint64_t bytes;
+
+  static allocCount now()
+  {
+    allocCount c = { heap_allocations.load(std::memory_order_relaxed), heap_bytes.load(std::memory_order_relaxed) };
+    return c;
+  }
+};
+
+struct stageResult
+{
+  std::vector<int64_t> samples_ns;
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+
+  void add(int64_t ns, const allocCount& before, const allocCount& after)
+  {
+    samples_ns.push_back(ns);
+    allocations += after.allocations - before.allocations;
+    bytes += after.bytes - before.bytes;
+  }
+};
+
+struct corpus
+{
+  std::string name;
+  uint32_t fourcc = 0;
+  int width = 0;
+  int height = 0;
+  int bytesperline = 0;
+  std::vector<frameFileEntry> frames;
+
+  // Backing store: either a mapped frame file or generated payloads.
+  std::unique_ptr<frame_file_reader> reader;
+  std::vector<std::vector<uint8_t>> payloads;
+};
+
+std::string fourcc_name(uint32_t fourcc)
+{
+  std::string name;
+  for (int i = 0; i < 4; ++i)
+  {
+    char c = static_cast<char>((fourcc >> (8 * i)) & 0xff);
+    if (c != ' ')
+    {
+      name += c;
+    }
+  }
+  return name;
+}
+
+bool parse_size(const std::string& text, int& width, int& height)
+{
+  return std::sscanf(text.c_str(), "%dx%d", &width, &height) == 2 && width >= 0 && height >= 0;
+}
+
+bool load_file(const std::string& path, corpus& c)
+{
+  c.reader.reset(new frame_file_reader());
+  if (!c.reader->open(path))
+  {
+    return false;
+  }
+
+  const frameFileHeader& header = c.reader->header();
+  c.name = path;
+  c.fourcc = header.fourcc;
+  c.width = header.width;
+  c.height = header.height;
+  c.bytesperline = header.bytesperline;
+  c.frames = c.reader->frames();
+  return !c.frames.empty();
+}
+
+// Fills a BGR image with a moving gradient and some texture so consecutive frames differ like real footage.
+void fill_pattern(cv::Mat& bgr, int frame)
+{
+  for (int y = 0; y < bgr.rows; ++y)
+  {
+    uint8_t* row = bgr.ptr(y);
+    for (int x = 0; x < bgr.cols; ++x)
+    {
+      row[3 * x + 0] = static_cast<uint8_t>(x + frame * 4);
+      row[3 * x + 1] = static_cast<uint8_t>(y + frame * 2);
+      row[3 * x + 2] = static_cast<uint8_t>(((x >> 3) ^ (y >> 3)) * 16 + frame);
+    }
+  }
+}
+
+void bgr_to_yuv(const uint8_t* p, int& y, int& u, int& v)
+{
+  int b = p[0], g = p[1], r = p[2];
+  y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+  u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+  v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+bool generate(const std::string& spec, int frame_count, corpus& c)
+{
+  size_t colon = spec.find(':');
+  if (colon == std::string::npos || !parse_size(spec.substr(colon + 1), c.width, c.height) || c.width < 2 ||
+      c.height < 2)
+  {
+    std::fprintf(stderr, "Invalid synthetic corpus: %s (expected FORMAT:WxH)\n", spec.c_str());
+    return false;
+  }
+
+  std::string format = spec.substr(0, colon);
+  c.width &= ~1;
+  c.height &= ~1;
+  c.name = "synthetic:" + spec;
+  if (format == "mjpeg")
+  {
+    c.fourcc = V4L2_PIX_FMT_MJPEG;
+    c.bytesperline = 0;
+  }
+  else if (format == "yuyv")
+  {
+    c.fourcc = V4L2_PIX_FMT_YUYV;
+    c.bytesperline = c.width * 2;
+  }
+  else if (format == "uyvy")
+  {
+    c.fourcc = V4L2_PIX_FMT_UYVY;
+    c.bytesperline = c.width * 2;
+  }
+  else if (format == "yvyu")
+  {
+    c.fourcc = V4L2_PIX_FMT_YVYU;
+    c.bytesperline = c.width * 2;
+  }
+  else if (format == "nv12")
+  {
+    c.fourcc = V4L2_PIX_FMT_NV12;
+    c.bytesperline = c.width;
+  }
+  else if (format == "grey")
+  {
+    c.fourcc = V4L2_PIX_FMT_GREY;
+    c.bytesperline = c.width;
+  }
+  else if (format == "rgb24")
+  {
+    c.fourcc = V4L2_PIX_FMT_RGB24;
+    c.bytesperline = c.width * 3;
+  }
+  else
+  {
+    std::fprintf(stderr, "Unsupported synthetic format: %s (mjpeg, yuyv, uyvy, yvyu, nv12, grey or rgb24)\n",
+                 format.c_str());
+    return false;
+  }
+
+  cv::Mat bgr(c.height, c.width, CV_8UC3);
+  for (int i = 0; i < frame_count; ++i)
+  {
+    fill_pattern(bgr, i);
+    std::vector<uint8_t> payload;
+    if (c.fourcc == V4L2_PIX_FMT_MJPEG)
+    {
+      cv::imencode(".jpg", bgr, payload);
+    }
+    else if (c.fourcc == V4L2_PIX_FMT_NV12)
+    {
+      payload.resize(c.width * c.height * 3 / 2);
+      uint8_t* chroma = &payload[c.width * c.height];
+      for (int y = 0; y < c.height; ++y)
+      {
+        const uint8_t* row = bgr.ptr(y);
+        for (int x = 0; x < c.width; ++x)
+        {
+          int yy, u, v;
+          bgr_to_yuv(row + 3 * x, yy, u, v);
+          payload[y * c.width + x] = static_cast<uint8_t>(yy);
+          if (!(y & 1) && !(x & 1))
+          {
+            chroma[(y / 2) * c.width + x] = static_cast<uint8_t>(u);
+            chroma[(y / 2) * c.width + x + 1] = static_cast<uint8_t>(v);
+          }
+        }
+      }
+    }
+    else if (c.fourcc == V4L2_PIX_FMT_GREY || c.fourcc == V4L2_PIX_FMT_RGB24)
+    {
+      bool grey = c.fourcc == V4L2_PIX_FMT_GREY;
+      payload.resize(c.bytesperline * c.height);
+      for (int y = 0; y < c.height; ++y)
+      {
+        const uint8_t* row = bgr.ptr(y);
+        uint8_t* out = &payload[y * c.bytesperline];
+        for (int x = 0; x < c.width; ++x)
+        {
+          if (grey)
+          {
+            int yy, u, v;
+            bgr_to_yuv(row + 3 * x, yy, u, v);
+            out[x] = static_cast<uint8_t>(yy);
+          }
+          else
+          {
+            out[3 * x + 0] = row[3 * x + 2];
+            out[3 * x + 1] = row[3 * x + 1];
+            out[3 * x + 2] = row[3 * x + 0];
+          }
+        }
+      }
+    }
+    else
+    {
+      // Byte offsets of Y0, U, Y1 and V inside each macropixel.
+      int ly = 0, lu = 1, ly1 = 2, lv = 3;
+      if (c.fourcc == V4L2_PIX_FMT_UYVY)
+      {
+        lu = 0, ly = 1, lv = 2, ly1 = 3;
+      }
+      else if (c.fourcc == V4L2_PIX_FMT_YVYU)
+      {
+        lv = 1, lu = 3;
+      }
+      payload.resize(c.width * c.height * 2);
+      for (int y = 0; y < c.height; ++y)
+      {
+        const uint8_t* row = bgr.ptr(y);
+        uint8_t* out = &payload[y * c.bytesperline];
+        for (int x = 0; x < c.width; x += 2)
+        {
+          int y0, y1, u, v, u1, v1;
+          bgr_to_yuv(row + 3 * x, y0, u, v);
+          bgr_to_yuv(row + 3 * (x + 1), y1, u1, v1);
+          u = (u + u1 + 1) >> 1;
+          v = (v + v1 + 1) >> 1;
+          uint8_t* px = out + 2 * x;
+          px[ly] = static_cast<uint8_t>(y0);
+          px[lu] = static_cast<uint8_t>(u);
+          px[ly1] = static_cast<uint8_t>(y1);
+          px[lv] = static_cast<uint8_t>(v);
+        }
+      }
+    }
+    c.payloads.push_back(std::move(payload));
+  }
+
+  for (size_t i = 0; i < c.payloads.size(); ++i)
+  {
+    frameFileEntry entry = { c.payloads[i].data(), c.payloads[i].size(), static_cast<int64_t>(i) * 33333333,
+                             static_cast<uint32_t>(i) };
+    c.frames.push_back(entry);
+  }
+  return true;
+}
+
+void print_stage(std::FILE* out, const char* name, stageResult& stage, bool last)
+{
+  std::vector<int64_t>& s = stage.samples_ns;
+  std::sort(s.begin(), s.end());
+  double total = 0;
+  for (int64_t ns : s)
+  {
+    total += ns;
+  }
+  double n = s.empty() ? 1.0 : static_cast<double>(s.size());
+  double mean = total / n;
+  int64_t p50 = s.empty() ? 0 : s[s.size() / 2];
+  int64_t p99 = s.empty() ? 0 : s[std::min(s.size() - 1, s.size() * 99 / 100)];
+
+  std::fprintf(out,
+               "        \"%s\": {\"ns_per_frame\": %.0f, \"p50_ns\": %lld, \"p99_ns\": %lld, \"frames_per_s\": %.1f, "
+               "\"allocations_per_frame\": %.3f, \"bytes_allocated_per_frame\": %.0f}%s\n",
+               name, mean, static_cast<long long>(p50), static_cast<long long>(p99), mean > 0 ? 1e9 / mean : 0.0,
+               stage.allocations / n, stage.bytes / n, last ? "" : ",");
+}
+
+// Runs one corpus at one target size. Returns false if any frame fails to decode, or with check_allocs if the
+// measured (post-warm-up) frames allocated anything.
+bool run(std::FILE* out, const corpus& c, int target_width, int target_height, size_t min_frames, bool check_allocs,
+         bool first)
+{
+  frame_decoder decoder;
+  decoder.set_format(c.fourcc, c.width, c.height, c.bytesperline);
+  decoder.set_target_size(target_width, target_height);
+
+  // The consumer keeps the last frame it took, like the GUI does while the frame is on screen, so reused decode
+  // buffers rotate exactly as they do live.
+  triple_buffer<frameData> frames;
+  frameData presented;
+
+  stageResult decode, handoff, pipeline;
+  size_t warmup = std::min<size_t>(c.frames.size(), 10);
+  size_t total = warmup + std::max(min_frames, c.frames.size());
+  bool ok = true;
+  int output_width = 0;
+  int output_height = 0;
+
+  for (size_t i = 0; i < total; ++i)
+  {
+    const frameFileEntry& entry = c.frames[i % c.frames.size()];
+
+    allocCount a0 = allocCount::now();
+    int64_t t0 = monotonic_ns();
+    cv::Mat img;
+    if (!decoder.decode(entry.data, entry.size, img))
+    {
+      ok = false;
+    }
+    int64_t t1 = monotonic_ns();
+    allocCount a1 = allocCount::now();
+
+    frameData& slot = frames.write_slot();
+    slot.image = std::move(img);
+    slot.sequence = entry.sequence;
+    slot.timestamp_ns = entry.timestamp_ns;
+    slot.decode_ns = t1 - t0;
+    frames.publish();
+    if (frames.update())
+    {
+      presented = frames.read_slot();
+    }
+    int64_t t2 = monotonic_ns();
+    allocCount a2 = allocCount::now();
+
+    if (i >= warmup)
+    {
+      decode.add(t1 - t0, a0, a1);
+      handoff.add(t2 - t1, a1, a2);
+      pipeline.add(t2 - t0, a0, a2);
+    }
+    output_width = presented.image.cols;
+    output_height = presented.image.rows;
+  }
+
+  std::fprintf(out, "%s    {\n", first ? "" : ",\n");
+  std::fprintf(out, "      \"corpus\": \"%s\", \"format\": \"%s\", \"width\": %d, \"height\": %d,\n", c.name.c_str(),
+               fourcc_name(c.fourcc).c_str(), c.width, c.height);
+  std::fprintf(out, "      \"target_width\": %d, \"target_height\": %d, \"output_width\": %d, \"output_height\": %d,\n",
+               target_width, target_height, output_width, output_height);
+  std::fprintf(out, "      \"frames\": %zu, \"decode_errors\": %s,\n", decode.samples_ns.size(), ok ? "false" : "true");
+  std::fprintf(out, "      \"stages\": {\n");
+  print_stage(out, "decode", decode, false);
+  print_stage(out, "handoff", handoff, false);
+  print_stage(out, "pipeline", pipeline, true);
+  std::fprintf(out, "      }\n    }");
+
+  if (check_allocs && pipeline.allocations > 0)
+  {
+    std::fprintf(stderr, "%s at %dx%d: %llu heap allocations in %zu frames after warm-up\n", c.name.c_str(),
+                 target_width, target_height, static_cast<unsigned long long>(pipeline.allocations),
+                 pipeline.samples_ns.size());
+    ok = false;
+  }
+  return ok;
+}
+
+// A localhost viewer that parses the multipart stream just far enough to count whole frames.
+struct httpViewer
+{
+  int fd = -1;
+  std::string header;
+  size_t body_left = 0;
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+
+  void consume(const char* data, size_t size)
+  {
+    bytes += size;
+    while (size > 0)
+    {
+      if (body_left > 0)
+      {
+        size_t n = std::min(body_left, size);
+        body_left -= n;
+        data += n;
+        size -= n;
+        if (body_left == 0)
+        {
+          ++frames;
+        }
+        continue;
+      }
+      header += *data++;
+      --size;
+      if (header.size() >= 4 && header.compare(header.size() - 4, 4, "\r\n\r\n") == 0)
+      {
+        size_t pos = header.find("Content-Length: ");
+        if (pos != std::string::npos)
+        {
+          body_left = std::strtoul(header.c_str() + pos + 16, nullptr, 10);
+        }
+        header.clear();
+      }
+    }
+  }
+};
+
+// Publishes an MJPEG corpus at a camera-like rate to the given number of viewers and reports what they received.
+// Returns false if a viewer could not connect or the capture side had to drop frames.
+bool run_http(std::FILE* out, const corpus& c, size_t viewers, double fps, size_t min_frames, bool first)
+{
+  mjpeg_server server;
+  if (!server.start("127.0.0.1", 0, viewers))
+  {
+    return false;
+  }
+
+  std::vector<httpViewer> clients(viewers);
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  bool ok = true;
+  for (size_t i = 0; i < viewers; ++i)
+  {
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.port());
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    const char request[] = "GET /stream.mjpg HTTP/1.0\r\n\r\n";
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1 ||
+        send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(request) - 1))
+    {
+      std::fprintf(stderr, "Viewer %zu failed to connect: %s\n", i, std::strerror(errno));
+      if (fd != -1)
+      {
+        close(fd);
+      }
+      ok = false;
+      break;
+    }
+    clients[i].fd = fd;
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &clients[i];
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  std::atomic<bool> reading(ok);
+  std::thread reader([&]() {
+    std::vector<char> buffer(256 << 10);
+    struct epoll_event events[64];
+    while (reading)
+    {
+      int n = epoll_wait(epoll_fd, events, 64, 100);
+      for (int i = 0; i < n; ++i)
+      {
+        httpViewer* v = static_cast<httpViewer*>(events[i].data.ptr);
+        ssize_t got = recv(v->fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (got > 0)
+        {
+          v->consume(buffer.data(), static_cast<size_t>(got));
+        }
+        else if (got == 0)
+        {
+          epoll_ctl(epoll_fd, EPOLL_CTL_DEL, v->fd, nullptr);
+        }
+      }
+    }
+  });
+
+  // Give the server a moment to take every request before the clock starts.
+  usleep(200000);
+
+  stageResult publish;
+  size_t warmup = std::min<size_t>(c.frames.size(), 10);
+  size_t total = ok ? warmup + std::max(min_frames, c.frames.size()) : 0;
+  int64_t interval_ns = static_cast<int64_t>(1e9 / fps);
+  int64_t start_ns = monotonic_ns();
+  for (size_t i = 0; i < total; ++i)
+  {
+    int64_t due = start_ns + static_cast<int64_t>(i) * interval_ns;
+    int64_t now = monotonic_ns();
+    if (due > now)
+    {
+      usleep(static_cast<useconds_t>((due - now) / 1000));
+    }
+
+    const frameFileEntry& entry = c.frames[i % c.frames.size()];
+    allocCount a0 = allocCount::now();
+    int64_t t0 = monotonic_ns();
+    server.publish(entry.data, entry.size, entry.timestamp_ns);
+    int64_t t1 = monotonic_ns();
+    allocCount a1 = allocCount::now();
+    if (i >= warmup)
+    {
+      publish.add(t1 - t0, a0, a1);
+    }
+  }
+  double elapsed = (monotonic_ns() - start_ns) / 1e9;
+
+  // Let the viewers finish the frame they are on.
+  usleep(200000);
+  reading = false;
+  reader.join();
+  mjpegServerStats stats = server.get_stats();
+  server.stop();
+
+  uint64_t min_frames_seen = viewers ? UINT64_MAX : 0;
+  uint64_t total_frames = 0;
+  uint64_t total_bytes = 0;
+  for (httpViewer& v : clients)
+  {
+    min_frames_seen = std::min(min_frames_seen, v.frames);
+    total_frames += v.frames;
+    total_bytes += v.bytes;
+    if (v.fd != -1)
+    {
+      close(v.fd);
+    }
+  }
+  close(epoll_fd);
+
+  double seconds = elapsed > 0 ? elapsed : 1.0;
+  std::fprintf(out, "%s    {\n", first ? "" : ",\n");
+  std::fprintf(out, "      \"corpus\": \"%s\", \"http_viewers\": %zu, \"published_fps\": %.1f,\n", c.name.c_str(),
+               viewers, stats.frames_published / seconds);
+  std::fprintf(out,
+               "      \"viewer_fps\": %.1f, \"min_viewer_fps\": %.1f, \"viewer_mbit_per_s\": %.1f, "
+               "\"frames_skipped\": %llu, \"publish_dropped\": %llu,\n",
+               viewers ? total_frames / seconds / viewers : 0.0, min_frames_seen / seconds,
+               viewers ? total_bytes * 8 / seconds / viewers / 1e6 : 0.0,
+               static_cast<unsigned long long>(stats.frames_skipped),
+               static_cast<unsigned long long>(stats.publish_dropped));
+  std::fprintf(out, "      \"stages\": {\n");
+  print_stage(out, "publish", publish, true);
+  std::fprintf(out, "      }\n    }");
+
+  return ok && stats.publish_dropped == 0;
+}
+
+// Publishes into a two-slot shared-memory ring as fast as possible while reader threads inspect the latest frame in
+// place. Every payload byte carries its frame number, so a reader can tell a torn frame from a whole one. Returns false
+// if a reader ever accepted a torn frame, i.e. the sequence lock missed a concurrent write.
+bool run_shm(std::FILE* out, size_t readers, size_t frame_count, bool first)
+{
+  const size_t FRAME_SIZE = 1 << 20;
+  struct v4l2_pix_format format;
+  std::memset(&format, 0, sizeof(format));
+  format.pixelformat = V4L2_PIX_FMT_MJPEG;
+  format.width = 1280;
+  format.height = 720;
+  format.sizeimage = FRAME_SIZE;
+
+  std::string name = "/v4l2_bench-" + std::to_string(getpid());
+  shm_publisher publisher;
+  if (!publisher.open(name, format, 2))
+  {
+    return false;
+  }
+
+  std::atomic<bool> publishing(true);
+  std::atomic<uint64_t> whole(0), torn_detected(0), torn_accepted(0), misses(0), open_failures(0);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < readers; ++i)
+  {
+    threads.emplace_back([&]() {
+      shm_frame_reader reader;
+      if (!reader.open(name))
+      {
+        ++open_failures;
+        return;
+      }
+      while (publishing)
+      {
+        shmFrameView view;
+        if (!reader.latest(view))
+        {
+          ++misses;
+          continue;
+        }
+        uint8_t expected = static_cast<uint8_t>(view.frame_number);
+        bool consistent = view.size == FRAME_SIZE;
+        for (size_t j = 0; consistent && j < view.size; j += 64)
+        {
+          consistent = view.data[j] == expected && view.data[view.size - 1 - j] == expected;
+        }
+        if (!reader.valid(view))
+        {
+          ++torn_detected;
+        }
+        else if (!consistent)
+        {
+          ++torn_accepted;
+        }
+        else
+        {
+          ++whole;
+        }
+      }
+    });
+  }
+
+  std::vector<uint8_t> payload(FRAME_SIZE);
+  stageResult publish;
+  int64_t start_ns = monotonic_ns();
+  for (size_t i = 0; i < frame_count; ++i)
+  {
+    std::memset(payload.data(), static_cast<uint8_t>(i + 1), payload.size());
+    allocCount a0 = allocCount::now();
+    int64_t t0 = monotonic_ns();
+    publisher.publish(payload.data(), payload.size(), t0, static_cast<uint32_t>(i));
+    int64_t t1 = monotonic_ns();
+    publish.add(t1 - t0, a0, allocCount::now());
+  }
+  double elapsed = (monotonic_ns() - start_ns) / 1e9;
+  publishing = false;
+  for (std::thread& t : threads)
+  {
+    t.join();
+  }
+  publisher.close();
+
+  std::fprintf(out, "%s    {\n", first ? "" : ",\n");
+  std::fprintf(out, "      \"shm_readers\": %zu, \"frames\": %zu, \"published_fps\": %.1f,\n", readers, frame_count,
+               elapsed > 0 ? frame_count / elapsed : 0.0);
+  std::fprintf(out, "      \"reads\": %llu, \"torn_detected\": %llu, \"torn_accepted\": %llu, \"misses\": %llu,\n",
+               static_cast<unsigned long long>(whole), static_cast<unsigned long long>(torn_detected),
+               static_cast<unsigned long long>(torn_accepted), static_cast<unsigned long long>(misses));
+  std::fprintf(out, "      \"stages\": {\n");
+  print_stage(out, "publish", publish, true);
+  std::fprintf(out, "      }\n    }");
+
+  if (open_failures > 0)
+  {
+    std::fprintf(stderr, "%llu shared-memory readers failed to open %s\n",
+                 static_cast<unsigned long long>(open_failures), name.c_str());
+  }
+  if (torn_accepted > 0)
+  {
+    std::fprintf(stderr, "Shared-memory readers accepted %llu torn frames\n",
+                 static_cast<unsigned long long>(torn_accepted));
+  }
+  return open_failures == 0 && torn_accepted == 0;
+}
+
+// Converts pseudo-random frames of every uncompressed format with each SIMD path this CPU can run and requires the
+// output to be byte-identical to the scalar path. Covers odd widths (so the scalar tail runs after every vector
+// kernel), padded source strides and padded output rows, whose padding must stay untouched. Source buffers are
+// allocated at exactly the minimum size, so an over-read shows up under AddressSanitizer.
+bool check_formats(std::FILE* out, bool first)
+{
+  static const uint32_t FORMATS[] = { V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_YVYU,
+                                      V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_RGB24 };
+  static const int WIDTHS[] = { 1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 129, 641 };
+  static const int HEIGHTS[] = { 1, 2, 3, 5 };
+  static const int SRC_PADDING[] = { 0, 3, 64 };
+  static const int DST_PADDING[] = { 0, 12 };
+  static const char* const PATHS[] = { "scalar", "sse2", "avx2" };
+  const uint8_t SENTINEL = 0xa5;
+
+  std::string detected = pixel_format_simd_path();
+  std::vector<const char*> paths;
+  for (const char* path : PATHS)
+  {
+    if (pixel_format_force_simd_path(path))
+    {
+      paths.push_back(path);
+    }
+  }
+
+  bool ok = true;
+  uint32_t seed = 1;
+  for (uint32_t fourcc : FORMATS)
+  {
+    size_t cases = 0, mismatches = 0;
+    for (int width : WIDTHS)
+    {
+      for (int height : HEIGHTS)
+      {
+        for (int src_padding : SRC_PADDING)
+        {
+          for (int dst_padding : DST_PADDING)
+          {
+            int min_stride = width;
+            size_t rows = height;
+            if (fourcc == V4L2_PIX_FMT_YUYV || fourcc == V4L2_PIX_FMT_UYVY || fourcc == V4L2_PIX_FMT_YVYU)
+            {
+              min_stride = (width + 1) / 2 * 4;
+            }
+            else if (fourcc == V4L2_PIX_FMT_NV12)
+            {
+              min_stride = (width + 1) & ~1;
+              rows = height + (height + 1) / 2;
+            }
+            else if (fourcc == V4L2_PIX_FMT_RGB24)
+            {
+              min_stride = width * 3;
+            }
+            int src_stride = min_stride + src_padding;
+            int dst_stride = width * 4 + dst_padding;
+
+            // Only the last row may end at its pixels; anything shorter is rejected by the converter.
+            std::vector<uint8_t> src(static_cast<size_t>(src_stride) * (rows - 1) + min_stride);
+            for (uint8_t& byte : src)
+            {
+              seed = seed * 1103515245u + 12345u;
+              byte = static_cast<uint8_t>(seed >> 16);
+            }
+
+            std::vector<uint8_t> reference;
+            for (const char* path : paths)
+            {
+              pixel_format_force_simd_path(path);
+              std::vector<uint8_t> dst(static_cast<size_t>(dst_stride) * height, SENTINEL);
+              if (!convert_to_rgb32(fourcc, src.data(), src.size(), width, height, src_stride, dst.data(),
+                                    dst_stride))
+              {
+                std::fprintf(stderr, "%s %dx%d stride %d: conversion rejected a valid buffer\n",
+                             fourcc_name(fourcc).c_str(), width, height, src_stride);
+                ++mismatches;
+                continue;
+              }
+              bool padding_intact = true;
+              for (int y = 0; y < height && padding_intact; ++y)
+              {
+                for (int x = width * 4; x < dst_stride; ++x)
+                {
+                  padding_intact = padding_intact && dst[static_cast<size_t>(y) * dst_stride + x] == SENTINEL;
+                }
+              }
+              if (!padding_intact)
+              {
+                std::fprintf(stderr, "%s %dx%d stride %d: %s wrote into the row padding\n",
+                             fourcc_name(fourcc).c_str(), width, height, src_stride, path);
+                ++mismatches;
+              }
+              else if (!reference.empty() && dst != reference)
+              {
+                std::fprintf(stderr, "%s %dx%d stride %d: %s output differs from scalar\n",
+                             fourcc_name(fourcc).c_str(), width, height, src_stride, path);
+                ++mismatches;
+              }
+              if (reference.empty())
+              {
+                reference.swap(dst);
+              }
+            }
+            ++cases;
+          }
+        }
+      }
+    }
+
+    std::fprintf(out, "%s    {\"format_check\": \"%s\", \"paths\": [", first ? "" : ",\n",
+                 fourcc_name(fourcc).c_str());
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      std::fprintf(out, "%s\"%s\"", i ? ", " : "", paths[i]);
+    }
+    std::fprintf(out, "], \"cases\": %zu, \"mismatches\": %zu}", cases, mismatches);
+    first = false;
+    ok = ok && mismatches == 0;
+  }
+
+  pixel_format_force_simd_path(detected.c_str());
+  return ok;
+}
+
+bool write_frame_file(const std::string& path, uint32_t fourcc, int width, int height, int bytesperline,
+                      const std::vector<frameFileEntry>& frames)
+{
+  frame_file_writer writer;
+  if (!writer.open(path, fourcc, width, height, bytesperline))
+  {
+    return false;
+  }
+  for (const frameFileEntry& entry : frames)
+  {
+    if (!writer.write_frame(entry.data, entry.size, entry.timestamp_ns, entry.sequence))
+    {
+      return false;
+    }
+  }
+  writer.close();
+  return true;
+}
+
+size_t thread_count()
+{
+  size_t count = 0;
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr)
+  {
+    return 0;
+  }
+  while (struct dirent* item = readdir(dir))
+  {
+    count += item->d_name[0] != '.';
+  }
+  closedir(dir);
+  return count;
+}
+
+struct engineSource
+{
+  std::unique_ptr<capture_source> source;
+  m_deviceConfig config;
+  std::shared_ptr<std::atomic<size_t>> events;  // Control events the source reported; null if not counted.
+};
+
+// Adds the sources to one CaptureEngine, streams for frames / fps seconds, calling tick every 100 ms, then removes
+// them while frames are still in flight. Fails if any source falls behind the rate, if a counted source saw no
+// events, or if the engine starts threads beyond its fixed pool.
+bool run_engine(std::FILE* out, const std::string& label, std::vector<engineSource>& sources, double fps,
+                size_t frames, std::function<void()> tick, bool first)
+{
+  const int WORKERS = 2;
+
+  bool ok = true;
+  std::vector<captureStats> stats;
+  size_t idle_threads = 0;
+  size_t busy_threads = 0;
+  double elapsed = 0;
+  {
+    CaptureEngine engine(WORKERS);
+    engine.start();
+    idle_threads = thread_count();
+
+    std::vector<capture_source*> added;
+    for (engineSource& entry : sources)
+    {
+      capture_source* s = engine.addSource(std::move(entry.source), entry.config);
+      if (s == nullptr)
+      {
+        ok = false;
+        break;
+      }
+      added.push_back(s);
+    }
+
+    int64_t start_ns = monotonic_ns();
+    int64_t end_ns = start_ns + static_cast<int64_t>(1e9 * frames / fps);
+    int64_t next_tick_ns = start_ns;
+    while (ok && monotonic_ns() < end_ns)
+    {
+      usleep(10000);
+      busy_threads = std::max(busy_threads, thread_count());
+      if (tick && monotonic_ns() >= next_tick_ns)
+      {
+        tick();
+        next_tick_ns += 100000000LL;
+      }
+    }
+    elapsed = (monotonic_ns() - start_ns) / 1e9;
+
+    for (capture_source* s : added)
+    {
+      stats.push_back(s->get_stats());
+    }
+    for (capture_source* s : added)
+    {
+      engine.removeCamera(s);
+    }
+    ok = ok && engine.cameraCount() == 0;
+  }
+
+  std::fprintf(out, "%s    {\n", first ? "" : ",\n");
+  std::fprintf(out,
+               "      \"engine\": \"%s\", \"sources\": %zu, \"workers\": %d, \"rate_fps\": %.1f, "
+               "\"threads_idle\": %zu, \"threads_streaming\": %zu,\n",
+               label.c_str(), sources.size(), WORKERS, fps, idle_threads, busy_threads);
+  std::fprintf(out, "      \"per_source\": [");
+  for (size_t i = 0; i < stats.size(); ++i)
+  {
+    const engineSource& entry = sources[i];
+    double source_fps = elapsed > 0 ? stats[i].frames_captured / elapsed : 0.0;
+    std::fprintf(out, "%s{\"source\": \"%s\", \"frames\": %llu, \"capture_fps\": %.2f, \"frames_dropped\": %llu",
+                 i ? ", " : "", entry.config.path.c_str(), static_cast<unsigned long long>(stats[i].frames_captured),
+                 source_fps, static_cast<unsigned long long>(stats[i].frames_dropped));
+    if (entry.events)
+    {
+      std::fprintf(out, ", \"events\": %zu", entry.events->load());
+      if (*entry.events == 0)
+      {
+        std::fprintf(stderr, "%s: engine source %zu reported no control events\n", label.c_str(), i);
+        ok = false;
+      }
+    }
+    std::fprintf(out, "}");
+    if (source_fps < fps * 0.95)
+    {
+      std::fprintf(stderr, "%s: engine source %zu ran at %.2f fps instead of %.1f\n", label.c_str(), i, source_fps,
+                   fps);
+      ok = false;
+    }
+  }
+  std::fprintf(out, "]\n    }");
+
+  if (busy_threads != idle_threads)
+  {
+    std::fprintf(stderr, "%s: engine ran %zu threads with %zu sources, %zu without\n", label.c_str(), busy_threads,
+                 sources.size(), idle_threads);
+    ok = false;
+  }
+  return ok;
+}
+
+// Replays the corpus from `count` looping replay sources at `fps` each on one engine.
+bool run_engine_replay(std::FILE* out, const corpus& c, size_t count, double fps, size_t frames, bool first)
+{
+  std::string path = "/tmp/v4l2_bench-engine-" + std::to_string(getpid()) + ".v4l2";
+  if (!write_frame_file(path, c.fourcc, c.width, c.height, c.bytesperline, c.frames))
+  {
+    return false;
+  }
+
+  std::vector<engineSource> sources(count);
+  for (engineSource& entry : sources)
+  {
+    replay_source* replay = new replay_source;
+    replay->set_pacing(REPLAY_FIXED_FPS);
+    replay->set_loop(true);
+    entry.source.reset(replay);
+    entry.config.path = path;
+    entry.config.fps = static_cast<float>(fps);
+  }
+  bool ok = run_engine(out, c.name, sources, fps, frames, nullptr, first);
+  unlink(path.c_str());
+  return ok;
+}
+
+// Streams every camera on one engine, e.g. the nodes of `modprobe vivid n_devs=8`. Meanwhile brightness is changed
+// through a second handle on each node, so the control events reach the engine's handle as POLLPRI and are dequeued
+// by usb_cam::service() between buffers, like a change made by another application. Brightness is restored after.
+bool run_engine_devices(std::FILE* out, const std::vector<std::string>& paths, const m_deviceConfig& base,
+                        size_t frames, bool first)
+{
+  std::vector<engineSource> sources(paths.size());
+  std::vector<int> control_fds;
+  std::vector<struct v4l2_queryctrl> brightness;
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    engineSource& entry = sources[i];
+    entry.config = base;
+    entry.config.path = paths[i];
+
+    usb_cam* camera = new usb_cam;
+    entry.source.reset(camera);
+
+    int fd = open(paths[i].c_str(), O_RDWR | O_CLOEXEC);
+    struct v4l2_queryctrl query;
+    memset(&query, 0, sizeof(query));
+    query.id = V4L2_CID_BRIGHTNESS;
+    if (fd == -1 || ioctl(fd, VIDIOC_QUERYCTRL, &query) == -1 || (query.flags & V4L2_CTRL_FLAG_DISABLED) ||
+        query.minimum == query.maximum)
+    {
+      std::fprintf(stderr, "%s: no brightness control, control events not checked\n", paths[i].c_str());
+      if (fd != -1)
+      {
+        close(fd);
+      }
+      continue;
+    }
+    std::shared_ptr<std::atomic<size_t>> events(new std::atomic<size_t>(0));
+    camera->set_event_callback([events](const struct v4l2_event& ev) {
+      if (ev.type == V4L2_EVENT_CTRL)
+      {
+        ++*events;
+      }
+    });
+    entry.events = events;
+    control_fds.push_back(fd);
+    brightness.push_back(query);
+  }
+
+  bool toggle = false;
+  auto tick = [&]() {
+    toggle = !toggle;
+    for (size_t i = 0; i < control_fds.size(); ++i)
+    {
+      struct v4l2_control control;
+      control.id = V4L2_CID_BRIGHTNESS;
+      bool at_max = brightness[i].default_value + brightness[i].step > brightness[i].maximum;
+      int step = at_max ? -brightness[i].step : brightness[i].step;
+      control.value = brightness[i].default_value + (toggle ? step : 0);
+      ioctl(control_fds[i], VIDIOC_S_CTRL, &control);
+    }
+  };
+
+  bool ok = run_engine(out, "devices", sources, base.fps, frames, tick, first);
+
+  for (size_t i = 0; i < control_fds.size(); ++i)
+  {
+    struct v4l2_control control;
+    control.id = V4L2_CID_BRIGHTNESS;
+    control.value = brightness[i].default_value;
+    ioctl(control_fds[i], VIDIOC_S_CTRL, &control);
+    close(control_fds[i]);
+  }
+  return ok;
+}
+
+// Starts the source, waits for its first frame and times stop_stream(), landing at a different point of the capture
+// thread's poll timeout each time. The stop path is capture_source's for every source; only close_stream() differs.
+// Fails if any stop takes longer than one poll timeout.
+bool run_stop_latency(std::FILE* out, capture_source& source, const m_deviceConfig& config, const char* label,
+                      size_t iterations, bool first)
+{
+  const int64_t STOP_BOUND_NS = 200 * 1000000LL;
+
+  std::atomic<int> delivered(0);
+  source.set_frame_callback([&delivered]() { ++delivered; });
+
+  stageResult stop;
+  bool ok = true;
+  int64_t worst = 0;
+  for (size_t i = 0; i < iterations && ok; ++i)
+  {
+    delivered = 0;
+    source.start_stream(config);
+    int64_t deadline = monotonic_ns() + 2000000000LL;
+    while (source.streaming && delivered == 0 && monotonic_ns() < deadline)
+    {
+      usleep(100);
+    }
+    if (delivered == 0)
+    {
+      std::fprintf(stderr, "%s: stream never delivered its first frame\n", label);
+      ok = false;
+      break;
+    }
+    usleep(static_cast<useconds_t>(i * 7919 % 50000));
+
+    allocCount a0 = allocCount::now();
+    int64_t t0 = monotonic_ns();
+    source.stop_stream();
+    int64_t t1 = monotonic_ns();
+    stop.add(t1 - t0, a0, allocCount::now());
+    worst = std::max(worst, t1 - t0);
+  }
+  source.stop_stream();
+
+  std::fprintf(out, "%s    {\n", first ? "" : ",\n");
+  std::fprintf(out, "      \"stop_latency\": \"%s\", \"stops\": %zu, \"worst_ms\": %.3f,\n", label,
+               stop.samples_ns.size(), worst / 1e6);
+  std::fprintf(out, "      \"stages\": {\n");
+  print_stage(out, "stop", stop, true);
+  std::fprintf(out, "      }\n    }");
+
+  if (worst > STOP_BOUND_NS)
+  {
+    std::fprintf(stderr, "%s: stopping the stream took %.1f ms\n", label, worst / 1e6);
+    ok = false;
+  }
+  return ok;
+}
+
+// Stop latency against a source that has stopped delivering: a recording whose second frame is an hour after the
+// first, so after the first frame the capture thread sits in poll() with nothing due, as it does on a stalled camera.
+bool run_stall_latency(std::FILE* out, size_t iterations, bool first)
+{
+  const int WIDTH = 16;
+  const int HEIGHT = 16;
+
+  std::vector<uint8_t> payload(WIDTH * HEIGHT, 0x80);
+  std::vector<frameFileEntry> frames;
+  frameFileEntry entry = { payload.data(), payload.size(), 0, 0 };
+  frames.push_back(entry);
+  entry.timestamp_ns = 3600 * 1000000000LL;
+  entry.sequence = 1;
+  frames.push_back(entry);
+
+  std::string path = "/tmp/v4l2_bench-stall-" + std::to_string(getpid()) + ".v4l2";
+  if (!write_frame_file(path, V4L2_PIX_FMT_GREY, WIDTH, HEIGHT, WIDTH, frames))
+  {
+    return false;
+  }
+
+  m_deviceConfig config;
+  config.path = path;
+  config.fps = 30;
+
+  replay_source source;
+  bool ok = run_stop_latency(out, source, config, "stalled stream", iterations, first);
+  unlink(path.c_str());
+  return ok;
+}
+
+double cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+const char* memory_name(bufferMemory memory)
+{
+  switch (memory)
+  {
+    case MEMORY_MMAP:
+      return "mmap";
+    case MEMORY_USERPTR:
+      return "userptr";
+    case MEMORY_DMABUF:
+      return "dmabuf";
+  }
+  return "unknown";
+}
+
+// Streams the camera once per buffer memory type and reports the process CPU time spent per captured frame, which
+// covers the ioctls, any copy the memory type implies and the decode. Nothing else runs meanwhile, so the figures can
+// be compared directly. A type the driver does not support is reported as such rather than failing the run.
+bool run_memory_sweep(std::FILE* out, const m_deviceConfig& base, size_t frames, bool first)
+{
+  const int WARMUP_FRAMES = 10;
+  const bufferMemory memories[] = { MEMORY_MMAP, MEMORY_USERPTR, MEMORY_DMABUF };
+
+  bool ok = true;
+  for (bufferMemory memory : memories)
+  {
+    m_deviceConfig config = base;
+    config.memory = memory;
+
+    usb_cam camera;
+    std::atomic<size_t> decoded(0);
+    camera.set_frame_callback([&decoded]() { ++decoded; });
+    camera.start_stream(config);
+
+    // Allow for a slow first frame, then twice the time the frames should take at the requested rate.
+    int64_t deadline = monotonic_ns() + 2000000000LL;
+    while (camera.streaming && decoded < WARMUP_FRAMES && monotonic_ns() < deadline)
+    {
+      usleep(1000);
+    }
+    bool started = camera.streaming && decoded >= WARMUP_FRAMES;
+
+    size_t count = 0;
+    double elapsed = 0;
+    double cpu = 0;
+    if (started)
+    {
+      size_t start_count = decoded;
+      int64_t start_ns = monotonic_ns();
+      double cpu_start = cpu_seconds();
+      deadline = start_ns + 2000000000LL + static_cast<int64_t>(2e9 * frames / config.fps);
+      while (camera.streaming && decoded - start_count < frames && monotonic_ns() < deadline)
+      {
+        usleep(1000);
+      }
+      count = decoded - start_count;
+      cpu = cpu_seconds() - cpu_start;
+      elapsed = (monotonic_ns() - start_ns) / 1e9;
+    }
+    captureStats stats = camera.get_stats();
+    struct v4l2_pix_format format = camera.get_format();
+    camera.stop_stream();
+
+    std::fprintf(out, "%s    {\n", first ? "" : ",\n");
+    first = false;
+    std::fprintf(out, "      \"memory\": \"%s\", \"device\": \"%s\", \"format\": \"%s\", \"width\": %u, "
+                 "\"height\": %u,\n",
+                 memory_name(memory), config.path.c_str(), fourcc_name(format.pixelformat).c_str(), format.width,
+                 format.height);
+    if (!started)
+    {
+      std::fprintf(out, "      \"supported\": false\n    }");
+      continue;
+    }
+    std::fprintf(out,
+                 "      \"supported\": true, \"frames\": %zu, \"capture_fps\": %.2f, \"frames_dropped\": %llu, "
+                 "\"cpu_us_per_frame\": %.1f, \"decode_ms_p50\": %.3f\n    }",
+                 count, elapsed > 0 ? count / elapsed : 0.0, static_cast<unsigned long long>(stats.frames_dropped),
+                 count ? cpu * 1e6 / count : 0.0, stats.decode_ms_p50);
+    if (count < frames)
+    {
+      std::fprintf(stderr, "%s: only %zu of %zu frames arrived with %s buffers\n", config.path.c_str(), count, frames,
+                   memory_name(memory));
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Pushes synthetic frames through a pre-trigger buffer in phases that each hit one of its bounds, then triggers and
+// reads the saved file back. Every frame is filled with a pattern derived from its sequence number, so a frame that
+// was overwritten in the arena after a wrap shows up as a mismatch. Checks that the byte, count and age bounds hold
+// exactly, that push() never allocates once armed, and that every frame from the oldest one buffered at the trigger
+// up to the end of the post-trigger window was either written intact and in order or counted as lost.
+bool run_pretrigger(std::FILE* out, bool first)
+{
+  const double SECONDS = 1.0;
+  const double FPS = 100;
+  const size_t ARENA = 64 * 1024;
+  const double POST_SECONDS = 0.5;
+  // Mirrors arm(): the entry ring holds twice the nominal frame count of the window, and at least 64.
+  const size_t CAPACITY = std::max<size_t>(64, static_cast<size_t>(SECONDS * FPS * 2));
+  const int64_t WINDOW_NS = static_cast<int64_t>(SECONDS * 1e9);
+  const int64_t MS = 1000000;
+
+  std::string path = "/tmp/v4l2_bench-pretrigger-" + std::to_string(getpid()) + ".v4l2";
+  struct v4l2_pix_format format;
+  memset(&format, 0, sizeof(format));
+  format.pixelformat = V4L2_PIX_FMT_GREY;
+  format.width = 64;
+  format.height = 64;
+  format.bytesperline = 64;
+  format.sizeimage = 8192;
+
+  pretrigger_buffer buffer;
+  if (!buffer.arm(format, FPS, SECONDS, ARENA))
+  {
+    return false;
+  }
+
+  std::vector<size_t> sizes;
+  std::vector<int64_t> dequeued;
+  std::vector<uint8_t> payload(8192);
+  uint64_t allocations = 0;
+  size_t pushes = 0;
+  bool ok = true;
+
+  auto push = [&](size_t size, int64_t dequeue_ns) {
+    uint32_t sequence = static_cast<uint32_t>(sizes.size());
+    for (size_t j = 0; j < size; ++j)
+    {
+      payload[j] = static_cast<uint8_t>(sequence * 131 + j * 7);
+    }
+    sizes.push_back(size);
+    dequeued.push_back(dequeue_ns);
+
+    rawFrame raw;
+    raw.data = payload.data();
+    raw.bytesused = size;
+    raw.index = 0;
+    raw.dmabuf_fd = -1;
+    raw.sequence = sequence;
+    raw.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    raw.timestamp_ns = dequeue_ns;
+    raw.dequeue_ns = dequeue_ns;
+
+    allocCount a0 = allocCount::now();
+    buffer.push(raw);
+    allocations += allocCount::now().allocations - a0.allocations;
+    ++pushes;
+  };
+  auto variable_size = [](uint32_t sequence) { return 1 + (sequence * 2654435761u >> 7) % 8192; };
+  // The frames held are always the newest ones, so the oldest held tells the age.
+  auto check_bounds = [&]() {
+    pretriggerStats stats = buffer.get_stats();
+    size_t oldest_held = sizes.size() - static_cast<size_t>(stats.frames_buffered);
+    if (stats.bytes_buffered > ARENA || stats.frames_buffered > CAPACITY || stats.frames_buffered == 0 ||
+        dequeued.back() - dequeued[oldest_held] > WINDOW_NS)
+    {
+      std::fprintf(stderr, "Pre-trigger buffer holds %llu frames, %llu bytes after frame %zu\n",
+                   static_cast<unsigned long long>(stats.frames_buffered),
+                   static_cast<unsigned long long>(stats.bytes_buffered), sizes.size() - 1);
+      ok = false;
+    }
+    return stats.frames_buffered;
+  };
+
+  // All pre-trigger frames are dated in the past, so the trigger below comes after them.
+  int64_t t = monotonic_ns() - 10000 * MS;
+
+  // Large frames: the arena fills first and wraps many times.
+  for (int i = 0; i < 300; ++i, t += 10 * MS)
+  {
+    push(variable_size(static_cast<uint32_t>(sizes.size())), t);
+    check_bounds();
+  }
+  // Tiny frames at 1000 fps: the entry ring fills long before the window does.
+  uint64_t count_bound = 0;
+  for (int i = 0; i < 500; ++i, t += MS)
+  {
+    push(16, t);
+    count_bound = check_bounds();
+  }
+  // Tiny frames at 50 fps: only the age bound applies.
+  uint64_t age_bound = 0;
+  for (int i = 0; i < 200; ++i, t += 20 * MS)
+  {
+    push(16, t);
+    age_bound = check_bounds();
+  }
+  if (count_bound != CAPACITY || age_bound != static_cast<uint64_t>(WINDOW_NS / (20 * MS) + 1))
+  {
+    std::fprintf(stderr, "Pre-trigger buffer held %llu frames at the count bound and %llu at the age bound\n",
+                 static_cast<unsigned long long>(count_bound), static_cast<unsigned long long>(age_bound));
+    ok = false;
+  }
+  // What leads up to the event.
+  for (int i = 0; i < 100; ++i, t += 10 * MS)
+  {
+    push(variable_size(static_cast<uint32_t>(sizes.size())), t);
+    check_bounds();
+  }
+  // The flush thread and the recorder allocate once triggered, and the counter is process wide, so only the pushes
+  // up to here are counted.
+  uint64_t armed_allocations = allocations;
+  size_t armed_pushes = pushes;
+
+  uint32_t oldest = static_cast<uint32_t>(sizes.size() - buffer.get_stats().frames_buffered);
+  int64_t trigger_start_ns = monotonic_ns();
+  if (!buffer.trigger(path, POST_SECONDS))
+  {
+    return false;
+  }
+  int64_t trigger_end_ns = monotonic_ns();
+
+  // A burst well inside the post-trigger window, faster than the flush can keep up with, then one frame past it to
+  // end the flush. Nothing is pushed after that one, so it is never evicted and is the first frame not written.
+  for (int i = 0; i < 200; ++i)
+  {
+    push(variable_size(static_cast<uint32_t>(sizes.size())), trigger_end_ns + i * MS);
+  }
+  uint32_t end = static_cast<uint32_t>(sizes.size());
+  push(16, trigger_start_ns + static_cast<int64_t>(POST_SECONDS * 1e9) + WINDOW_NS);
+
+  int64_t deadline = monotonic_ns() + 5000 * MS;
+  while (buffer.flushing() && monotonic_ns() < deadline)
+  {
+    usleep(1000);
+  }
+  pretriggerStats stats = buffer.get_stats();
+  buffer.disarm();
+
+  frame_file_reader reader;
+  size_t written = 0;
+  size_t corrupt = 0;
+  int64_t previous = static_cast<int64_t>(oldest) - 1;
+  if (!reader.open(path))
+  {
+    ok = false;
+  }
+  else
+  {
+    for (const frameFileEntry& frame : reader.frames())
+    {
+      bool intact = frame.sequence < sizes.size() && frame.size == sizes[frame.sequence] &&
+                    static_cast<int64_t>(frame.sequence) > previous && frame.sequence < end;
+      for (size_t j = 0; intact && j < frame.size; ++j)
+      {
+        intact = frame.data[j] == static_cast<uint8_t>(frame.sequence * 131 + j * 7);
+      }
+      corrupt += !intact;
+      previous = frame.sequence;
+      ++written;
+    }
+    reader.close();
+  }
+  unlink(path.c_str());
+
+  std::fprintf(out, "%s    {\n", first ? "" : ",\n");
+  std::fprintf(out,
+               "      \"pretrigger\": \"%zu byte arena\", \"pushes\": %zu, \"allocations_per_push\": %.3f, "
+               "\"count_bound_frames\": %llu, \"age_bound_frames\": %llu,\n",
+               ARENA, armed_pushes, static_cast<double>(armed_allocations) / armed_pushes,
+               static_cast<unsigned long long>(count_bound), static_cast<unsigned long long>(age_bound));
+  std::fprintf(out,
+               "      \"flush_expected\": %u, \"flush_written\": %zu, \"flush_lost\": %llu, \"flush_corrupt\": %zu\n"
+               "    }",
+               end - oldest, written, static_cast<unsigned long long>(stats.frames_lost), corrupt);
+
+  if (armed_allocations > 0)
+  {
+    std::fprintf(stderr, "Pre-trigger push() allocated %llu times\n",
+                 static_cast<unsigned long long>(armed_allocations));
+    ok = false;
+  }
+  if (corrupt > 0 || written + stats.frames_lost != end - oldest)
+  {
+    std::fprintf(stderr, "Pre-trigger flush wrote %zu frames (%zu bad) and lost %llu of %u\n", written, corrupt,
+                 static_cast<unsigned long long>(stats.frames_lost), end - oldest);
+    ok = false;
+  }
+  return ok;
+}
+
+// Cost of one TRACE_SCOPE span on this machine, or 0 when tracing is compiled out.
+double trace_span_ns()
+{
+#ifdef ENABLE_TRACING
+  const int SPANS = 1000000;
+  int64_t start = monotonic_ns();
+  for (int i = 0; i < SPANS; ++i)
+  {
+    TRACE_SCOPE("bench");
+  }
+  return (monotonic_ns() - start) / static_cast<double>(SPANS);
+#else
+  return 0;
+#endif
+}
+
+void usage(const char* argv0)
+{
+  std::printf(
+      "Usage: %s [options] [FRAME_FILE...]\n"
+      "\n"
+      "Replays frame dumps (see v4l2_capture_cli --output) through the capture pipeline and prints JSON.\n"
+      "\n"
+      "Options:\n"
+      "  -g, --synthetic FORMAT:WxH  Add a generated corpus; FORMAT is mjpeg, yuyv, uyvy, yvyu, nv12, grey or rgb24\n"
+      "                              (repeatable)\n"
+      "  -f, --check-formats         Check that every SIMD path converts each uncompressed format exactly like the\n"
+      "                              scalar code\n"
+      "  -s, --sizes LIST            Comma-separated target sizes for MJPEG, e.g. 0x0,1280x720,640x360\n"
+      "                              (default 0x0,640x360; 0x0 is full resolution)\n"
+      "  -n, --frames N              Minimum measured frames per run (default 300)\n"
+      "  -o, --output FILE           Write the JSON report to FILE instead of stdout\n"
+      "  -c, --check-allocs          Fail unless the pipeline makes no heap allocations per frame after warm-up\n"
+      "  -v, --viewers LIST          Also serve MJPEG corpora over HTTP to each number of localhost viewers,\n"
+      "                              e.g. 1,10,100\n"
+      "  -r, --rate FPS              Publishing rate for --viewers, frame rate for --engine-sources and --device\n"
+      "                              (default 30)\n"
+      "  -p, --shm-readers N         Check the shared-memory ring for torn reads with N concurrent readers\n"
+      "  -e, --engine-sources N      Also replay each corpus from N looping sources on one CaptureEngine at --rate\n"
+      "                              fps and check that every source keeps up with a fixed thread count\n"
+      "  -E, --engine-devices LIST   Stream these cameras together on one CaptureEngine at --rate fps and\n"
+      "                              --device-format, changing their brightness meanwhile, e.g. the nodes of\n"
+      "                              modprobe vivid n_devs=8\n"
+      "  -P, --pretrigger            Check the pre-trigger buffer's bounds, arena wrap-around and flush accounting\n"
+      "  -t, --stop-latency N        Stop a stalled stream N times, and the --device stream if given, and fail if\n"
+      "                              any stop exceeds one poll timeout\n"
+      "  -d, --device PATH           Stream --frames frames from this camera with each of mmap, userptr and dmabuf\n"
+      "                              buffers and compare the CPU time per frame\n"
+      "  -F, --device-format F:WxH   Format and size for --device (default YUYV:640x480)\n"
+      "  -h, --help                  Show this help\n",
+      argv0);
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  static const struct option options[] = { { "synthetic", required_argument, nullptr, 'g' },
+                                           { "sizes", required_argument, nullptr, 's' },
+                                           { "frames", required_argument, nullptr, 'n' },
+                                           { "output", required_argument, nullptr, 'o' },
+                                           { "check-allocs", no_argument, nullptr, 'c' },
+                                           { "check-formats", no_argument, nullptr, 'f' },
+                                           { "viewers", required_argument, nullptr, 'v' },
+                                           { "rate", required_argument, nullptr, 'r' },
+                                           { "shm-readers", required_argument, nullptr, 'p' },
+                                           { "engine-sources", required_argument, nullptr, 'e' },
+                                           { "stop-latency", required_argument, nullptr, 't' },
+                                           { "pretrigger", no_argument, nullptr, 'P' },
+                                           { "device", required_argument, nullptr, 'd' },
+                                           { "device-format", required_argument, nullptr, 'F' },
+                                           { "engine-devices", required_argument, nullptr, 'E' },
+                                           { "help", no_argument, nullptr, 'h' },
+                                           { nullptr, 0, nullptr, 0 } };
+
+  std::vector<std::string> synthetic;
+  std::string sizes = "0x0,640x360";
+  size_t min_frames = 300;
+  std::string output;
+  bool check_allocs = false;
+  bool formats = false;
+  std::vector<size_t> viewer_counts;
+  double http_fps = 30;
+  size_t shm_readers = 0;
+  size_t engine_sources = 0;
+  size_t stop_iterations = 0;
+  bool pretrigger = false;
+  std::string device;
+  std::string device_format = "YUYV:640x480";
+  std::vector<std::string> engine_devices;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "g:s:n:o:cfv:r:p:e:t:d:F:E:Ph", options, nullptr)) != -1)
+  {
+    switch (opt)
+    {
+      case 'g':
+        synthetic.push_back(optarg);
+        break;
+      case 's':
+        sizes = optarg;
+        break;
+      case 'n':
+        min_frames = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        check_allocs = true;
+        break;
+      case 'f':
+        formats = true;
+        break;
+      case 'v':
+        for (char* item = std::strtok(optarg, ","); item != nullptr; item = std::strtok(nullptr, ","))
+        {
+          viewer_counts.push_back(std::strtoul(item, nullptr, 10));
+        }
+        break;
+      case 'r':
+        http_fps = std::atof(optarg);
+        if (http_fps <= 0)
+        {
+          std::fprintf(stderr, "Invalid rate: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'p':
+        shm_readers = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'e':
+        engine_sources = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 't':
+        stop_iterations = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'd':
+        device = optarg;
+        break;
+      case 'F':
+        device_format = optarg;
+        break;
+      case 'P':
+        pretrigger = true;
+        break;
+      case 'E':
+        for (char* item = std::strtok(optarg, ","); item != nullptr; item = std::strtok(nullptr, ","))
+        {
+          engine_devices.push_back(item);
+        }
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  std::vector<std::pair<int, int>> targets;
+  size_t pos = 0;
+  while (pos <= sizes.size())
+  {
+    size_t comma = sizes.find(',', pos);
+    std::string item = sizes.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+    int w, h;
+    if (!parse_size(item, w, h))
+    {
+      std::fprintf(stderr, "Invalid size: %s\n", item.c_str());
+      return 2;
+    }
+    targets.push_back(std::make_pair(w, h));
+    if (comma == std::string::npos)
+    {
+      break;
+    }
+    pos = comma + 1;
+  }
+
+  std::vector<std::unique_ptr<corpus>> corpora;
+  for (int i = optind; i < argc; ++i)
+  {
+    std::unique_ptr<corpus> c(new corpus());
+    if (!load_file(argv[i], *c))
+    {
+      std::fprintf(stderr, "Failed to load frame file: %s\n", argv[i]);
+      return 1;
+    }
+    corpora.push_back(std::move(c));
+  }
+  for (const auto& spec : synthetic)
+  {
+    std::unique_ptr<corpus> c(new corpus());
+    if (!generate(spec, 30, *c))
+    {
+      return 2;
+    }
+    corpora.push_back(std::move(c));
+  }
+  if (corpora.empty() && shm_readers == 0 && !formats && stop_iterations == 0 && !pretrigger &&
+      device.empty() && engine_devices.empty())
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  m_deviceConfig device_config;
+  device_config.path = device;
+  device_config.fps = static_cast<float>(http_fps);
+  size_t colon = device_format.find(':');
+  if (colon == std::string::npos || colon == 0 ||
+      !parse_size(device_format.substr(colon + 1), device_config.resolution.first, device_config.resolution.second))
+  {
+    std::fprintf(stderr, "Invalid device format: %s (expected FORMAT:WxH)\n", device_format.c_str());
+    return 2;
+  }
+  device_config.format = device_format.substr(0, colon);
+
+  for (const auto& c : corpora)
+  {
+    if (!frame_decoder::supported(c->fourcc))
+    {
+      std::fprintf(stderr, "%s: unsupported pixel format %s\n", c->name.c_str(), fourcc_name(c->fourcc).c_str());
+      return 1;
+    }
+  }
+
+  std::FILE* out = stdout;
+  if (!output.empty())
+  {
+    out = std::fopen(output.c_str(), "w");
+    if (out == nullptr)
+    {
+      std::fprintf(stderr, "Failed to open %s: %s\n", output.c_str(), std::strerror(errno));
+      return 1;
+    }
+  }
+
+  static counting_allocator allocator;
+  cv::Mat::setDefaultAllocator(&allocator);
+
+#ifdef HAVE_TURBOJPEG
+  const char* turbojpeg = "true";
+#else
+  const char* turbojpeg = "false";
+#endif
+#ifdef ENABLE_TRACING
+  const char* tracing = "true";
+#else
+  const char* tracing = "false";
+#endif
+  std::fprintf(out,
+               "{\n  \"simd\": \"%s\", \"turbojpeg\": %s, \"tracing\": %s, \"trace_span_ns\": %.1f,\n"
+               "  \"results\": [\n",
+               pixel_format_simd_path(), turbojpeg, tracing, trace_span_ns());
+
+  bool ok = true;
+  bool first = true;
+  if (formats)
+  {
+    ok = check_formats(out, first) && ok;
+    first = false;
+  }
+  for (const auto& c : corpora)
+  {
+    if (engine_sources > 0)
+    {
+      ok = run_engine_replay(out, *c, engine_sources, http_fps, min_frames, first) && ok;
+      first = false;
+    }
+    // Only compressed formats are decoded at the target size; raw formats always convert at full resolution.
+    if (c->fourcc != V4L2_PIX_FMT_MJPEG)
+    {
+      ok = run(out, *c, 0, 0, min_frames, check_allocs, first) && ok;
+      first = false;
+      continue;
+    }
+    for (const auto& target : targets)
+    {
+      ok = run(out, *c, target.first, target.second, min_frames, check_allocs, first) && ok;
+      first = false;
+    }
+    for (size_t viewers : viewer_counts)
+    {
+      ok = run_http(out, *c, viewers, http_fps, min_frames, first) && ok;
+      first = false;
+    }
+  }
+  if (shm_readers > 0)
+  {
+    ok = run_shm(out, shm_readers, std::max<size_t>(min_frames, 1000), first) && ok;
+    first = false;
+  }
+  if (pretrigger)
+  {
+    ok = run_pretrigger(out, first) && ok;
+    first = false;
+  }
+  if (stop_iterations > 0)
+  {
+    ok = run_stall_latency(out, stop_iterations, first) && ok;
+    first = false;
+  }
+  if (stop_iterations > 0 && !device.empty())
+  {
+    usb_cam camera;
+    ok = run_stop_latency(out, camera, device_config, device.c_str(), stop_iterations, first) && ok;
+    first = false;
+  }
+  if (!engine_devices.empty())
+  {
+    ok = run_engine_devices(out, engine_devices, device_config, std::max<size_t>(min_frames, 1), first) && ok;
+    first = false;
+  }
+  if (!device.empty())
+  {
+    ok = run_memory_sweep(out, device_config, std::max<size_t>(min_frames, 1), first) && ok;
+  }
+  std::fprintf(out, "\n  ]\n}\n");
+
+  cv::Mat::setDefaultAllocator(nullptr);
+  if (out != stdout)
+  {
+    std::fclose(out);
+  }
+  return ok ? 0 : 1;
+}
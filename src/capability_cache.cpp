@@ -0,0 +1,346 @@
+#include "capability_cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "debug.h"
+
+namespace
+{
+const char* const CACHE_MAGIC = "V4L2CAPS 1";
+
+// Common capture sizes offered for stepwise and continuous ranges.
+const int COMMON_SIZES[][2] = { { 160, 120 },   { 320, 240 },   { 640, 360 },   { 640, 480 },   { 800, 600 },
+                                { 1024, 768 },  { 1280, 720 },  { 1280, 960 },  { 1920, 1080 }, { 2560, 1440 },
+                                { 3840, 2160 }, { 4096, 2160 } };
+
+bool on_range(int value, uint32_t min, uint32_t max, uint32_t step)
+{
+  if (value < static_cast<int>(min) || value > static_cast<int>(max))
+  {
+    return false;
+  }
+  return step <= 1 || (value - min) % step == 0;
+}
+
+// Tabs and newlines separate fields and records in the cache file.
+std::string sanitize(const std::string& text)
+{
+  std::string result = text;
+  std::replace(result.begin(), result.end(), '\t', ' ');
+  std::replace(result.begin(), result.end(), '\n', ' ');
+  return result;
+}
+
+std::vector<std::string> split(const std::string& line)
+{
+  std::vector<std::string> fields;
+  std::stringstream stream(line);
+  std::string field;
+  while (std::getline(stream, field, '\t'))
+  {
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+bool make_dirs(const std::string& path)
+{
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+  {
+    std::string dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST)
+    {
+      return false;
+    }
+    if (pos == std::string::npos)
+    {
+      return true;
+    }
+  }
+}
+}  // namespace
+
+std::vector<std::pair<int, int>> FormatInfo::candidate_sizes() const
+{
+  if (size_type == V4L2_FRMSIZE_TYPE_DISCRETE)
+  {
+    return sizes;
+  }
+
+  std::vector<std::pair<int, int>> result;
+  for (const auto& size : COMMON_SIZES)
+  {
+    if (on_range(size[0], stepwise.min_width, stepwise.max_width, stepwise.step_width) &&
+        on_range(size[1], stepwise.min_height, stepwise.max_height, stepwise.step_height))
+    {
+      result.push_back(std::make_pair(size[0], size[1]));
+    }
+  }
+
+  std::pair<int, int> largest(stepwise.max_width, stepwise.max_height);
+  if (result.empty() || result.back() != largest)
+  {
+    result.push_back(largest);
+  }
+  return result;
+}
+
+capability_cache::capability_cache() : path(default_path()), loaded(false)
+{
+}
+
+capability_cache::capability_cache(const std::string& path) : path(path), loaded(false)
+{
+}
+
+std::string capability_cache::default_path()
+{
+  const char* xdg = std::getenv("XDG_CACHE_HOME");
+  if (xdg != nullptr && xdg[0] == '/')
+  {
+    return std::string(xdg) + "/v4l2_gui/capabilities";
+  }
+  const char* home = std::getenv("HOME");
+  if (home != nullptr && home[0] == '/')
+  {
+    return std::string(home) + "/.cache/v4l2_gui/capabilities";
+  }
+  return std::string();
+}
+
+std::string capability_cache::device_key(const deviceIdentity& identity)
+{
+  return sanitize(identity.driver) + "\t" + sanitize(identity.bus_info) + "\t" + sanitize(identity.card);
+}
+
+std::string capability_cache::rate_key(uint32_t fourcc, int width, int height)
+{
+  std::ostringstream key;
+  key << fourcc << "\t" << width << "\t" << height;
+  return key.str();
+}
+
+capability_cache::entry* capability_cache::find(const deviceIdentity& identity)
+{
+  if (!loaded)
+  {
+    load();
+  }
+
+  auto it = entries.find(device_key(identity));
+  if (it == entries.end())
+  {
+    return nullptr;
+  }
+
+  // A driver update or new camera firmware can change what the device reports.
+  if (it->second.identity.version != identity.version || it->second.identity.firmware != sanitize(identity.firmware))
+  {
+    entries.erase(it);
+    return nullptr;
+  }
+  return &it->second;
+}
+
+bool capability_cache::lookup_formats(const deviceIdentity& identity, std::vector<FormatInfo>& formats)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entry* e = find(identity);
+  if (e == nullptr || e->formats.empty())
+  {
+    return false;
+  }
+  formats = e->formats;
+  return true;
+}
+
+void capability_cache::store_formats(const deviceIdentity& identity, const std::vector<FormatInfo>& formats)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entry* e = find(identity);
+  if (e == nullptr)
+  {
+    e = &entries[device_key(identity)];
+    e->identity = identity;
+    e->identity.firmware = sanitize(identity.firmware);
+  }
+  e->formats = formats;
+  save();
+}
+
+bool capability_cache::lookup_rates(const deviceIdentity& identity, uint32_t fourcc, int width, int height,
+                                    std::vector<float>& fps)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entry* e = find(identity);
+  if (e == nullptr)
+  {
+    return false;
+  }
+  auto it = e->rates.find(rate_key(fourcc, width, height));
+  if (it == e->rates.end())
+  {
+    return false;
+  }
+  fps = it->second;
+  return true;
+}
+
+void capability_cache::store_rates(const deviceIdentity& identity, uint32_t fourcc, int width, int height,
+                                   const std::vector<float>& fps)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entry* e = find(identity);
+  if (e == nullptr)
+  {
+    // Rates are only cached alongside the formats they belong to.
+    return;
+  }
+  e->rates[rate_key(fourcc, width, height)] = fps;
+  save();
+}
+
+void capability_cache::load()
+{
+  loaded = true;
+  entries.clear();
+  if (path.empty())
+  {
+    return;
+  }
+
+  std::ifstream file(path.c_str());
+  std::string line;
+  if (!std::getline(file, line) || line != CACHE_MAGIC)
+  {
+    return;
+  }
+
+  entry* current = nullptr;
+  while (std::getline(file, line))
+  {
+    std::vector<std::string> f = split(line);
+    if (f.empty())
+    {
+      continue;
+    }
+
+    if (f[0] == "device" && f.size() >= 5)
+    {
+      deviceIdentity identity;
+      identity.driver = f[1];
+      identity.bus_info = f[2];
+      identity.card = f[3];
+      identity.version = std::strtoul(f[4].c_str(), nullptr, 10);
+      identity.firmware = f.size() > 5 ? f[5] : std::string();
+      current = &entries[device_key(identity)];
+      current->identity = identity;
+    }
+    else if (current == nullptr)
+    {
+      continue;
+    }
+    else if (f[0] == "format" && f.size() >= 4)
+    {
+      FormatInfo format;
+      format.fourcc = std::strtoul(f[1].c_str(), nullptr, 10);
+      format.size_type = std::strtoul(f[2].c_str(), nullptr, 10);
+      format.description = f[3];
+      current->formats.push_back(format);
+    }
+    else if (f[0] == "size" && f.size() >= 3 && !current->formats.empty())
+    {
+      current->formats.back().sizes.push_back(std::make_pair(std::atoi(f[1].c_str()), std::atoi(f[2].c_str())));
+    }
+    else if (f[0] == "range" && f.size() >= 7 && !current->formats.empty())
+    {
+      struct v4l2_frmsize_stepwise& range = current->formats.back().stepwise;
+      range.min_width = std::strtoul(f[1].c_str(), nullptr, 10);
+      range.max_width = std::strtoul(f[2].c_str(), nullptr, 10);
+      range.step_width = std::strtoul(f[3].c_str(), nullptr, 10);
+      range.min_height = std::strtoul(f[4].c_str(), nullptr, 10);
+      range.max_height = std::strtoul(f[5].c_str(), nullptr, 10);
+      range.step_height = std::strtoul(f[6].c_str(), nullptr, 10);
+    }
+    else if (f[0] == "rates" && f.size() >= 4)
+    {
+      std::vector<float>& fps = current->rates[f[1] + "\t" + f[2] + "\t" + f[3]];
+      for (size_t i = 4; i < f.size(); ++i)
+      {
+        fps.push_back(std::strtof(f[i].c_str(), nullptr));
+      }
+    }
+  }
+}
+
+void capability_cache::save()
+{
+  if (path.empty())
+  {
+    return;
+  }
+
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos && slash > 0 && !make_dirs(path.substr(0, slash)))
+  {
+    CERR_ENDL("Failed to create cache directory for " << path);
+    return;
+  }
+
+  // Write a private temporary and rename it over the cache so readers never see a partial file.
+  std::ostringstream tmp_path;
+  tmp_path << path << "." << getpid() << ".tmp";
+  {
+    std::ofstream file(tmp_path.str().c_str());
+    if (!file)
+    {
+      CERR_ENDL("Failed to write capability cache: " << tmp_path.str());
+      return;
+    }
+
+    file << CACHE_MAGIC << "\n";
+    for (const auto& item : entries)
+    {
+      const entry& e = item.second;
+      file << "device\t" << item.first << "\t" << e.identity.version << "\t" << e.identity.firmware << "\n";
+      for (const auto& format : e.formats)
+      {
+        file << "format\t" << format.fourcc << "\t" << format.size_type << "\t" << sanitize(format.description) << "\n";
+        if (format.size_type == V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+          for (const auto& size : format.sizes)
+          {
+            file << "size\t" << size.first << "\t" << size.second << "\n";
+          }
+        }
+        else
+        {
+          const struct v4l2_frmsize_stepwise& r = format.stepwise;
+          file << "range\t" << r.min_width << "\t" << r.max_width << "\t" << r.step_width << "\t" << r.min_height
+               << "\t" << r.max_height << "\t" << r.step_height << "\n";
+        }
+      }
+      for (const auto& rate : e.rates)
+      {
+        file << "rates\t" << rate.first;
+        for (float fps : rate.second)
+        {
+          file << "\t" << fps;
+        }
+        file << "\n";
+      }
+    }
+  }
+
+  if (std::rename(tmp_path.str().c_str(), path.c_str()) == -1)
+  {
+    CERR_ENDL("Failed to replace capability cache: " << path);
+    std::remove(tmp_path.str().c_str());
+  }
+}
@@ -0,0 +1,547 @@
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "usb_camera.h"
+#include "replay_source.h"
+#include "frame_file.h"
+#include "recorder.h"
+#include "mjpeg_server.h"
+#include "shm_publisher.h"
+#include "trace.h"
+#include "logger.h"
+
+namespace
+{
+std::atomic<bool> interrupted(false);
+std::atomic<bool> trace_requested(false);
+
+void on_signal(int)
+{
+  interrupted = true;
+}
+
+void on_trace_signal(int)
+{
+  trace_requested = true;
+}
+
+void usage(const char* argv0)
+{
+  std::printf(
+      "Usage: %s --list\n"
+      "       %s --device PATH [options]\n"
+      "       %s --replay FILE [options]\n"
+      "\n"
+      "Options:\n"
+      "  -l, --list              List capture devices and their formats\n"
+      "  -d, --device PATH       Device to stream from, e.g. /dev/video0\n"
+      "  -i, --replay FILE       Replay a frame dump (see --output) instead of streaming from a device\n"
+      "  -p, --pace MODE         Replay timing: recorded, fps (at --fps) or max (default recorded)\n"
+      "  -e, --loop              Restart the replay after its last frame\n"
+      "  -c, --sources N         Replay the file as N independent sources, e.g. to load test 8 cameras\n"
+      "  -f, --format NAME       MJPEG, YUYV, UYVY, YVYU, NV12, GREY, RGB24, H264 or a fourcc (default MJPEG)\n"
+      "  -s, --size WxH          Resolution (default 640x480)\n"
+      "  -r, --fps N             Frame rate (default 30)\n"
+      "  -b, --buffers N         Number of V4L2 buffers (default 4)\n"
+      "  -m, --memory TYPE       mmap, userptr or dmabuf (default mmap)\n"
+      "  -t, --seconds N         Stop after N seconds\n"
+      "  -n, --frames N          Stop after N frames\n"
+      "  -o, --output FILE       Write raw frames to FILE (frame dump format)\n"
+      "  -R, --record FILE       Record to FILE without transcoding (AVI for MJPEG, Annex B for H.264)\n"
+      "  -H, --http [ADDR:]PORT  Serve the MJPEG stream over HTTP (binds 127.0.0.1 unless ADDR is given)\n"
+      "  -P, --shm NAME          Publish frames to the shared memory ring NAME, e.g. /v4l2-video0\n"
+      "  -T, --trace FILE        Write a Chrome trace of the capture pipeline to FILE on exit and on SIGUSR1\n"
+      "  -L, --log-level LEVEL   off, error, warning, info or debug (default info, or $V4L2_LOG_LEVEL)\n"
+      "  -D, --decode-size WxH   Decode compressed frames at this size (default full resolution)\n"
+      "  -S, --stats             Print statistics every second\n"
+      "  -h, --help              Show this help\n",
+      argv0, argv0, argv0);
+}
+
+bool parse_size(const char* text, int& width, int& height)
+{
+  return std::sscanf(text, "%dx%d", &width, &height) == 2 && width >= 0 && height >= 0;
+}
+
+double cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Totals over all sources; percentiles are those of the worst source.
+captureStats combine_stats(const std::vector<std::unique_ptr<capture_source>>& sources)
+{
+  captureStats total = sources[0]->get_stats();
+  for (size_t i = 1; i < sources.size(); ++i)
+  {
+    captureStats stats = sources[i]->get_stats();
+    total.capture_fps += stats.capture_fps;
+    total.delivered_fps += stats.delivered_fps;
+    total.frames_captured += stats.frames_captured;
+    total.frames_delivered += stats.frames_delivered;
+    total.frames_dropped += stats.frames_dropped;
+    total.decode_ms_p50 = std::max(total.decode_ms_p50, stats.decode_ms_p50);
+    total.decode_ms_p90 = std::max(total.decode_ms_p90, stats.decode_ms_p90);
+    total.decode_ms_p99 = std::max(total.decode_ms_p99, stats.decode_ms_p99);
+    total.latency_ms_p50 = std::max(total.latency_ms_p50, stats.latency_ms_p50);
+    total.latency_ms_p90 = std::max(total.latency_ms_p90, stats.latency_ms_p90);
+    total.latency_ms_p99 = std::max(total.latency_ms_p99, stats.latency_ms_p99);
+  }
+  return total;
+}
+
+bool replay_finished(const std::vector<std::unique_ptr<capture_source>>& sources)
+{
+  for (const auto& source : sources)
+  {
+    if (!static_cast<const replay_source*>(source.get())->finished())
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Stops every source when it goes out of scope, so no capture thread is left running into the outputs its callbacks
+// write to, whichever way main() returns. Declare it after those outputs.
+class source_stopper
+{
+public:
+  explicit source_stopper(std::vector<std::unique_ptr<capture_source>>& sources) : sources(sources)
+  {
+  }
+
+  ~source_stopper()
+  {
+    stop();
+  }
+
+  void stop()
+  {
+    for (auto& source : sources)
+    {
+      source->stop_stream();
+    }
+  }
+
+private:
+  source_stopper(const source_stopper&);
+  source_stopper& operator=(const source_stopper&);
+
+  std::vector<std::unique_ptr<capture_source>>& sources;
+};
+
+void print_stats(const captureStats& stats, double elapsed, double cpu_per_frame_us)
+{
+  std::printf("{\"elapsed_s\": %.3f, \"capture_fps\": %.2f, \"frames_captured\": %llu, \"frames_dropped\": %llu, "
+              "\"decode_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f}, \"cpu_us_per_frame\": %.1f}\n",
+              elapsed, stats.capture_fps, static_cast<unsigned long long>(stats.frames_captured),
+              static_cast<unsigned long long>(stats.frames_dropped), stats.decode_ms_p50, stats.decode_ms_p90,
+              stats.decode_ms_p99, cpu_per_frame_us);
+  std::fflush(stdout);
+}
+
+int list_devices()
+{
+  usb_cam camera;
+  std::vector<deviceData> devices = camera.find_device();
+  for (const auto& device : devices)
+  {
+    m_deviceInfo info = camera.get_device_info(device.path);
+    std::printf("%s: %s (%s, %s)\n", device.path.c_str(), device.device_name.c_str(), info.driver.c_str(),
+                info.bus_info.c_str());
+    for (const auto& format : info.format_info)
+    {
+      std::printf("  %c%c%c%c  %s:", format.fourcc & 0xff, (format.fourcc >> 8) & 0xff, (format.fourcc >> 16) & 0xff,
+                  (format.fourcc >> 24) & 0xff, format.description.c_str());
+      if (format.size_type != V4L2_FRMSIZE_TYPE_DISCRETE)
+      {
+        std::printf(" %ux%u - %ux%u", format.stepwise.min_width, format.stepwise.min_height, format.stepwise.max_width,
+                    format.stepwise.max_height);
+      }
+      else
+      {
+        for (const auto& size : format.sizes)
+        {
+          std::printf(" %dx%d", size.first, size.second);
+        }
+      }
+      std::printf("\n");
+    }
+  }
+  return devices.empty() ? 1 : 0;
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  static const struct option options[] = { { "list", no_argument, nullptr, 'l' },
+                                           { "device", required_argument, nullptr, 'd' },
+                                           { "replay", required_argument, nullptr, 'i' },
+                                           { "pace", required_argument, nullptr, 'p' },
+                                           { "loop", no_argument, nullptr, 'e' },
+                                           { "sources", required_argument, nullptr, 'c' },
+                                           { "format", required_argument, nullptr, 'f' },
+                                           { "size", required_argument, nullptr, 's' },
+                                           { "fps", required_argument, nullptr, 'r' },
+                                           { "buffers", required_argument, nullptr, 'b' },
+                                           { "memory", required_argument, nullptr, 'm' },
+                                           { "seconds", required_argument, nullptr, 't' },
+                                           { "frames", required_argument, nullptr, 'n' },
+                                           { "output", required_argument, nullptr, 'o' },
+                                           { "record", required_argument, nullptr, 'R' },
+                                           { "http", required_argument, nullptr, 'H' },
+                                           { "shm", required_argument, nullptr, 'P' },
+                                           { "trace", required_argument, nullptr, 'T' },
+                                           { "log-level", required_argument, nullptr, 'L' },
+                                           { "decode-size", required_argument, nullptr, 'D' },
+                                           { "stats", no_argument, nullptr, 'S' },
+                                           { "help", no_argument, nullptr, 'h' },
+                                           { nullptr, 0, nullptr, 0 } };
+
+  m_deviceConfig config;
+  config.format = "MJPEG";
+  config.resolution = std::make_pair(640, 480);
+  config.fps = 30;
+
+  std::string replay_path;
+  replayPacing pacing = REPLAY_RECORDED;
+  bool loop = false;
+  int source_count = 1;
+  double seconds = 0;
+  unsigned long max_frames = 0;
+  std::string output;
+  std::string record_path;
+  std::string http_address;
+  uint16_t http_port = 0;
+  bool http = false;
+  std::string shm_name;
+  std::string trace_path;
+  int decode_width = 0;
+  int decode_height = 0;
+  bool periodic_stats = false;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "ld:i:p:ec:f:s:r:b:m:t:n:o:R:H:P:T:L:D:Sh", options, nullptr)) != -1)
+  {
+    switch (opt)
+    {
+      case 'l':
+        return list_devices();
+      case 'd':
+        config.path = optarg;
+        break;
+      case 'i':
+        replay_path = optarg;
+        break;
+      case 'p':
+        if (!replay_source::parse_pacing(optarg, pacing))
+        {
+          std::fprintf(stderr, "Invalid pace: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'e':
+        loop = true;
+        break;
+      case 'c':
+        source_count = std::atoi(optarg);
+        if (source_count < 1)
+        {
+          std::fprintf(stderr, "Invalid source count: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'f':
+        config.format = optarg;
+        break;
+      case 's':
+        if (!parse_size(optarg, config.resolution.first, config.resolution.second))
+        {
+          std::fprintf(stderr, "Invalid size: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'r':
+        config.fps = std::atof(optarg);
+        break;
+      case 'b':
+        config.buffer_count = std::atoi(optarg);
+        break;
+      case 'm':
+        if (std::strcmp(optarg, "mmap") == 0)
+        {
+          config.memory = MEMORY_MMAP;
+        }
+        else if (std::strcmp(optarg, "userptr") == 0)
+        {
+          config.memory = MEMORY_USERPTR;
+        }
+        else if (std::strcmp(optarg, "dmabuf") == 0)
+        {
+          config.memory = MEMORY_DMABUF;
+        }
+        else
+        {
+          std::fprintf(stderr, "Invalid memory type: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 't':
+        seconds = std::atof(optarg);
+        break;
+      case 'n':
+        max_frames = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'R':
+        record_path = optarg;
+        break;
+      case 'H':
+        if (!mjpeg_server::parse_endpoint(optarg, http_address, http_port))
+        {
+          std::fprintf(stderr, "Invalid HTTP endpoint: %s\n", optarg);
+          return 2;
+        }
+        http = true;
+        break;
+      case 'P':
+        shm_name = optarg;
+        break;
+      case 'L':
+      {
+        logLevel level;
+        if (!logger::parse_level(optarg, level))
+        {
+          std::fprintf(stderr, "Invalid log level: %s\n", optarg);
+          return 2;
+        }
+        logger::set_level(level);
+        break;
+      }
+      case 'T':
+#ifdef ENABLE_TRACING
+        trace_path = optarg;
+        break;
+#else
+        std::fprintf(stderr, "Built without tracing (ENABLE_TRACING=OFF)\n");
+        return 2;
+#endif
+      case 'D':
+        if (!parse_size(optarg, decode_width, decode_height))
+        {
+          std::fprintf(stderr, "Invalid size: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'S':
+        periodic_stats = true;
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  if (config.path.empty() == replay_path.empty())
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  if (replay_path.empty() && source_count > 1)
+  {
+    std::fprintf(stderr, "--sources needs --replay\n");
+    return 2;
+  }
+
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+  if (!trace_path.empty())
+  {
+    std::signal(SIGUSR1, on_trace_signal);
+    tracer::instance().dump_at_exit(trace_path);
+  }
+
+  // The callbacks below write into these from the capture threads, so they are declared before the sources and
+  // outlive them.
+  frame_file_writer writer;
+  recorder record;
+  mjpeg_server server;
+  shm_publisher shm;
+  std::atomic<bool> shm_ready(false);
+  std::atomic<unsigned long> frames(0);
+  std::atomic<bool> writer_ready(false);
+
+  std::vector<std::unique_ptr<capture_source>> sources;
+  if (replay_path.empty())
+  {
+    sources.push_back(std::unique_ptr<capture_source>(new usb_cam));
+  }
+  else
+  {
+    config.path = replay_path;
+    for (int i = 0; i < source_count; ++i)
+    {
+      replay_source* replay = new replay_source;
+      replay->set_pacing(pacing);
+      replay->set_loop(loop);
+      sources.push_back(std::unique_ptr<capture_source>(replay));
+    }
+  }
+  capture_source& camera = *sources[0];
+  source_stopper stopper(sources);
+
+  // Raw buffers are written from the capture thread while they are still dequeued, so nothing is copied twice.
+  camera.set_raw_frame_callback([&](const rawFrame& raw) {
+    if (writer_ready)
+    {
+      writer.write_frame(raw.data, raw.bytesused, raw.timestamp_ns, raw.sequence);
+    }
+    if (record.recording())
+    {
+      record.push(raw);
+    }
+    if (server.running())
+    {
+      server.publish(raw.data, raw.bytesused, raw.timestamp_ns);
+    }
+    if (shm_ready)
+    {
+      shm.publish(raw);
+    }
+    ++frames;
+  });
+  // Further replay sources only add load; the outputs above follow the first one.
+  for (size_t i = 1; i < sources.size(); ++i)
+  {
+    sources[i]->set_raw_frame_callback([&](const rawFrame&) { ++frames; });
+  }
+
+  double cpu_start = cpu_seconds();
+  int64_t start_ns = monotonic_ns();
+  for (auto& source : sources)
+  {
+    source->set_target_size(decode_width, decode_height);
+    source->start_stream(config);
+    // A short replay may already have played out and cleared streaming, so check that a stream was opened at all.
+    if (source->device_fd() == -1)
+    {
+      std::fprintf(stderr, "Failed to start streaming from %s\n", config.path.c_str());
+      return 1;
+    }
+  }
+
+  if (!output.empty())
+  {
+    struct v4l2_pix_format fmt = camera.get_format();
+    if (!writer.open(output, fmt.pixelformat, fmt.width, fmt.height, fmt.bytesperline))
+    {
+      return 1;
+    }
+    writer_ready = true;
+  }
+
+  if (!record_path.empty() && !record.start(record_path, camera.get_format(), config.fps))
+  {
+    return 1;
+  }
+
+  if (!shm_name.empty())
+  {
+    if (!shm.open(shm_name, camera.get_format()))
+    {
+      stopper.stop();
+      record.stop();
+      return 1;
+    }
+    shm_ready = true;
+  }
+
+  if (http)
+  {
+    if (camera.get_format().pixelformat != V4L2_PIX_FMT_MJPEG)
+    {
+      std::fprintf(stderr, "--http needs an MJPEG stream\n");
+      stopper.stop();
+      record.stop();
+      return 2;
+    }
+    if (!server.start(http_address, http_port))
+    {
+      stopper.stop();
+      record.stop();
+      return 1;
+    }
+  }
+
+  int64_t next_report_ns = start_ns + 1000000000LL;
+  while (!interrupted)
+  {
+    usleep(10000);
+    int64_t now = monotonic_ns();
+    double elapsed = (now - start_ns) / 1e9;
+
+    if ((seconds > 0 && elapsed >= seconds) || (max_frames > 0 && frames >= max_frames) ||
+        (!replay_path.empty() && replay_finished(sources)))
+    {
+      break;
+    }
+
+    if (trace_requested.exchange(false))
+    {
+      tracer::instance().dump(trace_path);
+    }
+
+    if (periodic_stats && now >= next_report_ns)
+    {
+      unsigned long count = frames;
+      print_stats(combine_stats(sources), elapsed, count ? (cpu_seconds() - cpu_start) * 1e6 / count : 0.0);
+      next_report_ns += 1000000000LL;
+    }
+  }
+
+  captureStats stats = combine_stats(sources);
+  double elapsed = (monotonic_ns() - start_ns) / 1e9;
+  double cpu = cpu_seconds() - cpu_start;
+  stopper.stop();
+  writer.close();
+  record.stop();
+  mjpegServerStats served = server.get_stats();
+  server.stop();
+  shm.close();
+
+  unsigned long count = frames;
+  print_stats(stats, elapsed, count ? cpu * 1e6 / count : 0.0);
+  if (!record_path.empty())
+  {
+    recorderStats rec = record.get_stats();
+    std::printf("{\"recorded_frames\": %llu, \"recorder_dropped\": %llu, \"recorded_bytes\": %llu}\n",
+                static_cast<unsigned long long>(rec.frames_written),
+                static_cast<unsigned long long>(rec.frames_dropped),
+                static_cast<unsigned long long>(rec.bytes_written));
+  }
+  if (http)
+  {
+    std::printf("{\"http_published\": %llu, \"http_sent\": %llu, \"http_skipped\": %llu}\n",
+                static_cast<unsigned long long>(served.frames_published),
+                static_cast<unsigned long long>(served.frames_sent),
+                static_cast<unsigned long long>(served.frames_skipped));
+  }
+  return 0;
+}
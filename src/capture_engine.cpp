@@ -0,0 +1,294 @@
+#include "capture_engine.h"
+
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+CaptureEngine::CaptureEngine(int worker_count)
+  : epoll_fd(-1), wake_fd(-1), worker_count(worker_count < 0 ? 0 : worker_count), next_id(1), running(false)
+{
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
+  {
+    CERR_ENDL("Failed to create epoll instance: " << strerror(errno));
+    return;
+  }
+
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd == -1)
+  {
+    CERR_ENDL("Failed to create wakeup eventfd: " << strerror(errno));
+    return;
+  }
+
+  // Id 0 is reserved for the wakeup fd; cameras start at 1.
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = 0;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1)
+  {
+    CERR_ENDL("Failed to register wakeup eventfd: " << strerror(errno));
+  }
+}
+
+CaptureEngine::~CaptureEngine()
+{
+  stop();
+
+  std::map<uint64_t, std::shared_ptr<cameraEntry>> remaining;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    remaining.swap(cameras);
+  }
+  for (auto& item : remaining)
+  {
+    item.second->camera->stop_stream();
+  }
+
+  if (wake_fd != -1)
+  {
+    close(wake_fd);
+  }
+  if (epoll_fd != -1)
+  {
+    close(epoll_fd);
+  }
+}
+
+void CaptureEngine::start()
+{
+  if (running || epoll_fd == -1)
+  {
+    return;
+  }
+
+  running = true;
+  reactor_thread = std::thread(&CaptureEngine::reactorLoop, this);
+  for (int i = 0; i < worker_count; ++i)
+  {
+    workers.push_back(std::thread(&CaptureEngine::workerLoop, this));
+  }
+}
+
+void CaptureEngine::stop()
+{
+  if (!running)
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) == -1)
+  {
+    CERR_ENDL("Failed to wake reactor thread: " << strerror(errno));
+  }
+  job_ready.notify_all();
+
+  if (reactor_thread.joinable())
+  {
+    reactor_thread.join();
+  }
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+  workers.clear();
+}
+
+usb_cam* CaptureEngine::addCamera(const m_deviceConfig& config)
+{
+  return static_cast<usb_cam*>(addSource(std::unique_ptr<capture_source>(new usb_cam), config));
+}
+
+capture_source* CaptureEngine::addSource(std::unique_ptr<capture_source> source, const m_deviceConfig& config)
+{
+  if (!source->open_stream(config))
+  {
+    CERR_ENDL("Failed to open camera: " << config.path);
+    return nullptr;
+  }
+
+  std::shared_ptr<cameraEntry> entry(new cameraEntry);
+  entry->camera = std::move(source);
+  entry->busy = false;
+  entry->removed = false;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  entry->id = next_id++;
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT;
+  ev.data.u64 = entry->id;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, entry->camera->device_fd(), &ev) == -1)
+  {
+    CERR_ENDL("Failed to register camera " << config.path << ": " << strerror(errno));
+    entry->camera->stop_stream();
+    return nullptr;
+  }
+
+  cameras[entry->id] = entry;
+  return entry->camera.get();
+}
+
+void CaptureEngine::removeCamera(capture_source* camera)
+{
+  std::shared_ptr<cameraEntry> entry;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto& item : cameras)
+    {
+      if (item.second->camera.get() == camera)
+      {
+        entry = item.second;
+        break;
+      }
+    }
+    if (!entry)
+    {
+      return;
+    }
+
+    entry->removed = true;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, camera->device_fd(), nullptr);
+    job_done.wait(lock, [&entry]() { return !entry->busy; });
+    cameras.erase(entry->id);
+  }
+
+  entry->camera->stop_stream();
+}
+
+size_t CaptureEngine::cameraCount()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return cameras.size();
+}
+
+size_t CaptureEngine::threadCount() const
+{
+  return 1 + worker_count;
+}
+
+void CaptureEngine::reactorLoop()
+{
+  TRACE_THREAD_NAME("capture reactor");
+  struct epoll_event events[MAX_EVENTS];
+
+  while (running)
+  {
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, EPOLL_TIMEOUT_MS);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      CERR_ENDL("Failed to wait for camera events: " << strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+      if (events[i].data.u64 == 0)
+      {
+        uint64_t count;
+        while (read(wake_fd, &count, sizeof(count)) > 0)
+        {
+        }
+        continue;
+      }
+
+      job j;
+      j.events = events[i].events;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cameras.find(events[i].data.u64);
+        if (it == cameras.end())
+        {
+          // Removed after epoll_wait returned.
+          continue;
+        }
+        j.entry = it->second;
+        j.entry->busy = true;
+
+        if (worker_count > 0)
+        {
+          jobs.push_back(j);
+          job_ready.notify_one();
+          continue;
+        }
+      }
+      runJob(j);
+    }
+  }
+}
+
+void CaptureEngine::workerLoop()
+{
+  TRACE_THREAD_NAME("capture worker");
+  while (true)
+  {
+    job j;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      job_ready.wait(lock, [this]() { return !running || !jobs.empty(); });
+      if (jobs.empty())
+      {
+        // Only exit once the queue is drained, so every dispatched camera gets re-armed.
+        return;
+      }
+      j = jobs.front();
+      jobs.pop_front();
+    }
+    runJob(j);
+  }
+}
+
+void CaptureEngine::runJob(const job& j)
+{
+  short revents = 0;
+  revents |= (j.events & EPOLLIN) ? POLLIN : 0;
+  revents |= (j.events & EPOLLPRI) ? POLLPRI : 0;
+  revents |= (j.events & EPOLLERR) ? POLLERR : 0;
+  revents |= (j.events & EPOLLHUP) ? POLLHUP : 0;
+
+  bool ok = j.entry->camera->service(revents);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  j.entry->busy = false;
+  // Once removeCamera() has unregistered the fd there is nothing to re-arm; it is waiting to close the camera.
+  if (!j.entry->removed)
+  {
+    if (ok)
+    {
+      rearm(*j.entry);
+    }
+    else
+    {
+      // Left disarmed; the owner is expected to removeCamera() it.
+      j.entry->camera->streaming = false;
+      CERR_ENDL("Camera " << j.entry->id << " stopped streaming");
+    }
+  }
+  job_done.notify_all();
+}
+
+void CaptureEngine::rearm(const cameraEntry& entry)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT;
+  ev.data.u64 = entry.id;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, entry.camera->device_fd(), &ev) == -1)
+  {
+    CERR_ENDL("Failed to re-arm camera " << entry.id << ": " << strerror(errno));
+  }
+}
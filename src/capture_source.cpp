@@ -0,0 +1,195 @@
+#include "capture_source.h"
+#include "debug.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+capture_source::capture_source() : streaming(false), m_wake_fd(-1)
+{
+  memset(&m_pixfmt, 0, sizeof(m_pixfmt));
+}
+
+capture_source::~capture_source()
+{
+}
+
+void capture_source::start_stream(const m_deviceConfig& config)
+{
+  if (streaming)
+  {
+    return;
+  }
+
+  // Reap a stream whose capture loop already ended on its own, e.g. after the device went away.
+  stop_stream();
+  if (!open_stream(config))
+  {
+    return;
+  }
+
+  m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_wake_fd == -1)
+  {
+    CERR_ENDL("Failed to create wakeup eventfd: " << strerror(errno));
+  }
+
+  m_thread = std::thread(&capture_source::capture_loop, this);
+}
+
+void capture_source::capture_loop()
+{
+  TRACE_THREAD_NAME("capture");
+  struct pollfd fds[2] = {};
+  fds[0].fd = device_fd();
+  fds[0].events = POLLIN | POLLPRI;
+  fds[1].fd = m_wake_fd;
+  fds[1].events = POLLIN;
+
+  while (streaming)
+  {
+    int r = poll(fds, m_wake_fd == -1 ? 1 : 2, POLL_TIMEOUT_MS);
+    if (r == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      CERR_ENDL("Failed to poll capture source: " << strerror(errno));
+      break;
+    }
+
+    if (r == 0 || (fds[1].revents & POLLIN))
+    {
+      // Timeout or stop request; the loop condition decides whether to keep going.
+      continue;
+    }
+
+    if (!service(fds[0].revents))
+    {
+      break;
+    }
+  }
+
+  // No more frames will come, so stop reporting a live stream. stop_stream() still tears it down.
+  streaming = false;
+}
+
+void capture_source::stop_stream()
+{
+  // Keyed on the fd rather than the streaming flag, which is cleared when the stream ends on its own.
+  if (device_fd() == -1)
+  {
+    return;
+  }
+
+  streaming = false;
+
+  if (m_wake_fd != -1)
+  {
+    uint64_t one = 1;
+    if (write(m_wake_fd, &one, sizeof(one)) == -1)
+    {
+      CERR_ENDL("Failed to wake capture thread: " << strerror(errno));
+    }
+  }
+
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+
+  close_stream();
+  m_frames.clear();
+
+  if (m_wake_fd != -1)
+  {
+    close(m_wake_fd);
+    m_wake_fd = -1;
+  }
+}
+
+void capture_source::set_frame_callback(std::function<void()> callback)
+{
+  m_frame_callback = callback;
+}
+
+void capture_source::set_raw_frame_callback(std::function<void(const rawFrame&)> callback)
+{
+  m_raw_callback = callback;
+}
+
+void capture_source::set_target_size(int width, int height)
+{
+  m_decoder.set_target_size(width, height);
+}
+
+void capture_source::begin_stream(const struct v4l2_pix_format& format)
+{
+  m_pixfmt = format;
+  m_decoder.set_format(m_pixfmt.pixelformat, m_pixfmt.width, m_pixfmt.height, m_pixfmt.bytesperline);
+  m_stats.reset();
+}
+
+void capture_source::deliver(const rawFrame& raw)
+{
+  if (m_raw_callback)
+  {
+    TRACE_SCOPE("raw callback");
+    m_raw_callback(raw);
+  }
+
+  // The decoder hands back an image no other slot refers to, so it can be moved into the back slot as-is. It is timed
+  // on its own, so time spent in the raw frame callback (recording, serving) does not count as decode time.
+  cv::Mat img;
+  int64_t decode_start_ns = monotonic_ns();
+  m_decoder.decode(raw.data, raw.bytesused, img);
+  int64_t decode_ns = monotonic_ns() - decode_start_ns;
+  m_stats.record_capture(raw.sequence, raw.timestamp_ns, decode_ns);
+
+  if (!img.empty())
+  {
+    TRACE_SCOPE("handoff");
+    frameData& frame = m_frames.write_slot();
+    frame.image = std::move(img);
+    frame.sequence = raw.sequence;
+    frame.flags = raw.flags;
+    frame.timestamp_ns = raw.timestamp_ns;
+    frame.dequeue_ns = raw.dequeue_ns;
+    frame.decode_ns = decode_ns;
+    m_frames.publish();
+
+    if (m_frame_callback)
+    {
+      m_frame_callback();
+    }
+  }
+}
+
+bool capture_source::acquire_frame(frameData& frame)
+{
+  bool fresh = m_frames.update();
+  frame = m_frames.read_slot();
+  return fresh;
+}
+
+void capture_source::mark_presented(const frameData& frame)
+{
+  // Only a monotonic kernel timestamp is comparable with our clock; otherwise measure from dequeue.
+  int64_t now = monotonic_ns();
+  bool monotonic = (frame.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+  m_stats.record_present(now, now - (monotonic ? frame.timestamp_ns : frame.dequeue_ns));
+}
+
+captureStats capture_source::get_stats()
+{
+  return m_stats.snapshot();
+}
+
+struct v4l2_pix_format capture_source::get_format() const
+{
+  return m_pixfmt;
+}
@@ -0,0 +1,168 @@
+#include "control_writer.h"
+
+#include "trace.h"
+
+control_writer::control_writer(usb_cam* camera)
+  : camera(camera), pending_reset(false), min_interval(std::chrono::steady_clock::duration::zero()), running(false)
+{
+}
+
+control_writer::~control_writer()
+{
+  stop();
+}
+
+void control_writer::start()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running)
+  {
+    return;
+  }
+  running = true;
+  worker = std::thread(&control_writer::run, this);
+}
+
+void control_writer::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running)
+    {
+      return;
+    }
+    running = false;
+    pending_writes.clear();
+    pending_reads.clear();
+    pending_reset = false;
+  }
+  wake.notify_one();
+  worker.join();
+}
+
+void control_writer::set(uint32_t id, int32_t value)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& pending : pending_writes)
+    {
+      if (pending.first == id)
+      {
+        pending.second = value;
+        return;
+      }
+    }
+    pending_writes.push_back(std::make_pair(id, value));
+  }
+  wake.notify_one();
+}
+
+void control_writer::read(const std::vector<uint32_t>& ids)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_reads.insert(ids.begin(), ids.end());
+  }
+  wake.notify_one();
+}
+
+void control_writer::reset_to_default()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_reset = true;
+  }
+  wake.notify_one();
+}
+
+void control_writer::set_max_rate(double batches_per_second)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (batches_per_second > 0)
+  {
+    min_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / batches_per_second));
+  }
+  else
+  {
+    min_interval = std::chrono::steady_clock::duration::zero();
+  }
+}
+
+void control_writer::set_value_callback(std::function<void(uint32_t id, int32_t value)> callback)
+{
+  m_callback = callback;
+}
+
+void control_writer::run()
+{
+  TRACE_THREAD_NAME("controls");
+  std::chrono::steady_clock::time_point last_batch;
+  std::unique_lock<std::mutex> lock(mutex);
+
+  while (running)
+  {
+    wake.wait(lock, [this]()
+              { return !running || pending_reset || !pending_writes.empty() || !pending_reads.empty(); });
+    if (!running)
+    {
+      break;
+    }
+
+    // Under a rate cap, wait out the interval; everything that arrives meanwhile joins this batch.
+    std::chrono::steady_clock::time_point next = last_batch + min_interval;
+    if (std::chrono::steady_clock::now() < next)
+    {
+      wake.wait_until(lock, next, [this]() { return !running; });
+      if (!running)
+      {
+        break;
+      }
+    }
+
+    std::vector<std::pair<uint32_t, int32_t>> writes;
+    writes.swap(pending_writes);
+    std::set<uint32_t> reads;
+    reads.swap(pending_reads);
+    bool reset = pending_reset;
+    pending_reset = false;
+    last_batch = std::chrono::steady_clock::now();
+    lock.unlock();
+
+    if (reset)
+    {
+      camera->reset_controls_to_default();
+    }
+    if (!writes.empty() && !camera->set_controls(writes))
+    {
+      CERR_ENDL("Some controls could not be written");
+    }
+
+    for (const auto& write : writes)
+    {
+      reads.insert(write.first);
+    }
+    std::map<uint32_t, int32_t> values;
+    camera->get_controls(std::vector<uint32_t>(reads.begin(), reads.end()), values);
+
+    lock.lock();
+    if (m_callback)
+    {
+      for (const auto& value : values)
+      {
+        // A value queued while this batch ran is newer than what we read back; let its own batch report it.
+        bool superseded = false;
+        for (const auto& pending : pending_writes)
+        {
+          superseded = superseded || pending.first == value.first;
+        }
+        if (!superseded)
+        {
+          lock.unlock();
+          m_callback(value.first, value.second);
+          lock.lock();
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,348 @@
+#include "device_registry.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+namespace
+{
+const char* const SYSFS_CLASS = "/sys/class/video4linux/";
+
+// Returns N for "videoN", -1 for anything else (vbi, radio, v4l-subdev, ...).
+int node_number(const std::string& name)
+{
+  if (name.compare(0, 5, "video") != 0 || name.size() == 5)
+  {
+    return -1;
+  }
+  for (size_t i = 5; i < name.size(); ++i)
+  {
+    if (!std::isdigit(static_cast<unsigned char>(name[i])))
+    {
+      return -1;
+    }
+  }
+  return std::atoi(name.c_str() + 5);
+}
+
+bool by_node_number(const deviceData& a, const deviceData& b)
+{
+  return node_number(a.path.substr(5)) < node_number(b.path.substr(5));
+}
+
+std::string read_attribute(const std::string& path)
+{
+  std::ifstream file(path.c_str());
+  std::string value;
+  std::getline(file, value);
+  return value;
+}
+
+// sysfs does not say which direction a node streams in, so ask the driver once. Nodes that cannot be opened (e.g. for
+// lack of permission) are kept, as before.
+bool is_capture_node(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1)
+  {
+    DEBUG_ENDL("Cannot query " << path << ": " << strerror(errno));
+    return true;
+  }
+
+  struct v4l2_capability cap;
+  memset(&cap, 0, sizeof(cap));
+  int r;
+  do
+  {
+    r = ioctl(fd, VIDIOC_QUERYCAP, &cap);
+  } while (r == -1 && errno == EINTR);
+  close(fd);
+  if (r == -1)
+  {
+    return false;
+  }
+
+  uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+  if (caps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))
+  {
+    return false;
+  }
+  return (caps & V4L2_CAP_VIDEO_CAPTURE) != 0;
+}
+}  // namespace
+
+device_registry::device_registry() : running(false), netlink_fd(-1), wake_fd(-1)
+{
+}
+
+device_registry::~device_registry()
+{
+  stop();
+}
+
+bool device_registry::read_node(const std::string& name, deviceData& device)
+{
+  if (node_number(name) < 0)
+  {
+    return false;
+  }
+
+  std::string dir = SYSFS_CLASS + name + "/";
+
+  // Secondary nodes of the same device (UVC metadata, for one) have a non-zero index.
+  std::string index = read_attribute(dir + "index");
+  if (!index.empty() && std::atoi(index.c_str()) != 0)
+  {
+    return false;
+  }
+
+  device.path = "/dev/" + name;
+
+  // Output-only and mem-to-mem nodes have index 0 too.
+  if (!is_capture_node(device.path))
+  {
+    return false;
+  }
+
+  device.device_name = read_attribute(dir + "name");
+
+  char resolved[PATH_MAX];
+  if (realpath((dir + "device").c_str(), resolved) != nullptr)
+  {
+    device.bus_path = resolved;
+  }
+  return true;
+}
+
+std::vector<deviceData> device_registry::enumerate()
+{
+  std::vector<deviceData> devices;
+
+  DIR* dir = opendir(SYSFS_CLASS);
+  if (dir == nullptr)
+  {
+    CERR_ENDL("Failed to open " << SYSFS_CLASS);
+    return devices;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr)
+  {
+    deviceData device;
+    if (read_node(entry->d_name, device))
+    {
+      devices.push_back(device);
+    }
+  }
+  closedir(dir);
+
+  std::sort(devices.begin(), devices.end(), by_node_number);
+  return devices;
+}
+
+bool device_registry::start()
+{
+  if (running)
+  {
+    return true;
+  }
+
+  std::vector<deviceData> found = enumerate();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    known.clear();
+    for (const auto& device : found)
+    {
+      known[device.path] = device;
+    }
+  }
+
+  netlink_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+  if (netlink_fd == -1)
+  {
+    CERR_ENDL("Failed to open uevent socket: " << strerror(errno));
+    return false;
+  }
+
+  // Group 1 carries the kernel's own uevents, which do not depend on udev running.
+  struct sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = 1;
+  if (bind(netlink_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1)
+  {
+    CERR_ENDL("Failed to bind uevent socket: " << strerror(errno));
+    close(netlink_fd);
+    netlink_fd = -1;
+    return false;
+  }
+
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd == -1)
+  {
+    CERR_ENDL("Failed to create eventfd: " << strerror(errno));
+    close(netlink_fd);
+    netlink_fd = -1;
+    return false;
+  }
+
+  running = true;
+  monitor_thread = std::thread(&device_registry::monitor_loop, this);
+  return true;
+}
+
+void device_registry::stop()
+{
+  if (!running)
+  {
+    return;
+  }
+
+  running = false;
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) == -1)
+  {
+    CERR_ENDL("Failed to wake device monitor: " << strerror(errno));
+  }
+  if (monitor_thread.joinable())
+  {
+    monitor_thread.join();
+  }
+
+  close(netlink_fd);
+  close(wake_fd);
+  netlink_fd = -1;
+  wake_fd = -1;
+}
+
+std::vector<deviceData> device_registry::devices()
+{
+  std::vector<deviceData> result;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& item : known)
+    {
+      result.push_back(item.second);
+    }
+  }
+  std::sort(result.begin(), result.end(), by_node_number);
+  return result;
+}
+
+void device_registry::set_callback(std::function<void(deviceEvent, const deviceData&)> callback)
+{
+  m_callback = callback;
+}
+
+void device_registry::monitor_loop()
+{
+  char buffer[8192];
+  struct pollfd fds[2];
+  fds[0].fd = netlink_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = wake_fd;
+  fds[1].events = POLLIN;
+
+  while (running)
+  {
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      CERR_ENDL("Device monitor poll failed: " << strerror(errno));
+      break;
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+      break;
+    }
+
+    if (fds[0].revents & POLLIN)
+    {
+      ssize_t len;
+      while ((len = recv(netlink_fd, buffer, sizeof(buffer) - 1, 0)) > 0)
+      {
+        buffer[len] = '\0';
+        handle_uevent(buffer, len);
+      }
+    }
+  }
+}
+
+void device_registry::handle_uevent(const char* message, size_t size)
+{
+  // "ACTION@DEVPATH\0KEY=VALUE\0KEY=VALUE\0..."
+  std::string action;
+  std::string subsystem;
+  std::string devname;
+  for (size_t pos = strlen(message) + 1; pos < size; pos += strlen(message + pos) + 1)
+  {
+    const char* field = message + pos;
+    if (strncmp(field, "ACTION=", 7) == 0)
+    {
+      action = field + 7;
+    }
+    else if (strncmp(field, "SUBSYSTEM=", 10) == 0)
+    {
+      subsystem = field + 10;
+    }
+    else if (strncmp(field, "DEVNAME=", 8) == 0)
+    {
+      devname = field + 8;
+    }
+  }
+
+  if (subsystem != "video4linux" || devname.empty())
+  {
+    return;
+  }
+
+  // DEVNAME is relative to /dev, normally just "videoN".
+  std::string name = devname.substr(devname.rfind('/') + 1);
+  deviceData device;
+
+  if (action == "add")
+  {
+    if (!read_node(name, device))
+    {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    known[device.path] = device;
+  }
+  else if (action == "remove")
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = known.find("/dev/" + name);
+    if (it == known.end())
+    {
+      return;
+    }
+    device = it->second;
+    known.erase(it);
+  }
+  else
+  {
+    return;
+  }
+
+  COUT_ENDL("Device " << (action == "add" ? "added: " : "removed: ") << device.path << " - " << device.device_name);
+  if (m_callback)
+  {
+    m_callback(action == "add" ? DEVICE_ADDED : DEVICE_REMOVED, device);
+  }
+}
@@ -0,0 +1,63 @@
+#include "frame_decoder.h"
+
+#include <linux/videodev2.h>
+#include "pixel_format.h"
+#include "frame_pool.h"
+#include "trace.h"
+#include "debug.h"
+
+frame_decoder::frame_decoder() : fourcc(0), width(0), height(0), bytesperline(0), target_width(0), target_height(0)
+{
+}
+
+bool frame_decoder::supported(uint32_t fourcc)
+{
+  return fourcc == V4L2_PIX_FMT_MJPEG || (fourcc == V4L2_PIX_FMT_H264 && h264_decoder::available()) ||
+         pixel_format_supported(fourcc);
+}
+
+void frame_decoder::set_format(uint32_t fourcc, int width, int height, int bytesperline)
+{
+  this->fourcc = fourcc;
+  this->width = width;
+  this->height = height;
+  this->bytesperline = bytesperline;
+  if (fourcc == V4L2_PIX_FMT_H264)
+  {
+    h264.reset();
+  }
+}
+
+void frame_decoder::set_target_size(int width, int height)
+{
+  target_width = width;
+  target_height = height;
+}
+
+bool frame_decoder::decode(const uint8_t* data, size_t size, cv::Mat& out)
+{
+  if (fourcc == V4L2_PIX_FMT_MJPEG)
+  {
+    TRACE_SCOPE("decode MJPEG");
+    out.release();
+    return mjpeg.decode(data, size, target_width, target_height, out);
+  }
+  if (fourcc == V4L2_PIX_FMT_H264)
+  {
+    TRACE_SCOPE("decode H.264");
+    out.release();
+    return h264.decode(data, size, target_width, target_height, out);
+  }
+
+  // Uncompressed formats convert in one pass to 4-channel BGRX, which the GUI displays as-is.
+  TRACE_SCOPE("convert");
+  cv::Mat img = frame_pool::image(height, width, CV_8UC4);
+  if (!convert_to_rgb32(fourcc, data, size, width, height, bytesperline, img.data, img.step))
+  {
+    CERR_ENDL("Failed to convert frame (" << size << " bytes)");
+    out.release();
+    return false;
+  }
+  out = img;
+  return true;
+}
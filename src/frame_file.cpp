@@ -0,0 +1,193 @@
+#include "frame_file.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "debug.h"
+
+namespace
+{
+const char FRAME_FILE_MAGIC[8] = { 'V', '4', 'L', '2', 'F', 'R', 'M', '1' };
+const size_t RECORD_ALIGN = 8;
+// Large stdio buffer so a stream of frames turns into few, big write() calls.
+const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+size_t padded(size_t size)
+{
+  return (size + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+}
+}  // namespace
+
+frame_file_writer::frame_file_writer() : file(nullptr), count(0)
+{
+}
+
+frame_file_writer::~frame_file_writer()
+{
+  close();
+}
+
+bool frame_file_writer::open(const std::string& path, uint32_t fourcc, uint32_t width, uint32_t height,
+                             uint32_t bytesperline)
+{
+  close();
+
+  file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr)
+  {
+    CERR_ENDL("Failed to open frame file for writing: " << path << ": " << strerror(errno));
+    return false;
+  }
+  setvbuf(file, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+
+  frameFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FRAME_FILE_MAGIC, sizeof(header.magic));
+  header.fourcc = fourcc;
+  header.width = width;
+  header.height = height;
+  header.bytesperline = bytesperline;
+
+  if (std::fwrite(&header, sizeof(header), 1, file) != 1)
+  {
+    CERR_ENDL("Failed to write frame file header: " << path);
+    close();
+    return false;
+  }
+  count = 0;
+  return true;
+}
+
+bool frame_file_writer::write_frame(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence)
+{
+  if (file == nullptr)
+  {
+    return false;
+  }
+
+  frameFileRecord record;
+  record.timestamp_ns = timestamp_ns;
+  record.sequence = sequence;
+  record.size = static_cast<uint32_t>(size);
+
+  static const uint8_t padding[RECORD_ALIGN] = { 0 };
+  size_t pad = padded(size) - size;
+  if (std::fwrite(&record, sizeof(record), 1, file) != 1 || std::fwrite(data, 1, size, file) != size ||
+      std::fwrite(padding, 1, pad, file) != pad)
+  {
+    CERR_ENDL("Failed to write frame " << sequence << ": " << strerror(errno));
+    return false;
+  }
+  ++count;
+  return true;
+}
+
+void frame_file_writer::close()
+{
+  if (file != nullptr)
+  {
+    std::fclose(file);
+    file = nullptr;
+  }
+}
+
+size_t frame_file_writer::frames_written() const
+{
+  return count;
+}
+
+frame_file_reader::frame_file_reader() : mapping(nullptr), mapping_size(0)
+{
+  memset(&file_header, 0, sizeof(file_header));
+}
+
+frame_file_reader::~frame_file_reader()
+{
+  close();
+}
+
+bool frame_file_reader::open(const std::string& path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    CERR_ENDL("Failed to open frame file: " << path << ": " << strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(frameFileHeader))
+  {
+    CERR_ENDL("Frame file is too small: " << path);
+    ::close(fd);
+    return false;
+  }
+
+  mapping_size = st.st_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    CERR_ENDL("Failed to map frame file: " << path << ": " << strerror(errno));
+    mapping = nullptr;
+    return false;
+  }
+  madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+  const uint8_t* base = static_cast<const uint8_t*>(mapping);
+  memcpy(&file_header, base, sizeof(file_header));
+  if (memcmp(file_header.magic, FRAME_FILE_MAGIC, sizeof(file_header.magic)) != 0)
+  {
+    CERR_ENDL("Not a frame file: " << path);
+    close();
+    return false;
+  }
+
+  size_t offset = sizeof(frameFileHeader);
+  while (offset + sizeof(frameFileRecord) <= mapping_size)
+  {
+    frameFileRecord record;
+    memcpy(&record, base + offset, sizeof(record));
+    offset += sizeof(record);
+    if (offset + record.size > mapping_size)
+    {
+      CERR_ENDL("Frame file is truncated after " << entries.size() << " frames: " << path);
+      break;
+    }
+
+    frameFileEntry entry;
+    entry.data = base + offset;
+    entry.size = record.size;
+    entry.timestamp_ns = record.timestamp_ns;
+    entry.sequence = record.sequence;
+    entries.push_back(entry);
+
+    offset += padded(record.size);
+  }
+  return true;
+}
+
+void frame_file_reader::close()
+{
+  entries.clear();
+  if (mapping != nullptr)
+  {
+    munmap(mapping, mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+  }
+}
+
+const frameFileHeader& frame_file_reader::header() const
+{
+  return file_header;
+}
+
+const std::vector<frameFileEntry>& frame_file_reader::frames() const
+{
+  return entries;
+}
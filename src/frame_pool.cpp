@@ -0,0 +1,156 @@
+#include "frame_pool.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+// Enough for a handful of 4K BGRX frames in flight per camera.
+const size_t DEFAULT_MAX_CACHED_BYTES = 256 << 20;
+}  // namespace
+
+frame_pool::frame_pool() : max_cached_bytes(DEFAULT_MAX_CACHED_BYTES)
+{
+}
+
+frame_pool& frame_pool::instance()
+{
+  static frame_pool* pool = new frame_pool();
+  return *pool;
+}
+
+cv::Mat frame_pool::image(int rows, int cols, int type)
+{
+  cv::Mat img;
+  img.allocator = &instance();
+  img.create(rows, cols, type);
+  return img;
+}
+
+void frame_pool::set_max_cached_bytes(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  max_cached_bytes = bytes;
+}
+
+void frame_pool::trim()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& list : free_lists)
+  {
+    for (cv::UMatData* u : list.second)
+    {
+      free_buffer(u);
+    }
+  }
+  free_lists.clear();
+  stats.cached_bytes = 0;
+}
+
+framePoolStats frame_pool::get_stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+cv::UMatData* frame_pool::allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                                   cv::AccessFlag flags, cv::UMatUsageFlags usage) const
+{
+  // Images wrapping caller-owned memory have nothing to pool.
+  if (data != nullptr)
+  {
+    return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+  }
+
+  // Same layout rules as OpenCV's standard allocator: densely packed rows.
+  size_t total = CV_ELEM_SIZE(type);
+  for (int i = dims - 1; i >= 0; --i)
+  {
+    if (step != nullptr)
+    {
+      step[i] = total;
+    }
+    total *= sizes[i];
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = free_lists.find(total);
+    if (it != free_lists.end() && !it->second.empty())
+    {
+      cv::UMatData* u = it->second.back();
+      it->second.pop_back();
+      stats.cached_bytes -= total;
+      ++stats.reuses;
+
+      // Reset the bookkeeping in place; the pixel buffer stays attached.
+      uint8_t* buffer = u->origdata;
+      u->~UMatData();
+      new (u) cv::UMatData(this);
+      u->data = u->origdata = buffer;
+      u->size = total;
+      return u;
+    }
+    ++stats.allocations;
+  }
+
+  void* buffer = nullptr;
+  if (posix_memalign(&buffer, ALIGNMENT, total ? total : 1) != 0)
+  {
+    throw std::bad_alloc();
+  }
+  cv::UMatData* u = new cv::UMatData(this);
+  u->data = u->origdata = static_cast<uint8_t*>(buffer);
+  u->size = total;
+  return u;
+}
+
+bool frame_pool::allocate(cv::UMatData* data, cv::AccessFlag flags, cv::UMatUsageFlags usage) const
+{
+  (void)flags;
+  (void)usage;
+  return data != nullptr;
+}
+
+void frame_pool::deallocate(cv::UMatData* u) const
+{
+  if (u == nullptr)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (stats.cached_bytes + u->size > max_cached_bytes)
+  {
+    // Make room by dropping buffers of sizes nobody is asking for right now.
+    for (auto it = free_lists.begin(); it != free_lists.end() && stats.cached_bytes + u->size > max_cached_bytes;)
+    {
+      if (it->first == u->size)
+      {
+        ++it;
+        continue;
+      }
+      for (cv::UMatData* stale : it->second)
+      {
+        stats.cached_bytes -= stale->size;
+        free_buffer(stale);
+      }
+      it = free_lists.erase(it);
+    }
+  }
+
+  if (stats.cached_bytes + u->size > max_cached_bytes)
+  {
+    free_buffer(u);
+    return;
+  }
+  free_lists[u->size].push_back(u);
+  stats.cached_bytes += u->size;
+}
+
+void frame_pool::free_buffer(cv::UMatData* u) const
+{
+  std::free(u->origdata);
+  delete u;
+  ++stats.releases;
+}
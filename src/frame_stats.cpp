@@ -0,0 +1,110 @@
+#include "frame_stats.h"
+
+#include <algorithm>
+
+void frame_stats::rollingWindow::clear()
+{
+  count = 0;
+  next = 0;
+}
+
+void frame_stats::rollingWindow::push(int64_t value)
+{
+  values[next] = value;
+  next = (next + 1) % WINDOW;
+  if (count < WINDOW)
+  {
+    ++count;
+  }
+}
+
+// Events per second between the oldest and newest timestamp in the window.
+double frame_stats::rollingWindow::rate_per_second() const
+{
+  if (count < 2)
+  {
+    return 0.0;
+  }
+
+  int newest = (next + WINDOW - 1) % WINDOW;
+  int oldest = (next + WINDOW - count) % WINDOW;
+  int64_t span = values[newest] - values[oldest];
+  return span > 0 ? (count - 1) * 1e9 / span : 0.0;
+}
+
+double frame_stats::rollingWindow::percentile_ms(double p) const
+{
+  if (count == 0)
+  {
+    return 0.0;
+  }
+
+  int64_t sorted[WINDOW];
+  std::copy(values, values + count, sorted);
+  int k = static_cast<int>(p * (count - 1) + 0.5);
+  std::nth_element(sorted, sorted + k, sorted + count);
+  return sorted[k] / 1e6;
+}
+
+frame_stats::frame_stats()
+{
+  reset();
+}
+
+void frame_stats::reset()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  capture_times.clear();
+  present_times.clear();
+  decode_times.clear();
+  latencies.clear();
+  have_sequence = false;
+  last_sequence = 0;
+  frames_captured = 0;
+  frames_delivered = 0;
+  frames_dropped = 0;
+}
+
+void frame_stats::record_capture(uint32_t sequence, int64_t timestamp_ns, int64_t decode_ns)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // Drivers number every frame they capture, including the ones they drop for lack of a queued buffer.
+  if (have_sequence && sequence > last_sequence + 1)
+  {
+    frames_dropped += sequence - last_sequence - 1;
+  }
+  have_sequence = true;
+  last_sequence = sequence;
+
+  ++frames_captured;
+  capture_times.push(timestamp_ns);
+  decode_times.push(decode_ns);
+}
+
+void frame_stats::record_present(int64_t present_ns, int64_t latency_ns)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  ++frames_delivered;
+  present_times.push(present_ns);
+  latencies.push(latency_ns);
+}
+
+captureStats frame_stats::snapshot()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  captureStats stats;
+  stats.capture_fps = capture_times.rate_per_second();
+  stats.delivered_fps = present_times.rate_per_second();
+  stats.frames_captured = frames_captured;
+  stats.frames_delivered = frames_delivered;
+  stats.frames_dropped = frames_dropped;
+  stats.decode_ms_p50 = decode_times.percentile_ms(0.50);
+  stats.decode_ms_p90 = decode_times.percentile_ms(0.90);
+  stats.decode_ms_p99 = decode_times.percentile_ms(0.99);
+  stats.latency_ms_p50 = latencies.percentile_ms(0.50);
+  stats.latency_ms_p90 = latencies.percentile_ms(0.90);
+  stats.latency_ms_p99 = latencies.percentile_ms(0.99);
+  return stats;
+}
@@ -0,0 +1,180 @@
+#include "h264_decoder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+#include "frame_pool.h"
+#include "debug.h"
+
+#ifdef HAVE_LIBAVCODEC
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+namespace
+{
+// Each frame thread holds back one picture; past four the added latency outweighs the throughput at camera rates.
+const unsigned MAX_THREADS = 4;
+}  // namespace
+
+h264_decoder::h264_decoder()
+  : context(nullptr), packet(nullptr), frame(nullptr), scaler(nullptr), errors(0)
+{
+}
+
+h264_decoder::~h264_decoder()
+{
+  close();
+}
+
+bool h264_decoder::available()
+{
+#ifdef HAVE_LIBAVCODEC
+  return avcodec_find_decoder(AV_CODEC_ID_H264) != nullptr;
+#else
+  return false;
+#endif
+}
+
+bool h264_decoder::open()
+{
+#ifdef HAVE_LIBAVCODEC
+  const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+  if (codec == nullptr)
+  {
+    CERR_ENDL("libavcodec has no H.264 decoder");
+    return false;
+  }
+
+  AVCodecContext* ctx = avcodec_alloc_context3(codec);
+  if (ctx == nullptr)
+  {
+    return false;
+  }
+  ctx->thread_count = static_cast<int>(std::max(1u, std::min(std::thread::hardware_concurrency(), MAX_THREADS)));
+  ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if (avcodec_open2(ctx, codec, nullptr) < 0)
+  {
+    CERR_ENDL("Failed to open the H.264 decoder");
+    avcodec_free_context(&ctx);
+    return false;
+  }
+
+  context = ctx;
+  packet = av_packet_alloc();
+  frame = av_frame_alloc();
+  errors = 0;
+  return packet != nullptr && frame != nullptr;
+#else
+  return false;
+#endif
+}
+
+void h264_decoder::close()
+{
+#ifdef HAVE_LIBAVCODEC
+  AVCodecContext* ctx = static_cast<AVCodecContext*>(context);
+  AVPacket* pkt = static_cast<AVPacket*>(packet);
+  AVFrame* frm = static_cast<AVFrame*>(frame);
+  avcodec_free_context(&ctx);
+  av_packet_free(&pkt);
+  av_frame_free(&frm);
+  sws_freeContext(static_cast<SwsContext*>(scaler));
+#endif
+  context = nullptr;
+  packet = nullptr;
+  frame = nullptr;
+  scaler = nullptr;
+}
+
+void h264_decoder::reset()
+{
+#ifdef HAVE_LIBAVCODEC
+  if (context != nullptr)
+  {
+    avcodec_flush_buffers(static_cast<AVCodecContext*>(context));
+  }
+#endif
+  errors = 0;
+}
+
+bool h264_decoder::decode(const uint8_t* data, size_t size, int target_width, int target_height, cv::Mat& out)
+{
+#ifdef HAVE_LIBAVCODEC
+  if (context == nullptr && !open())
+  {
+    close();
+    return false;
+  }
+
+  AVCodecContext* ctx = static_cast<AVCodecContext*>(context);
+  AVPacket* pkt = static_cast<AVPacket*>(packet);
+  AVFrame* frm = static_cast<AVFrame*>(frame);
+
+  // The packet only borrows the V4L2 buffer; the decoder copies what it keeps before send returns.
+  pkt->data = const_cast<uint8_t*>(data);
+  pkt->size = static_cast<int>(size);
+  int ret = avcodec_send_packet(ctx, pkt);
+  pkt->data = nullptr;
+  pkt->size = 0;
+  if (ret < 0 && ret != AVERROR(EAGAIN))
+  {
+    // Expected until the first keyframe with its SPS/PPS comes along; only report persistent failures.
+    if (++errors % 100 == 1)
+    {
+      char text[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+      av_strerror(ret, text, sizeof(text));
+      CERR_ENDL("Failed to decode H.264 frame: " << text);
+    }
+    return false;
+  }
+
+  // A packet yields at most one picture from a camera stream, but drain anyway so the decoder never backs up.
+  bool have_picture = false;
+  while (avcodec_receive_frame(ctx, frm) == 0)
+  {
+    int width = frm->width;
+    int height = frm->height;
+    int fit_width = width;
+    int fit_height = height;
+    if (target_width > 0 && target_height > 0)
+    {
+      double scale = std::min(static_cast<double>(target_width) / width, static_cast<double>(target_height) / height);
+      fit_width = std::min(width, static_cast<int>(width * scale + 0.5));
+      fit_height = std::min(height, static_cast<int>(height * scale + 0.5));
+    }
+
+    SwsContext* sws =
+        sws_getCachedContext(static_cast<SwsContext*>(scaler), width, height, static_cast<AVPixelFormat>(frm->format),
+                             fit_width, fit_height, AV_PIX_FMT_BGR0,
+                             fit_width < width ? SWS_FAST_BILINEAR : SWS_POINT, nullptr, nullptr, nullptr);
+    scaler = sws;
+    if (sws == nullptr)
+    {
+      CERR_ENDL("Failed to set up H.264 color conversion");
+      av_frame_unref(frm);
+      return false;
+    }
+
+    cv::Mat buffer = frame_pool::image(fit_height, fit_width, CV_8UC4);
+    uint8_t* dst[4] = { buffer.data, nullptr, nullptr, nullptr };
+    int dst_stride[4] = { static_cast<int>(buffer.step), 0, 0, 0 };
+    sws_scale(sws, frm->data, frm->linesize, 0, height, dst, dst_stride);
+    av_frame_unref(frm);
+
+    out = buffer;
+    have_picture = true;
+  }
+  return have_picture;
+#else
+  (void)data;
+  (void)size;
+  (void)target_width;
+  (void)target_height;
+  out.release();
+  return false;
+#endif
+}
@@ -1,17 +1,42 @@
 #include "joystick.h"
 
-Joystick::Joystick(std::string device) : device_path(device), joystick_fd(-1), running(false)
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+Joystick::Joystick(std::string device)
+  : device_path(device)
+  , joystick_fd(-1)
+  , wake_fd(-1)
+  , running(false)
+  , sequence(0)
+  , connected(false)
+  , axis_count(0)
+  , button_count(0)
+  , queue_enabled(false)
+  , queue_head(0)
+  , queue_tail(0)
+  , queue_dropped(0)
 {
-  joystick_fd = open(device.c_str(), O_RDONLY | O_NONBLOCK);
-  if (joystick_fd == -1)
+  for (auto& value : axis_values)
   {
-    CERR_ENDL("Failed to open joystick: " << device);
+    value.store(0, std::memory_order_relaxed);
+  }
+  for (auto& value : button_values)
+  {
+    value.store(0, std::memory_order_relaxed);
+  }
+
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd == -1)
+  {
+    CERR_ENDL("Failed to create joystick wakeup eventfd: " << strerror(errno));
   }
-  else
+
+  if (!openDevice())
   {
-    COUT("Joystick connected: ");
-    COUT_ENDL(device);
-    initialize();
+    CERR_ENDL("Failed to open joystick: " << device);
   }
 }
 
@@ -20,19 +45,24 @@ Joystick::~Joystick()
   stopEventThread();
   if (joystick_fd != -1)
   {
-    close(joystick_fd);
+    closeDevice();
     COUT_ENDL("Joystick disconnected.");
   }
+  if (wake_fd != -1)
+  {
+    close(wake_fd);
+  }
 }
 
 bool Joystick::isConnected() const
 {
-  return joystick_fd != -1;
+  return connected;
 }
 
 void Joystick::startEventThread()
 {
-  if (!running && joystick_fd != -1)
+  // Runs even without a device so a joystick plugged in later is picked up.
+  if (!running && wake_fd != -1)
   {
     running = true;
     event_thread = std::thread(&Joystick::readEvent, this);
@@ -44,6 +74,11 @@ void Joystick::stopEventThread()
   if (running)
   {
     running = false;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) == -1)
+    {
+      CERR_ENDL("Failed to wake joystick thread: " << strerror(errno));
+    }
     if (event_thread.joinable())
     {
       event_thread.join();
@@ -51,6 +86,100 @@ void Joystick::stopEventThread()
   }
 }
 
+void Joystick::getState(joystickState& state) const
+{
+  for (;;)
+  {
+    uint64_t before = sequence.load(std::memory_order_acquire);
+    if (before & 1)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    state.connected = connected.load(std::memory_order_relaxed);
+    state.axis_count = axis_count.load(std::memory_order_relaxed);
+    state.button_count = button_count.load(std::memory_order_relaxed);
+    for (int i = 0; i < joystickState::MAX_AXES; ++i)
+    {
+      state.axis[i] = axis_values[i].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < joystickState::MAX_BUTTONS; ++i)
+    {
+      state.button[i] = button_values[i].load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) == before)
+    {
+      state.generation = before / 2;
+      return;
+    }
+  }
+}
+
+uint64_t Joystick::generation() const
+{
+  return sequence.load(std::memory_order_acquire) / 2;
+}
+
+void Joystick::setButtonCallback(std::function<void(int button, bool pressed)> callback)
+{
+  button_callback = callback;
+}
+
+void Joystick::enableEventQueue(bool enable)
+{
+  queue_enabled = enable;
+}
+
+bool Joystick::pollEvent(joystickEvent& event)
+{
+  uint32_t head = queue_head.load(std::memory_order_relaxed);
+  if (head == queue_tail.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+  event = queue[head % QUEUE_SIZE];
+  queue_head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+uint64_t Joystick::droppedEvents() const
+{
+  return queue_dropped;
+}
+
+bool Joystick::openDevice()
+{
+  joystick_fd = open(device_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (joystick_fd == -1)
+  {
+    return false;
+  }
+  COUT_ENDL("Joystick connected: " << device_path);
+  initialize();
+  return true;
+}
+
+void Joystick::closeDevice()
+{
+  close(joystick_fd);
+  joystick_fd = -1;
+
+  beginUpdate();
+  connected.store(false, std::memory_order_relaxed);
+  for (auto& value : axis_values)
+  {
+    value.store(0, std::memory_order_relaxed);
+  }
+  for (auto& value : button_values)
+  {
+    value.store(0, std::memory_order_relaxed);
+  }
+  endUpdate();
+}
+
 void Joystick::initialize()
 {
   if (joystick_fd == -1)
@@ -75,40 +204,157 @@ void Joystick::initialize()
     buttons_count = 0;
   }
 
-  // Resize the axis and button vectors
-  axis.resize(axes_count, 0);
-  button.resize(buttons_count, 0);
+  // The driver follows up with JS_EVENT_INIT events carrying the current value of every axis and button.
+  beginUpdate();
+  connected.store(true, std::memory_order_relaxed);
+  int axes = axes_count;
+  int buttons = buttons_count;
+  axis_count.store(axes < joystickState::MAX_AXES ? axes : joystickState::MAX_AXES, std::memory_order_relaxed);
+  button_count.store(buttons < joystickState::MAX_BUTTONS ? buttons : joystickState::MAX_BUTTONS,
+                     std::memory_order_relaxed);
+  endUpdate();
 
   COUT_ENDL("Joystick initialized with " << (int)axes_count << " axes and " << (int)buttons_count << " buttons.");
 }
 
+void Joystick::beginUpdate()
+{
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Joystick::endUpdate()
+{
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Joystick::applyEvent(const struct js_event& event)
+{
+  bool init = event.type & JS_EVENT_INIT;
+  switch (event.type & ~JS_EVENT_INIT)
+  {
+    case JS_EVENT_AXIS:
+      if (event.number >= axis_count.load(std::memory_order_relaxed))
+      {
+        return;
+      }
+      axis_values[event.number].store(event.value, std::memory_order_relaxed);
+      DEBUG_ENDL("Axis event: Axis " << (int)event.number << " Value " << event.value);
+      break;
+    case JS_EVENT_BUTTON:
+      if (event.number >= button_count.load(std::memory_order_relaxed))
+      {
+        return;
+      }
+      button_values[event.number].store(event.value != 0, std::memory_order_relaxed);
+      DEBUG_ENDL("Button event: Button " << (int)event.number << " Value " << event.value);
+      break;
+    default:
+      return;
+  }
+
+  // Initial state events describe the device as it was opened; they are not edges.
+  if (init)
+  {
+    return;
+  }
+
+  if (queue_enabled)
+  {
+    uint32_t tail = queue_tail.load(std::memory_order_relaxed);
+    if (tail - queue_head.load(std::memory_order_acquire) == QUEUE_SIZE)
+    {
+      ++queue_dropped;
+    }
+    else
+    {
+      joystickEvent& slot = queue[tail % QUEUE_SIZE];
+      slot.type = (event.type & ~JS_EVENT_INIT) == JS_EVENT_AXIS ? joystickEvent::AXIS : joystickEvent::BUTTON;
+      slot.number = event.number;
+      slot.value = event.value;
+      slot.time_ms = event.time;
+      queue_tail.store(tail + 1, std::memory_order_release);
+    }
+  }
+}
+
 void Joystick::readEvent()
 {
   while (running)
   {
-    struct js_event event;
-    ssize_t bytes = read(joystick_fd, &event, sizeof(event));
+    if (joystick_fd == -1 && !openDevice())
+    {
+      // Not plugged in: wait for the retry interval or shutdown, whichever comes first.
+      struct pollfd wake = { wake_fd, POLLIN, 0 };
+      if (poll(&wake, 1, RECONNECT_MS) > 0 && (wake.revents & POLLIN))
+      {
+        // Consume the wakeup, or a stop/start without a device would leave it readable and this loop would spin.
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        {
+          CERR_ENDL("Failed to read joystick wakeup: " << strerror(errno));
+        }
+      }
+      continue;
+    }
+
+    struct pollfd fds[2] = { { joystick_fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      CERR_ENDL("Joystick poll failed: " << strerror(errno));
+      break;
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+      uint64_t count;
+      if (read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+      {
+        CERR_ENDL("Failed to read joystick wakeup: " << strerror(errno));
+      }
+      continue;
+    }
+
+    if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+    {
+      COUT_ENDL("Joystick disconnected.");
+      closeDevice();
+      continue;
+    }
+
+    // Drain everything that is queued and publish it as one update.
+    struct js_event events[64];
+    ssize_t bytes = read(joystick_fd, events, sizeof(events));
+    if (bytes == -1)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+      {
+        COUT_ENDL("Joystick disconnected.");
+        closeDevice();
+      }
+      continue;
+    }
+
+    beginUpdate();
+    for (ssize_t i = 0; i < bytes / static_cast<ssize_t>(sizeof(struct js_event)); ++i)
+    {
+      applyEvent(events[i]);
+    }
+    endUpdate();
 
-    if (bytes == sizeof(event))
+    // Callbacks run outside the update so they can read a consistent state.
+    if (button_callback)
     {
-      switch (event.type & ~JS_EVENT_INIT)
+      for (ssize_t i = 0; i < bytes / static_cast<ssize_t>(sizeof(struct js_event)); ++i)
       {
-        case JS_EVENT_AXIS:
-          if (event.number < axis.size())
-          {
-            axis[event.number] = event.value;
-            COUT_ENDL("Axis event: Axis " << (int)event.number << " Value " << event.value);
-          }
-          break;
-        case JS_EVENT_BUTTON:
-          if (event.number < button.size())
-          {
-            button[event.number] = event.value;
-            COUT_ENDL("Button event: Button " << (int)event.number << " Value " << event.value);
-          }
-          break;
-        default:
-          break;
+        if (events[i].type == JS_EVENT_BUTTON)
+        {
+          button_callback(events[i].number, events[i].value != 0);
+        }
       }
     }
   }
@@ -0,0 +1,280 @@
+#include "logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "frame_stats.h"
+
+struct logger::entry
+{
+  std::atomic<size_t> sequence;
+  logLevel level;
+  const char* file;
+  int line;
+  int64_t time_ns;  // CLOCK_REALTIME
+  uint64_t suppressed;
+  size_t length;
+  bool truncated;
+  char text[MESSAGE_BYTES];
+};
+
+std::atomic<int> logger::current_level(LOG_LEVEL_INFO);
+
+namespace
+{
+// Fixed-size stream buffer: formatting a message never allocates, and overflow only marks it truncated.
+class message_buffer : public std::streambuf
+{
+public:
+  message_buffer() : truncated(false)
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    setp(text, text + logger::MESSAGE_BYTES);
+    truncated = false;
+  }
+
+  const char* data() const
+  {
+    return pbase();
+  }
+
+  size_t size() const
+  {
+    return pptr() - pbase();
+  }
+
+  bool truncated;
+
+protected:
+  int_type overflow(int_type c) override
+  {
+    truncated = true;
+    return traits_type::not_eof(c);
+  }
+
+private:
+  char text[logger::MESSAGE_BYTES];
+};
+
+struct threadMessage
+{
+  message_buffer buffer;
+  std::ostream stream;
+
+  threadMessage() : stream(&buffer)
+  {
+  }
+};
+
+thread_local threadMessage thread_message;
+}  // namespace
+
+bool log_site::allow(uint64_t& suppressed_count)
+{
+  int64_t now = monotonic_ns();
+  int64_t start = window_start_ns.load(std::memory_order_relaxed);
+  if (now - start >= WINDOW_NS && window_start_ns.compare_exchange_strong(start, now, std::memory_order_relaxed))
+  {
+    in_window.store(0, std::memory_order_relaxed);
+  }
+  if (in_window.fetch_add(1, std::memory_order_relaxed) >= BURST)
+  {
+    suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  suppressed_count = suppressed.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+logger::logger()
+  : entries(new entry[QUEUE_ENTRIES]), enqueue_pos(0), dequeue_pos(0), dropped_messages(0), reported_drops(0)
+{
+  for (size_t i = 0; i < QUEUE_ENTRIES; ++i)
+  {
+    entries[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  const char* env = std::getenv("V4L2_LOG_LEVEL");
+  logLevel level;
+  if (env != nullptr && parse_level(env, level))
+  {
+    set_level(level);
+  }
+
+  writer = std::thread(&logger::run, this);
+  writer.detach();
+  std::atexit(&logger::flush_at_exit);
+}
+
+logger& logger::instance()
+{
+  static logger* log = new logger();
+  return *log;
+}
+
+void logger::set_level(logLevel level)
+{
+  current_level.store(level, std::memory_order_relaxed);
+}
+
+logLevel logger::level()
+{
+  return static_cast<logLevel>(current_level.load(std::memory_order_relaxed));
+}
+
+bool logger::parse_level(const std::string& text, logLevel& level)
+{
+  static const char* const NAMES[] = { "off", "error", "warning", "info", "debug" };
+  for (int i = LOG_LEVEL_OFF; i <= LOG_LEVEL_DEBUG; ++i)
+  {
+    if (text == NAMES[i])
+    {
+      level = static_cast<logLevel>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::ostream& logger::stream()
+{
+  thread_message.buffer.reset();
+  thread_message.stream.clear();
+  return thread_message.stream;
+}
+
+void logger::write(logLevel level, const log_site& site, uint64_t suppressed)
+{
+  size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+  entry* e;
+  for (;;)
+  {
+    e = &entries[pos & (QUEUE_ENTRIES - 1)];
+    size_t sequence = e->sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0)
+    {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // The writer is a full queue behind; drop rather than wait for the terminal.
+      dropped_messages.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  e->level = level;
+  e->file = site.file;
+  e->line = site.line;
+  e->time_ns = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+  e->suppressed = suppressed;
+
+  e->length = thread_message.buffer.size();
+  e->truncated = thread_message.buffer.truncated;
+  memcpy(e->text, thread_message.buffer.data(), e->length);
+  e->sequence.store(pos + 1, std::memory_order_release);
+
+  if (level <= LOG_LEVEL_ERROR)
+  {
+    wake.notify_one();
+  }
+}
+
+void logger::flush()
+{
+  std::lock_guard<std::mutex> lock(consumer_mutex);
+  drain(stderr);
+}
+
+void logger::flush_at_exit()
+{
+  instance().flush();
+}
+
+uint64_t logger::dropped() const
+{
+  return dropped_messages.load(std::memory_order_relaxed);
+}
+
+void logger::run()
+{
+  for (;;)
+  {
+    size_t written;
+    {
+      std::lock_guard<std::mutex> lock(consumer_mutex);
+      written = drain(stderr);
+    }
+    if (written == 0)
+    {
+      // Producers only signal errors; everything else is picked up within the poll interval.
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      wake.wait_for(lock, std::chrono::milliseconds(50));
+    }
+  }
+}
+
+size_t logger::drain(std::FILE* out)
+{
+  static const char LEVEL_TAGS[] = { '-', 'E', 'W', 'I', 'D' };
+
+  size_t written = 0;
+  for (;;)
+  {
+    entry& e = entries[dequeue_pos & (QUEUE_ENTRIES - 1)];
+    if (e.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+    {
+      break;
+    }
+
+    time_t seconds = static_cast<time_t>(e.time_ns / 1000000000LL);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    const char* file = std::strrchr(e.file, '/');
+    std::fprintf(out, "%02d:%02d:%02d.%03d %c %s:%d %.*s", local.tm_hour, local.tm_min, local.tm_sec,
+                 static_cast<int>(e.time_ns / 1000000 % 1000), LEVEL_TAGS[e.level], file ? file + 1 : e.file, e.line,
+                 static_cast<int>(e.length), e.text);
+    if (e.truncated)
+    {
+      std::fputs("...", out);
+    }
+    if (e.suppressed > 0)
+    {
+      std::fprintf(out, " (%llu similar messages suppressed)", static_cast<unsigned long long>(e.suppressed));
+    }
+    std::fputc('\n', out);
+
+    e.sequence.store(dequeue_pos + QUEUE_ENTRIES, std::memory_order_release);
+    ++dequeue_pos;
+    ++written;
+  }
+
+  uint64_t drops = dropped_messages.load(std::memory_order_relaxed);
+  if (drops != reported_drops)
+  {
+    std::fprintf(out, "%llu log messages dropped, the log queue was full\n",
+                 static_cast<unsigned long long>(drops - reported_drops));
+    reported_drops = drops;
+  }
+  if (written > 0)
+  {
+    std::fflush(out);
+  }
+  return written;
+}
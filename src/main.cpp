@@ -1,11 +1,65 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
+
+#include "logger.h"
+#include "trace.h"
 
 int main(int argc, char* argv[])
 {
   QApplication a(argc, argv);
+  TRACE_THREAD_NAME("gui");
+
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  QCommandLineOption http("http", "Serve the MJPEG stream over HTTP (binds 127.0.0.1 unless ADDR is given).",
+                          "[ADDR:]PORT");
+  parser.addOption(http);
+  QCommandLineOption shm("shm", "Publish frames to the shared memory ring NAME for other local processes.", "NAME");
+  parser.addOption(shm);
+  QCommandLineOption trace("trace", "Write a Chrome trace of the capture pipeline to FILE on exit and on F12.", "FILE");
+  parser.addOption(trace);
+  QCommandLineOption log_level("log-level", "off, error, warning, info or debug (default info, or $V4L2_LOG_LEVEL).",
+                               "LEVEL");
+  parser.addOption(log_level);
+  parser.process(a);
+
+  if (parser.isSet(log_level))
+  {
+    logLevel level;
+    if (!logger::parse_level(parser.value(log_level).toStdString(), level))
+    {
+      std::cerr << "Invalid log level: " << parser.value(log_level).toStdString() << std::endl;
+      return 2;
+    }
+    logger::set_level(level);
+  }
+
   MainWindow w;
+  if (parser.isSet(http))
+  {
+    std::string address;
+    uint16_t port;
+    if (!mjpeg_server::parse_endpoint(parser.value(http).toStdString(), address, port) || !w.serve_http(address, port))
+    {
+      std::cerr << "Cannot serve HTTP on " << parser.value(http).toStdString() << std::endl;
+      return 2;
+    }
+  }
+  if (parser.isSet(shm))
+  {
+    w.publish_shm(parser.value(shm).toStdString());
+  }
+  if (parser.isSet(trace))
+  {
+#ifdef ENABLE_TRACING
+    w.set_trace_file(parser.value(trace));
+#else
+    std::cerr << "Built without tracing (ENABLE_TRACING=OFF)" << std::endl;
+    return 2;
+#endif
+  }
   w.setFixedSize(990, 580);
   w.show();
   return a.exec();
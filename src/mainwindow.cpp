@@ -1,71 +1,295 @@
 #include "./ui_mainwindow.h"
 #include "mainwindow.h"
 
+#include <QDateTime>
+#include <QDir>
+#include <QFileDialog>
+#include <QShortcut>
+#include <QSignalBlocker>
+#include <QStandardPaths>
+#include <opencv2/imgproc.hpp>
+
+#include "trace.h"
+
 MainWindow::MainWindow(QWidget* parent)
-  : QMainWindow(parent), ui(new Ui::MainWindow), m_camera(new usb_cam), m_joystick(new Joystick("/dev/input/js0"))
+  : QMainWindow(parent)
+  , ui(new Ui::MainWindow)
+  , m_camera(new usb_cam)
+  , m_registry(new device_registry)
+  , m_controls(new control_writer(m_camera))
+  , m_recorder(new recorder)
+  , m_pretrigger(new pretrigger_buffer)
+  , m_joystick(new Joystick("/dev/input/js0"))
+  , m_ptz(new ptz_controller(m_camera, m_joystick))
+  , m_http(new mjpeg_server)
+  , m_shm(new shm_publisher)
+  , frame_pending(false)
+  , http_publish(false)
+  , shm_publish(false)
+  , stream_on(false)
 {
   ui->setupUi(this);
   QIcon icon(":/image/images/icon.png");
   setWindowIcon(icon);
 
-  devices = m_camera->find_device();
-  for (const auto& item : devices)
+  // Cameras can come and go while the app runs; the registry reports them from its own thread.
+  m_registry->set_callback([this](deviceEvent event, const deviceData& device) {
+    QMetaObject::invokeMethod(this, "handle_hotplug", Qt::QueuedConnection, Q_ARG(int, static_cast<int>(event)),
+                              Q_ARG(QString, QString::fromStdString(device.path)));
+  });
+  m_registry->start();
+  populate_devices();
+
+  // The joystick thread also waits for a joystick to be plugged in, so it runs even when none is connected yet.
+  m_joystick->setButtonCallback([this](int button, bool pressed) {
+    if (button == INCIDENT_BUTTON && pressed)
+    {
+      QMetaObject::invokeMethod(this, "trigger_incident", Qt::QueuedConnection);
+    }
+  });
+  m_joystick->startEventThread();
+
+  // Joystick axes drive pan, tilt and zoom; the buttons after the incident button recall PTZ presets.
+  m_ptz->set_preset_buttons(FIRST_PRESET_BUTTON);
+  m_ptz->set_value_callback([this](uint32_t id, int32_t value) {
+    QMetaObject::invokeMethod(this, "handle_control_value", Qt::QueuedConnection, Q_ARG(int, static_cast<int>(id)),
+                              Q_ARG(int, static_cast<int>(value)));
+  });
+
+  // New frames are announced from the capture thread. Only one update is queued at a time, so a slow GUI coalesces
+  // bursts to the latest frame instead of piling up events.
+  m_camera->set_frame_callback([this]() {
+    if (!frame_pending.exchange(true))
+    {
+      QMetaObject::invokeMethod(this, "update_frame", Qt::QueuedConnection);
+    }
+  });
+
+  // setFrame() only schedules a repaint, so delivered fps and latency are measured when the frame is painted.
+  connect(ui->img, &VideoWidget::framePainted, this, [this]() { m_camera->mark_presented(shown_frame); });
+
+  // Recording, the pre-trigger ring, HTTP viewers and shared memory take the compressed buffers straight from the
+  // capture thread, before any decoding.
+  m_camera->set_raw_frame_callback([this](const rawFrame& raw) {
+    m_pretrigger->push(raw);
+    if (m_recorder->recording())
+    {
+      m_recorder->push(raw);
+    }
+    if (http_publish)
+    {
+      m_http->publish(raw.data, raw.bytesused, raw.timestamp_ns);
+    }
+    if (shm_publish)
+    {
+      m_shm->publish(raw);
+    }
+  });
+
+  // Control writes and reads complete on the writer thread; the values the device took come back here.
+  m_controls->set_value_callback([this](uint32_t id, int32_t value) {
+    QMetaObject::invokeMethod(this, "handle_control_value", Qt::QueuedConnection, Q_ARG(int, static_cast<int>(id)),
+                              Q_ARG(int, static_cast<int>(value)));
+  });
+
+  // Device events arrive on the capture thread; hand them over to the GUI thread.
+  m_camera->set_event_callback([this](const struct v4l2_event& ev) {
+    int value = ev.type == V4L2_EVENT_SOURCE_CHANGE ? static_cast<int>(ev.u.src_change.changes) : ev.u.ctrl.value;
+    QMetaObject::invokeMethod(this, "handle_device_event", Qt::QueuedConnection, Q_ARG(int, static_cast<int>(ev.type)),
+                              Q_ARG(int, static_cast<int>(ev.id)), Q_ARG(int, value));
+  });
+}
+
+MainWindow::~MainWindow()
+{
+  stop_controls();
+  m_joystick->stopEventThread();
+  m_registry->stop();
+  stop_stream();
+  m_recorder->stop();
+  m_http->stop();
+  delete m_registry;
+  delete m_controls;
+  delete m_recorder;
+  delete m_pretrigger;
+  delete m_ptz;
+  delete m_http;
+  delete m_shm;
+  delete m_camera;
+  delete m_joystick;
+  delete ui;
+}
+
+namespace
+{
+// File extension matching the container recorder picks for a pixel format.
+QString recording_suffix(uint32_t pixelformat)
+{
+  switch (pixelformat)
   {
-    ui->devices->addItem(QString::fromStdString(item.path + " - " + item.device_name));
+    case V4L2_PIX_FMT_MJPEG:
+      return ".avi";
+    case V4L2_PIX_FMT_H264:
+      return ".h264";
+    default:
+      return ".v4l2";
   }
-  device_info = m_camera->get_device_info(devices[0].path);
+}
+// Keeps the decoded cv::Mat alive for as long as a QImage refers to its pixels.
+void release_mat(void* mat)
+{
+  delete static_cast<cv::Mat*>(mat);
+}
+}  // namespace
 
-  ui->quality->clear();
-  for (const auto& resInfo : device_info.resolution_info)
+void MainWindow::update_frame()
+{
+  // Clear first so a frame published while we paint schedules another update.
+  frame_pending = false;
+
+  TRACE_SCOPE("present");
+  frameData frame;
+  if (m_camera->acquire_frame(frame) && !frame.image.empty())
   {
-    QString resolution = QString::number(resInfo.resolution.first) + "x" + QString::number(resInfo.resolution.second);
-    ui->quality->addItem(resolution);
+    const cv::Mat& image = frame.image;
+    QImage qimg;
+    if (image.type() == CV_8UC4)
+    {
+      // Converted uncompressed formats are already laid out as QImage::Format_RGB32.
+      qimg = QImage(image.data, image.cols, image.rows, image.step, QImage::Format_RGB32, release_mat,
+                    new cv::Mat(image));
+    }
+    else
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+      qimg = QImage(image.data, image.cols, image.rows, image.step, QImage::Format_BGR888, release_mat,
+                    new cv::Mat(image));
+#else
+      cv::Mat rgbFrame;
+      cv::cvtColor(image, rgbFrame, cv::COLOR_BGR2RGB);
+      qimg = QImage(rgbFrame.data, rgbFrame.cols, rgbFrame.rows, rgbFrame.step, QImage::Format_RGB888, release_mat,
+                    new cv::Mat(rgbFrame));
+#endif
+    }
+
+    update_hud();
+    // Presentation is recorded once the widget has actually drawn the image; only the timestamps are kept here.
+    shown_frame = frame;
+    shown_frame.image.release();
+    ui->img->setFrame(qimg);
   }
+}
 
-  ui->format->clear();
-  for (const auto& format : device_info.formats)
+void MainWindow::update_hud()
+{
+  if (!ui->hud->isChecked())
   {
-    ui->format->addItem(QString::fromStdString(format));
+    ui->img->setOverlayText(QString());
+    return;
   }
 
-  if (m_joystick->isConnected())
+  // Percentiles are recomputed a few times per second, not on every frame.
+  if (hud_text.isEmpty() || hud_timer.elapsed() > HUD_REFRESH_MS)
   {
-    m_joystick->startEventThread();
+    captureStats stats = m_camera->get_stats();
+    hud_text = QString("capture %1 fps  shown %2 fps  dropped %3\n"
+                       "decode p50/p90/p99 %4 / %5 / %6 ms\n"
+                       "latency p50/p90/p99 %7 / %8 / %9 ms")
+                   .arg(stats.capture_fps, 0, 'f', 1)
+                   .arg(stats.delivered_fps, 0, 'f', 1)
+                   .arg(stats.frames_dropped)
+                   .arg(stats.decode_ms_p50, 0, 'f', 1)
+                   .arg(stats.decode_ms_p90, 0, 'f', 1)
+                   .arg(stats.decode_ms_p99, 0, 'f', 1)
+                   .arg(stats.latency_ms_p50, 0, 'f', 1)
+                   .arg(stats.latency_ms_p90, 0, 'f', 1)
+                   .arg(stats.latency_ms_p99, 0, 'f', 1);
+    hud_timer.restart();
   }
+  ui->img->setOverlayText(hud_text);
 }
 
-MainWindow::~MainWindow()
+void MainWindow::on_fastScaling_stateChanged(int state)
 {
-  m_joystick->stopEventThread();
-  delete m_camera;
-  delete m_joystick;
-  delete ui;
+  ui->img->setFastScaling(state == Qt::Checked);
 }
 
-void MainWindow::update_frame()
+void MainWindow::handle_device_event(int type, int id, int value)
 {
-  if (!m_camera->m_image.empty())
+  if (!stream_on)
   {
-    cv::Mat rgbFrame;
-    cv::cvtColor(m_camera->m_image, rgbFrame, cv::COLOR_BGR2RGB);
+    return;
+  }
 
-    QImage qimg(rgbFrame.data, rgbFrame.cols, rgbFrame.rows, rgbFrame.step, QImage::Format_RGB888);
+  if (type == V4L2_EVENT_SOURCE_CHANGE)
+  {
+    if (value & V4L2_EVENT_SRC_CH_RESOLUTION)
+    {
+      // The capture loop has already stopped; renegotiate the format with the same settings. The recording is closed
+      // because its header describes the old resolution.
+      stop_recording();
+      stop_controls();
+      stop_stream();
+      start_stream(stream_config);
+      start_controls();
+    }
+  }
+  else if (type == V4L2_EVENT_CTRL)
+  {
+    handle_control_value(id, value);
+  }
+}
 
-    ui->img->setPixmap(QPixmap::fromImage(qimg).scaled(ui->img->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
+void MainWindow::handle_hotplug(int event, const QString& path)
+{
+  // Losing the camera we stream from ends the stream the same way the STOP button does.
+  if (event == DEVICE_REMOVED && stream_on && stream_config.path == path.toStdString())
+  {
+    on_stream_clicked();
   }
+  populate_devices();
 }
 
-void MainWindow::on_devices_currentIndexChanged(int index)
+void MainWindow::populate_devices()
 {
-  device_info = m_camera->get_device_info(devices[index].path);
+  int current = ui->devices->currentIndex();
+  std::string selected = current >= 0 && current < static_cast<int>(devices.size()) ? devices[current].path : "";
 
-  ui->quality->clear();
-  for (const auto& resInfo : device_info.resolution_info)
+  devices = m_registry->devices();
+  int index = devices.empty() ? -1 : 0;
+  {
+    // Rebuilding the list must not reload the device info unless the selection actually changes.
+    const QSignalBlocker blocker(ui->devices);
+    ui->devices->clear();
+    for (size_t i = 0; i < devices.size(); ++i)
+    {
+      ui->devices->addItem(QString::fromStdString(devices[i].path + " - " + devices[i].device_name));
+      if (devices[i].path == selected)
+      {
+        index = static_cast<int>(i);
+      }
+    }
+    ui->devices->setCurrentIndex(index);
+  }
+
+  if (index < 0 || devices[index].path != selected)
   {
-    QString resolution = QString::number(resInfo.resolution.first) + "x" + QString::number(resInfo.resolution.second);
-    ui->quality->addItem(resolution);
+    on_devices_currentIndexChanged(index);
   }
+}
 
+void MainWindow::on_devices_currentIndexChanged(int index)
+{
+  if (index < 0 || index >= static_cast<int>(devices.size()))
+  {
+    device_info = m_deviceInfo();
+  }
+  else
+  {
+    device_info = m_camera->get_device_info(devices[index].path);
+  }
+
+  // Refilling the formats cascades into the sizes and frame rates of the first format.
   ui->format->clear();
   for (const auto& format : device_info.formats)
   {
@@ -73,32 +297,50 @@ void MainWindow::on_devices_currentIndexChanged(int index)
   }
 }
 
+void MainWindow::on_format_currentIndexChanged(int index)
+{
+  frame_sizes.clear();
+  if (index >= 0 && index < static_cast<int>(device_info.format_info.size()))
+  {
+    frame_sizes = device_info.format_info[index].candidate_sizes();
+  }
+
+  ui->quality->clear();
+  for (const auto& size : frame_sizes)
+  {
+    ui->quality->addItem(QString::number(size.first) + "x" + QString::number(size.second));
+  }
+}
+
 void MainWindow::on_quality_currentIndexChanged(int index)
 {
-  ui->fps->clear();
+  // Frame intervals are only probed for the size actually selected, and cached once seen.
+  frame_rates.clear();
+  int deviceIndex = ui->devices->currentIndex();
+  int formatIndex = ui->format->currentIndex();
+  if (index >= 0 && index < static_cast<int>(frame_sizes.size()) && deviceIndex >= 0 &&
+      deviceIndex < static_cast<int>(devices.size()) && formatIndex >= 0 &&
+      formatIndex < static_cast<int>(device_info.format_info.size()))
+  {
+    frame_rates = m_camera->get_frame_rates(devices[deviceIndex].path, device_info.format_info[formatIndex].fourcc,
+                                            frame_sizes[index].first, frame_sizes[index].second);
+  }
 
-  if (index >= 0 && index < device_info.resolution_info.size())
+  ui->fps->clear();
+  for (const auto& fps : frame_rates)
   {
-    const auto& selectedResolutionInfo = device_info.resolution_info[index];
-    for (const auto& fps : selectedResolutionInfo.fps)
-    {
-      ui->fps->addItem(QString::number(fps) + " fps");
-    }
+    ui->fps->addItem(QString::number(fps) + " fps");
   }
 }
 
 void MainWindow::on_stream_clicked()
 {
-  if (m_camera->streaming)
+  if (stream_on)
   {
-    if (streamTimer)
-    {
-      streamTimer->stop();
-      delete streamTimer;
-      streamTimer = nullptr;
-    }
-
-    m_camera->stop_stream();
+    stream_on = false;
+    stop_controls();
+    stop_stream();
+    stop_recording();
     ui->img->clear();
     ui->stream->setStyleSheet("color: red;");
     ui->stream->setText("STREAM");
@@ -111,67 +353,184 @@ void MainWindow::on_stream_clicked()
     int fpsIndex = ui->fps->currentIndex();
     int formatIndex = ui->format->currentIndex();
 
-    if (deviceIndex < 0 || qualityIndex < 0 || fpsIndex < 0 || formatIndex < 0)
+    if (deviceIndex < 0 || deviceIndex >= static_cast<int>(devices.size()) || qualityIndex < 0 || fpsIndex < 0 ||
+        formatIndex < 0)
     {
-      std::cerr << "Invalid selection" << std::endl;
+      CERR_ENDL("Invalid selection");
       return;
     }
 
     m_deviceConfig config;
     config.path = devices[deviceIndex].path;
     config.device_name = devices[deviceIndex].device_name;
-    config.resolution = device_info.resolution_info[qualityIndex].resolution;
-    config.fps = device_info.resolution_info[qualityIndex].fps[fpsIndex];
-    config.format = ui->format->itemText(formatIndex).toStdString();
-
-    m_camera->start_stream(config);
-    read_device_value();
-
-    streamTimer = new QTimer(this);
-    connect(streamTimer, &QTimer::timeout, this, &MainWindow::update_frame);
-    streamTimer->start(10);
+    config.resolution = frame_sizes[qualityIndex];
+    config.fps = frame_rates[fpsIndex];
+    config.format = device_info.format_info[formatIndex].description;
+    config.fourcc = device_info.format_info[formatIndex].fourcc;
+
+    stream_config = config;
+    // The preview only needs frames as large as the video area, so let the decoder downscale for free.
+    m_camera->set_target_size(ui->img->contentsRect().width(), ui->img->contentsRect().height());
+    start_stream(config);
+    start_controls();
+
+    stream_on = true;
     ui->stream->setStyleSheet("color: green;");
     ui->stream->setText("STOP");
     ui->devices->setEnabled(false);
   }
 }
 
+bool MainWindow::serve_http(const std::string& address, uint16_t port)
+{
+  return m_http->start(address, port);
+}
+
+void MainWindow::set_trace_file(const QString& path)
+{
+  tracer::instance().dump_at_exit(path.toStdString());
+  QShortcut* dump = new QShortcut(QKeySequence(Qt::Key_F12), this);
+  connect(dump, &QShortcut::activated, this, [path]() { tracer::instance().dump(path.toStdString()); });
+}
+
+void MainWindow::publish_shm(const std::string& name)
+{
+  shm_name = name;
+}
+
+void MainWindow::start_stream(const m_deviceConfig& config)
+{
+  m_camera->start_stream(config);
+  if (m_camera->streaming)
+  {
+    // Frames are already flowing, which is fine: stop_stream() disarmed the ring, so push() drops them until armed.
+    m_pretrigger->arm(m_camera->get_format(), config.fps, PRETRIGGER_SECONDS, PRETRIGGER_BYTES);
+    http_publish = m_http->running() && m_camera->get_format().pixelformat == V4L2_PIX_FMT_MJPEG;
+    // Each stream gets a fresh ring sized for its format; readers see the old one go stale and reopen.
+    shm_publish = !shm_name.empty() && m_shm->open(shm_name, m_camera->get_format());
+  }
+}
+
+void MainWindow::stop_stream()
+{
+  m_camera->stop_stream();
+  http_publish = false;
+  shm_publish = false;
+  m_shm->close();
+  m_pretrigger->disarm();
+}
+
+void MainWindow::on_saveIncident_clicked()
+{
+  trigger_incident();
+}
+
+void MainWindow::trigger_incident()
+{
+  if (!m_pretrigger->armed())
+  {
+    return;
+  }
+
+  QString dir = QStandardPaths::writableLocation(QStandardPaths::MoviesLocation);
+  QDir().mkpath(dir);
+  QString path = dir + "/incident-" + QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") +
+                 recording_suffix(m_camera->get_format().pixelformat);
+  if (m_pretrigger->trigger(path.toStdString(), POST_TRIGGER_SECONDS))
+  {
+    COUT_ENDL("Saving incident to " << path.toStdString());
+  }
+}
+
+void MainWindow::on_record_clicked()
+{
+  if (m_recorder->recording())
+  {
+    stop_recording();
+    return;
+  }
+  if (!m_camera->streaming)
+  {
+    return;
+  }
+
+  struct v4l2_pix_format format = m_camera->get_format();
+  QString suffix = recording_suffix(format.pixelformat);
+  QString path = QFileDialog::getSaveFileName(this, "Record to", QString(), "*" + suffix);
+  if (path.isEmpty() || !m_recorder->start(path.toStdString(), format, stream_config.fps))
+  {
+    return;
+  }
+  ui->record->setStyleSheet("color: red;");
+  ui->record->setText("STOP REC");
+}
+
+void MainWindow::stop_recording()
+{
+  if (!m_recorder->recording())
+  {
+    return;
+  }
+  m_recorder->stop();
+  recorderStats stats = m_recorder->get_stats();
+  COUT_ENDL("Recorded " << stats.frames_written << " frames (" << stats.bytes_written << " bytes), dropped "
+                        << stats.frames_dropped);
+  ui->record->setStyleSheet("");
+  ui->record->setText("REC");
+}
+
+void MainWindow::start_controls()
+{
+  if (m_camera->streaming)
+  {
+    m_controls->start();
+    m_ptz->start();
+    read_device_value();
+  }
+}
+
+void MainWindow::stop_controls()
+{
+  m_ptz->stop();
+  m_controls->stop();
+}
+
 void MainWindow::on_reset_clicked()
 {
   if (m_camera->streaming)
   {
-    m_camera->reset_controls_to_default();
+    m_controls->reset_to_default();
     read_device_value();
   }
 }
 
 void MainWindow::on_brightnessSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_BRIGHTNESS, value);
+  m_controls->set(V4L2_CID_BRIGHTNESS, value);
   ui->brightness->setText(QString::number(value));
 }
 
 void MainWindow::on_contrastSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_CONTRAST, value);
+  m_controls->set(V4L2_CID_CONTRAST, value);
   ui->contrast->setText(QString::number(value));
 }
 
 void MainWindow::on_saturationSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_SATURATION, value);
+  m_controls->set(V4L2_CID_SATURATION, value);
   ui->saturation->setText(QString::number(value));
 }
 
 void MainWindow::on_hueSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_HUE, value);
+  m_controls->set(V4L2_CID_HUE, value);
   ui->hue->setText(QString::number(value));
 }
 
 void MainWindow::on_whiteBalanceSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_WHITE_BALANCE_TEMPERATURE, value);
+  m_controls->set(V4L2_CID_WHITE_BALANCE_TEMPERATURE, value);
   ui->whiteBalance->setText(QString::number(value));
 }
 
@@ -179,35 +538,34 @@ void MainWindow::on_whiteBalanceAuto_stateChanged(int state)
 {
   if (state == Qt::Checked)
   {
-    m_camera->set_control(V4L2_CID_AUTO_WHITE_BALANCE, 1);
+    m_controls->set(V4L2_CID_AUTO_WHITE_BALANCE, 1);
     ui->whiteBalanceSlider->setDisabled(true);
   }
   else
   {
-    m_camera->set_control(V4L2_CID_AUTO_WHITE_BALANCE, 0);
+    m_controls->set(V4L2_CID_AUTO_WHITE_BALANCE, 0);
     ui->whiteBalanceSlider->setEnabled(true);
 
-    int wb_temp = m_camera->get_control(V4L2_CID_WHITE_BALANCE_TEMPERATURE);
-    ui->whiteBalanceSlider->setValue(wb_temp);
-    ui->whiteBalance->setText(QString::number(wb_temp));
+    // The manual value arrives through handle_control_value() once the device has switched.
+    m_controls->read(std::vector<uint32_t>(1, V4L2_CID_WHITE_BALANCE_TEMPERATURE));
   }
 }
 
 void MainWindow::on_gammaSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_GAMMA, value);
+  m_controls->set(V4L2_CID_GAMMA, value);
   ui->gamma->setText(QString::number(value));
 }
 
 void MainWindow::on_sharpnessSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_SHARPNESS, value);
+  m_controls->set(V4L2_CID_SHARPNESS, value);
   ui->sharpness->setText(QString::number(value));
 }
 
 void MainWindow::on_exposureSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_EXPOSURE, value);
+  m_controls->set(V4L2_CID_EXPOSURE, value);
   ui->exposure->setText(QString::number(value));
 }
 
@@ -215,59 +573,58 @@ void MainWindow::on_exposureAuto_stateChanged(int state)
 {
   if (state == Qt::Checked)
   {
-    m_camera->set_control(V4L2_CID_EXPOSURE_AUTO, 1);
+    m_controls->set(V4L2_CID_EXPOSURE_AUTO, 1);
     ui->exposureSlider->setDisabled(true);
   }
   else
   {
-    m_camera->set_control(V4L2_CID_EXPOSURE_AUTO, 0);
+    m_controls->set(V4L2_CID_EXPOSURE_AUTO, 0);
     ui->exposureSlider->setEnabled(true);
 
-    int exposure = m_camera->get_control(V4L2_CID_EXPOSURE);
-    ui->exposureSlider->setValue(exposure);
-    ui->exposure->setText(QString::number(exposure));
+    // The manual value arrives through handle_control_value() once the device has switched.
+    m_controls->read(std::vector<uint32_t>(1, V4L2_CID_EXPOSURE_ABSOLUTE));
   }
 }
 
 void MainWindow::on_gainSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_GAIN, value);
+  m_controls->set(V4L2_CID_GAIN, value);
   ui->gain->setText(QString::number(value));
 }
 
 void MainWindow::on_panSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_PAN_ABSOLUTE, value);
+  m_controls->set(V4L2_CID_PAN_ABSOLUTE, value);
   ui->pan->setText(QString::number(value));
 }
 
 void MainWindow::on_tiltSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_TILT_ABSOLUTE, value);
+  m_controls->set(V4L2_CID_TILT_ABSOLUTE, value);
   ui->tilt->setText(QString::number(value));
 }
 
 void MainWindow::on_backlightSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_BACKLIGHT_COMPENSATION, value);
+  m_controls->set(V4L2_CID_BACKLIGHT_COMPENSATION, value);
   ui->backlight->setText(QString::number(value));
 }
 
 void MainWindow::on_powerLineSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_POWER_LINE_FREQUENCY, value);
+  m_controls->set(V4L2_CID_POWER_LINE_FREQUENCY, value);
   ui->powerLine->setText(QString::number(value));
 }
 
 void MainWindow::on_zoomSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_ZOOM_ABSOLUTE, value);
+  m_controls->set(V4L2_CID_ZOOM_ABSOLUTE, value);
   ui->zoom->setText(QString::number(value));
 }
 
 void MainWindow::on_focusSlider_valueChanged(int value)
 {
-  m_camera->set_control(V4L2_CID_FOCUS_ABSOLUTE, value);
+  m_controls->set(V4L2_CID_FOCUS_ABSOLUTE, value);
   ui->focus->setText(QString::number(value));
 }
 
@@ -275,17 +632,16 @@ void MainWindow::on_focusAuto_stateChanged(int state)
 {
   if (state == Qt::Checked)
   {
-    m_camera->set_control(V4L2_CID_FOCUS_AUTO, 1);
+    m_controls->set(V4L2_CID_FOCUS_AUTO, 1);
     ui->focusSlider->setDisabled(true);
   }
   else
   {
-    m_camera->set_control(V4L2_CID_FOCUS_AUTO, 0);
+    m_controls->set(V4L2_CID_FOCUS_AUTO, 0);
     ui->focusSlider->setEnabled(true);
 
-    int focus = m_camera->get_control(V4L2_CID_FOCUS_AUTO);
-    ui->focusSlider->setValue(focus);
-    ui->focus->setText(QString::number(focus));
+    // The manual value arrives through handle_control_value() once the device has switched.
+    m_controls->read(std::vector<uint32_t>(1, V4L2_CID_FOCUS_ABSOLUTE));
   }
 }
 
@@ -293,75 +649,187 @@ void MainWindow::read_device_value()
 {
   if (m_camera->streaming)
   {
+    // Ranges come from the control table; the values are read on the writer thread and arrive through
+    // handle_control_value().
     set_qslider_from_query(ui->brightnessSlider, ui->brightness, V4L2_CID_BRIGHTNESS);
     set_qslider_from_query(ui->contrastSlider, ui->contrast, V4L2_CID_CONTRAST);
     set_qslider_from_query(ui->saturationSlider, ui->saturation, V4L2_CID_SATURATION);
     set_qslider_from_query(ui->hueSlider, ui->hue, V4L2_CID_HUE);
-    set_qslider_from_query(ui->whiteBalanceSlider, ui->whiteBalance, ui->whiteBalanceAuto, V4L2_CID_AUTO_WHITE_BALANCE,
-                           V4L2_CID_WHITE_BALANCE_TEMPERATURE);
+    set_qslider_from_query(ui->whiteBalanceSlider, ui->whiteBalance, V4L2_CID_WHITE_BALANCE_TEMPERATURE);
     set_qslider_from_query(ui->gammaSlider, ui->gamma, V4L2_CID_GAMMA);
     set_qslider_from_query(ui->sharpnessSlider, ui->sharpness, V4L2_CID_SHARPNESS);
-    set_qslider_from_query(ui->exposureSlider, ui->exposure, ui->exposureAuto, V4L2_CID_EXPOSURE_AUTO,
-                           V4L2_CID_EXPOSURE_ABSOLUTE);
+    set_qslider_from_query(ui->exposureSlider, ui->exposure, V4L2_CID_EXPOSURE_ABSOLUTE);
     set_qslider_from_query(ui->gainSlider, ui->gain, V4L2_CID_GAIN);
     set_qslider_from_query(ui->panSlider, ui->pan, V4L2_CID_PAN_ABSOLUTE);
     set_qslider_from_query(ui->tiltSlider, ui->tilt, V4L2_CID_TILT_ABSOLUTE);
     set_qslider_from_query(ui->backlightSlider, ui->backlight, V4L2_CID_BACKLIGHT_COMPENSATION);
     set_qslider_from_query(ui->powerLineSlider, ui->powerLine, V4L2_CID_POWER_LINE_FREQUENCY);
     set_qslider_from_query(ui->zoomSlider, ui->zoom, V4L2_CID_ZOOM_ABSOLUTE);
-    set_qslider_from_query(ui->focusSlider, ui->focus, ui->focusAuto, V4L2_CID_FOCUS_AUTO, V4L2_CID_FOCUS_ABSOLUTE);
+    set_qslider_from_query(ui->focusSlider, ui->focus, V4L2_CID_FOCUS_ABSOLUTE);
+
+    // Auto modes first, so the sliders they lock are already disabled when the manual values arrive.
+    static const uint32_t ids[] = { V4L2_CID_AUTO_WHITE_BALANCE,
+                                    V4L2_CID_EXPOSURE_AUTO,
+                                    V4L2_CID_FOCUS_AUTO,
+                                    V4L2_CID_BRIGHTNESS,
+                                    V4L2_CID_CONTRAST,
+                                    V4L2_CID_SATURATION,
+                                    V4L2_CID_HUE,
+                                    V4L2_CID_WHITE_BALANCE_TEMPERATURE,
+                                    V4L2_CID_GAMMA,
+                                    V4L2_CID_SHARPNESS,
+                                    V4L2_CID_EXPOSURE_ABSOLUTE,
+                                    V4L2_CID_GAIN,
+                                    V4L2_CID_PAN_ABSOLUTE,
+                                    V4L2_CID_TILT_ABSOLUTE,
+                                    V4L2_CID_BACKLIGHT_COMPENSATION,
+                                    V4L2_CID_POWER_LINE_FREQUENCY,
+                                    V4L2_CID_ZOOM_ABSOLUTE,
+                                    V4L2_CID_FOCUS_ABSOLUTE };
+    m_controls->read(std::vector<uint32_t>(ids, ids + sizeof(ids) / sizeof(ids[0])));
   }
 }
 
-void MainWindow::set_qslider_from_query(QSlider* slider, QLabel* label, int control_id)
+void MainWindow::handle_control_value(int control_id, int value)
 {
-  v4l2_queryctrl queryctrl;
-  int value;
+  QCheckBox* check = nullptr;
+  QSlider* slider = nullptr;
+  QLabel* label = nullptr;
 
-  if (m_camera->query_control(control_id, queryctrl))
+  switch (control_id)
   {
-    slider->setEnabled(true);
-    value = m_camera->get_control(control_id);
-    slider->setRange(queryctrl.minimum, queryctrl.maximum);
-    slider->setValue(value);
-    label->setText(QString::number(value));
+    case V4L2_CID_AUTO_WHITE_BALANCE:
+      check = ui->whiteBalanceAuto;
+      slider = ui->whiteBalanceSlider;
+      label = ui->whiteBalance;
+      break;
+    case V4L2_CID_EXPOSURE_AUTO:
+      check = ui->exposureAuto;
+      slider = ui->exposureSlider;
+      label = ui->exposure;
+      break;
+    case V4L2_CID_FOCUS_AUTO:
+      check = ui->focusAuto;
+      slider = ui->focusSlider;
+      label = ui->focus;
+      break;
+    default:
+      sync_control(control_id, value);
+      return;
   }
-  else
+
+  const QSignalBlocker blocker(check);
+  check->setChecked(value == 1);
+  if (value == 1)
   {
     slider->setDisabled(true);
-    label->setText("NA");
+    label->setText("AUTO");
+  }
+  else if (!slider->isEnabled() && label->text() == "AUTO")
+  {
+    slider->setEnabled(true);
   }
 }
 
-void MainWindow::set_qslider_from_query(QSlider* slider, QLabel* label, QCheckBox* check, int control_id_auto,
-                                        int control_id)
+void MainWindow::sync_control(int control_id, int value)
+{
+  QSlider* slider = nullptr;
+  QLabel* label = nullptr;
+
+  switch (control_id)
+  {
+    case V4L2_CID_BRIGHTNESS:
+      slider = ui->brightnessSlider;
+      label = ui->brightness;
+      break;
+    case V4L2_CID_CONTRAST:
+      slider = ui->contrastSlider;
+      label = ui->contrast;
+      break;
+    case V4L2_CID_SATURATION:
+      slider = ui->saturationSlider;
+      label = ui->saturation;
+      break;
+    case V4L2_CID_HUE:
+      slider = ui->hueSlider;
+      label = ui->hue;
+      break;
+    case V4L2_CID_WHITE_BALANCE_TEMPERATURE:
+      slider = ui->whiteBalanceSlider;
+      label = ui->whiteBalance;
+      break;
+    case V4L2_CID_GAMMA:
+      slider = ui->gammaSlider;
+      label = ui->gamma;
+      break;
+    case V4L2_CID_SHARPNESS:
+      slider = ui->sharpnessSlider;
+      label = ui->sharpness;
+      break;
+    case V4L2_CID_EXPOSURE:
+    case V4L2_CID_EXPOSURE_ABSOLUTE:
+      slider = ui->exposureSlider;
+      label = ui->exposure;
+      break;
+    case V4L2_CID_GAIN:
+      slider = ui->gainSlider;
+      label = ui->gain;
+      break;
+    case V4L2_CID_PAN_ABSOLUTE:
+      slider = ui->panSlider;
+      label = ui->pan;
+      break;
+    case V4L2_CID_TILT_ABSOLUTE:
+      slider = ui->tiltSlider;
+      label = ui->tilt;
+      break;
+    case V4L2_CID_BACKLIGHT_COMPENSATION:
+      slider = ui->backlightSlider;
+      label = ui->backlight;
+      break;
+    case V4L2_CID_POWER_LINE_FREQUENCY:
+      slider = ui->powerLineSlider;
+      label = ui->powerLine;
+      break;
+    case V4L2_CID_ZOOM_ABSOLUTE:
+      slider = ui->zoomSlider;
+      label = ui->zoom;
+      break;
+    case V4L2_CID_FOCUS_ABSOLUTE:
+      slider = ui->focusSlider;
+      label = ui->focus;
+      break;
+    default:
+      return;
+  }
+
+  // Sliders under automatic control show "AUTO" and must not be touched, and a slider being dragged is ahead of the
+  // device anyway.
+  if (!slider->isEnabled() || slider->isSliderDown())
+  {
+    return;
+  }
+
+  // The device already has this value, so don't let valueChanged write it back.
+  const QSignalBlocker blocker(slider);
+  slider->setValue(value);
+  label->setText(QString::number(value));
+}
+
+void MainWindow::set_qslider_from_query(QSlider* slider, QLabel* label, int control_id)
 {
   v4l2_queryctrl queryctrl;
-  int auto_value = m_camera->get_control(control_id_auto);
-  int value;
 
-  if (auto_value == 1)
+  // Only the range changes here; don't let valueChanged write anything to the device.
+  const QSignalBlocker blocker(slider);
+  if (m_camera->query_control(control_id, queryctrl))
   {
-    check->setChecked(true);
-    slider->setDisabled(true);
-    label->setText("AUTO");
+    slider->setEnabled(true);
+    slider->setRange(queryctrl.minimum, queryctrl.maximum);
   }
   else
   {
-    check->setChecked(false);
-    m_camera->query_control(control_id, queryctrl);
-    if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
-    {
-      slider->setDisabled(true);
-      label->setText("NA");
-    }
-    else
-    {
-      slider->setEnabled(true);
-      value = m_camera->get_control(control_id);
-      slider->setRange(queryctrl.minimum, queryctrl.maximum);
-      slider->setValue(value);
-      label->setText(QString::number(value));
-    }
+    slider->setDisabled(true);
+    label->setText("NA");
   }
 }
@@ -0,0 +1,101 @@
+#include "mjpeg_decoder.h"
+
+#include <algorithm>
+#include <opencv2/imgcodecs.hpp>
+#include "frame_pool.h"
+#include "debug.h"
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+mjpeg_decoder::mjpeg_decoder() : handle(nullptr)
+{
+#ifdef HAVE_TURBOJPEG
+  handle = tjInitDecompress();
+  if (handle == nullptr)
+  {
+    CERR_ENDL("Failed to create TurboJPEG decompressor: " << tjGetErrorStr());
+  }
+
+  // Only the power-of-two reductions are done in the DCT domain with SIMD; the other n/8 factors are slower.
+  int count = 0;
+  tjscalingfactor* all = tjGetScalingFactors(&count);
+  for (int i = 0; all != nullptr && i < count; ++i)
+  {
+    if (all[i].num == 1 && (all[i].denom == 1 || all[i].denom == 2 || all[i].denom == 4 || all[i].denom == 8))
+    {
+      factors.push_back(std::make_pair(all[i].num, all[i].denom));
+    }
+  }
+#endif
+}
+
+mjpeg_decoder::~mjpeg_decoder()
+{
+#ifdef HAVE_TURBOJPEG
+  if (handle != nullptr)
+  {
+    tjDestroy(handle);
+  }
+#endif
+}
+
+bool mjpeg_decoder::decode(const uint8_t* data, size_t size, int target_width, int target_height, cv::Mat& out)
+{
+#ifdef HAVE_TURBOJPEG
+  if (handle != nullptr)
+  {
+    int width, height, subsamp, colorspace;
+    if (tjDecompressHeader3(handle, data, size, &width, &height, &subsamp, &colorspace) != 0)
+    {
+      CERR_ENDL("Failed to read JPEG header: " << tjGetErrorStr2(handle));
+      return false;
+    }
+
+    // Size of the image once letterboxed into the target box.
+    int fit_width = width;
+    int fit_height = height;
+    if (target_width > 0 && target_height > 0)
+    {
+      double scale = std::min(static_cast<double>(target_width) / width, static_cast<double>(target_height) / height);
+      fit_width = std::min(width, static_cast<int>(width * scale + 0.5));
+      fit_height = std::min(height, static_cast<int>(height * scale + 0.5));
+    }
+
+    int scaled_width = width;
+    int scaled_height = height;
+    for (const auto& f : factors)
+    {
+      tjscalingfactor factor = { f.first, f.second };
+      int w = TJSCALED(width, factor);
+      int h = TJSCALED(height, factor);
+      if (w >= fit_width && h >= fit_height && w * h < scaled_width * scaled_height)
+      {
+        scaled_width = w;
+        scaled_height = h;
+      }
+    }
+
+    cv::Mat buffer = frame_pool::image(scaled_height, scaled_width, CV_8UC4);
+    int flags = scaled_width < width ? TJFLAG_FASTDCT : 0;
+    if (tjDecompress2(handle, data, size, buffer.data, scaled_width, buffer.step, scaled_height, TJPF_BGRX, flags) != 0)
+    {
+      // Corrupt tails are common on USB MJPEG; keep the frame if TurboJPEG only warned.
+      if (tjGetErrorCode(handle) != TJERR_WARNING)
+      {
+        CERR_ENDL("Failed to decode JPEG: " << tjGetErrorStr2(handle));
+        return false;
+      }
+    }
+
+    out = buffer;
+    return true;
+  }
+#endif
+
+  (void)target_width;
+  (void)target_height;
+  out = cv::imdecode(cv::Mat(1, size, CV_8UC1, const_cast<uint8_t*>(data)), cv::IMREAD_COLOR);
+  return !out.empty();
+}
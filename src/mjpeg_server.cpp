@@ -0,0 +1,656 @@
+#include "mjpeg_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "frame_stats.h"
+#include "debug.h"
+
+namespace
+{
+const char BOUNDARY[] = "v4l2frame";
+const char TRAILER[] = "\r\n";
+
+const char STREAM_RESPONSE[] = "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: multipart/x-mixed-replace; boundary=v4l2frame\r\n"
+                               "Cache-Control: no-cache, no-store\r\n"
+                               "Pragma: no-cache\r\n"
+                               "Connection: close\r\n"
+                               "\r\n";
+const char NOT_FOUND_RESPONSE[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char BAD_REQUEST_RESPONSE[] = "HTTP/1.0 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char UNAVAILABLE_RESPONSE[] =
+    "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+}  // namespace
+
+struct mjpeg_server::frame
+{
+  std::atomic<int> refs;
+  std::vector<uint8_t> data;
+  size_t size;
+  uint64_t sequence;
+  char header[160];  // Multipart part header.
+  size_t header_size;
+
+  frame() : refs(0), size(0), sequence(0), header_size(0)
+  {
+  }
+};
+
+struct mjpeg_server::client
+{
+  int fd;
+  bool streaming;     // Multipart stream; otherwise a single response.
+  bool snapshot;      // Sends current without part header and trailer.
+  bool close_after;   // Close once the response and current frame are out.
+  bool writable;      // EPOLLOUT is enabled.
+  char request[2048];
+  size_t request_size;
+  std::string response;
+  size_t response_sent;
+  frame* current;
+  size_t sent;  // Bytes of current's part already sent.
+  uint64_t last_sequence;
+  int64_t last_progress_ns;
+
+  client()
+    : fd(-1)
+    , streaming(false)
+    , snapshot(false)
+    , close_after(false)
+    , writable(false)
+    , request_size(0)
+    , response_sent(0)
+    , current(nullptr)
+    , sent(0)
+    , last_sequence(0)
+    , last_progress_ns(0)
+  {
+  }
+};
+
+mjpeg_server::mjpeg_server()
+  : listen_fd(-1)
+  , epoll_fd(-1)
+  , wake_fd(-1)
+  , bound_port(0)
+  , max_clients(0)
+  , latest(nullptr)
+  , next_sequence(0)
+  , is_running(false)
+  , frames_published(0)
+  , frames_sent(0)
+  , frames_skipped(0)
+  , publish_dropped(0)
+  , client_count(0)
+{
+}
+
+mjpeg_server::~mjpeg_server()
+{
+  stop();
+}
+
+bool mjpeg_server::parse_endpoint(const std::string& text, std::string& address, uint16_t& port)
+{
+  size_t colon = text.rfind(':');
+  address = colon == std::string::npos ? "127.0.0.1" : text.substr(0, colon);
+  std::string port_text = colon == std::string::npos ? text : text.substr(colon + 1);
+  char* end = nullptr;
+  unsigned long value = std::strtoul(port_text.c_str(), &end, 10);
+  if (port_text.empty() || *end != '\0' || value > 65535)
+  {
+    return false;
+  }
+  port = static_cast<uint16_t>(value);
+  struct in_addr parsed;
+  return inet_pton(AF_INET, address.c_str(), &parsed) == 1;
+}
+
+bool mjpeg_server::start(const std::string& address, uint16_t port, size_t max_viewers)
+{
+  stop();
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+  {
+    CERR_ENDL("Invalid HTTP server address: " << address);
+    return false;
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  if (listen_fd == -1 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+      bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1 || listen(listen_fd, 128) == -1)
+  {
+    CERR_ENDL("Failed to listen on " << address << ":" << port << ": " << strerror(errno));
+    stop();
+    return false;
+  }
+
+  socklen_t length = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &length);
+  bound_port = ntohs(addr.sin_port);
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (epoll_fd == -1 || wake_fd == -1)
+  {
+    CERR_ENDL("Failed to set up HTTP server: " << strerror(errno));
+    stop();
+    return false;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  ev.data.ptr = &wake_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+  max_clients = max_viewers;
+  frames_published = 0;
+  frames_sent = 0;
+  frames_skipped = 0;
+  publish_dropped = 0;
+
+  is_running = true;
+  server_thread = std::thread(&mjpeg_server::run, this);
+  COUT_ENDL("Serving MJPEG on http://" << address << ":" << bound_port << "/");
+  return true;
+}
+
+void mjpeg_server::stop()
+{
+  if (is_running)
+  {
+    is_running = false;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) == -1)
+    {
+      CERR_ENDL("Failed to wake HTTP server: " << strerror(errno));
+    }
+    server_thread.join();
+  }
+
+  for (auto& c : clients)
+  {
+    close_client(c.get());
+  }
+  clients.clear();
+  client_count = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(latest_mutex);
+    if (latest != nullptr)
+    {
+      release(latest);
+      latest = nullptr;
+    }
+  }
+
+  int* fds[] = { &listen_fd, &epoll_fd, &wake_fd };
+  for (int* fd : fds)
+  {
+    if (*fd != -1)
+    {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+bool mjpeg_server::running() const
+{
+  return is_running;
+}
+
+uint16_t mjpeg_server::port() const
+{
+  return bound_port;
+}
+
+mjpegServerStats mjpeg_server::get_stats()
+{
+  mjpegServerStats stats;
+  stats.clients = client_count;
+  stats.frames_published = frames_published;
+  stats.frames_sent = frames_sent;
+  stats.frames_skipped = frames_skipped;
+  stats.publish_dropped = publish_dropped;
+  return stats;
+}
+
+void mjpeg_server::publish(const uint8_t* data, size_t size, int64_t timestamp_ns)
+{
+  if (!is_running)
+  {
+    return;
+  }
+
+  // An unreferenced frame is neither the latest nor being sent, so nothing else can reach it.
+  frame* f = nullptr;
+  for (auto& candidate : frames)
+  {
+    if (candidate->refs.load(std::memory_order_acquire) == 0)
+    {
+      f = candidate.get();
+      break;
+    }
+  }
+  if (f == nullptr)
+  {
+    // Each viewer pins at most one frame, plus the latest and the one being filled.
+    if (frames.size() >= max_clients + 2)
+    {
+      ++publish_dropped;
+      return;
+    }
+    frames.emplace_back(new frame());
+    f = frames.back().get();
+  }
+
+  if (f->data.size() < size)
+  {
+    f->data.resize(size);
+  }
+  memcpy(f->data.data(), data, size);
+  f->size = size;
+  f->sequence = ++next_sequence;
+  int n = std::snprintf(f->header, sizeof(f->header),
+                        "--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\nX-Timestamp: %lld.%06lld\r\n\r\n",
+                        BOUNDARY, size, static_cast<long long>(timestamp_ns / 1000000000LL),
+                        static_cast<long long>((timestamp_ns % 1000000000LL) / 1000));
+  f->header_size = std::min(static_cast<size_t>(n), sizeof(f->header) - 1);
+  f->refs.store(1, std::memory_order_release);
+
+  frame* previous;
+  {
+    std::lock_guard<std::mutex> lock(latest_mutex);
+    previous = latest;
+    latest = f;
+  }
+  if (previous != nullptr)
+  {
+    release(previous);
+  }
+
+  ++frames_published;
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+  {
+    CERR_ENDL("Failed to wake HTTP server: " << strerror(errno));
+  }
+}
+
+mjpeg_server::frame* mjpeg_server::acquire_latest()
+{
+  std::lock_guard<std::mutex> lock(latest_mutex);
+  if (latest != nullptr)
+  {
+    latest->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  return latest;
+}
+
+void mjpeg_server::release(frame* f)
+{
+  f->refs.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void mjpeg_server::run()
+{
+  struct epoll_event events[64];
+  while (is_running)
+  {
+    int n = epoll_wait(epoll_fd, events, 64, 1000);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      CERR_ENDL("HTTP server epoll_wait failed: " << strerror(errno));
+      break;
+    }
+
+    bool new_frame = false;
+    for (int i = 0; i < n; ++i)
+    {
+      if (events[i].data.ptr == nullptr)
+      {
+        accept_clients();
+        continue;
+      }
+      if (events[i].data.ptr == &wake_fd)
+      {
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        {
+          CERR_ENDL("Failed to read HTTP server wakeup: " << strerror(errno));
+        }
+        new_frame = true;
+        continue;
+      }
+
+      client* c = static_cast<client*>(events[i].data.ptr);
+      if (c->fd == -1)
+      {
+        continue;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+      {
+        close_client(c);
+        continue;
+      }
+      if (events[i].events & EPOLLIN)
+      {
+        read_request(c);
+      }
+      if (c->fd != -1 && (events[i].events & EPOLLOUT))
+      {
+        send_pending(c);
+      }
+    }
+
+    // Idle viewers start on the new frame; busy ones pick up the newest frame when they finish theirs.
+    int64_t now = monotonic_ns();
+    for (auto& c : clients)
+    {
+      if (c->fd == -1)
+      {
+        continue;
+      }
+      if (new_frame && c->streaming && c->current == nullptr && c->response_sent == c->response.size())
+      {
+        frame* f = acquire_latest();
+        if (f != nullptr && f->sequence > c->last_sequence)
+        {
+          start_frame(c.get(), f);
+          send_pending(c.get());
+        }
+        else if (f != nullptr)
+        {
+          release(f);
+        }
+      }
+      bool waiting = c->current != nullptr || c->response_sent < c->response.size() || !c->streaming;
+      if (c->fd != -1 && waiting && now - c->last_progress_ns > STALL_TIMEOUT_MS * 1000000LL)
+      {
+        close_client(c.get());
+      }
+    }
+
+    clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                 [](const std::unique_ptr<client>& c) { return c->fd == -1; }),
+                  clients.end());
+    client_count = clients.size();
+  }
+}
+
+void mjpeg_server::accept_clients()
+{
+  for (;;)
+  {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        CERR_ENDL("HTTP accept failed: " << strerror(errno));
+      }
+      return;
+    }
+    if (clients.size() >= max_clients)
+    {
+      close(fd);
+      continue;
+    }
+
+    std::unique_ptr<client> c(new client());
+    c->fd = fd;
+    c->last_progress_ns = monotonic_ns();
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = c.get();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+      close(fd);
+      continue;
+    }
+    clients.push_back(std::move(c));
+  }
+}
+
+void mjpeg_server::read_request(client* c)
+{
+  char discard[512];
+  char* buffer = c->response.empty() ? c->request + c->request_size : discard;
+  size_t space = c->response.empty() ? sizeof(c->request) - 1 - c->request_size : sizeof(discard);
+
+  ssize_t n = recv(c->fd, buffer, space, 0);
+  if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+  {
+    close_client(c);
+    return;
+  }
+  if (n == -1 || !c->response.empty())
+  {
+    // Anything a viewer sends after its request is ignored.
+    return;
+  }
+
+  c->request_size += n;
+  c->request[c->request_size] = '\0';
+  c->last_progress_ns = monotonic_ns();
+  if (strstr(c->request, "\r\n\r\n") == nullptr && strstr(c->request, "\n\n") == nullptr)
+  {
+    if (c->request_size == sizeof(c->request) - 1)
+    {
+      c->response = BAD_REQUEST_RESPONSE;
+      c->close_after = true;
+      send_pending(c);
+    }
+    return;
+  }
+
+  char method[8] = { 0 };
+  char path[256] = { 0 };
+  if (std::sscanf(c->request, "%7s %255s", method, path) != 2 || strcmp(method, "GET") != 0)
+  {
+    c->response = BAD_REQUEST_RESPONSE;
+    c->close_after = true;
+  }
+  else if (strcmp(path, "/") == 0 || strcmp(path, "/stream.mjpg") == 0)
+  {
+    c->response = STREAM_RESPONSE;
+    c->streaming = true;
+    frame* f = acquire_latest();
+    if (f != nullptr)
+    {
+      start_frame(c, f);
+    }
+  }
+  else if (strcmp(path, "/snapshot.jpg") == 0)
+  {
+    frame* f = acquire_latest();
+    if (f == nullptr)
+    {
+      c->response = UNAVAILABLE_RESPONSE;
+    }
+    else
+    {
+      char header[160];
+      std::snprintf(header, sizeof(header),
+                    "HTTP/1.0 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n"
+                    "Cache-Control: no-cache\r\nConnection: close\r\n\r\n",
+                    f->size);
+      c->response = header;
+      c->snapshot = true;
+      start_frame(c, f);
+    }
+    c->close_after = true;
+  }
+  else
+  {
+    c->response = NOT_FOUND_RESPONSE;
+    c->close_after = true;
+  }
+  send_pending(c);
+}
+
+void mjpeg_server::start_frame(client* c, frame* f)
+{
+  if (c->last_sequence != 0 && f->sequence > c->last_sequence + 1)
+  {
+    frames_skipped += f->sequence - c->last_sequence - 1;
+  }
+  c->current = f;
+  c->sent = 0;
+  c->last_sequence = f->sequence;
+}
+
+void mjpeg_server::send_pending(client* c)
+{
+  for (;;)
+  {
+    // Whatever is left of the response header, then the frame as part header, JPEG and trailer.
+    struct iovec iov[4];
+    int count = 0;
+    size_t response_left = c->response.size() - c->response_sent;
+    if (response_left > 0)
+    {
+      iov[count].iov_base = const_cast<char*>(c->response.data() + c->response_sent);
+      iov[count].iov_len = response_left;
+      ++count;
+    }
+
+    size_t part_size = 0;
+    if (c->current != nullptr)
+    {
+      frame* f = c->current;
+      const void* bases[3] = { f->header, f->data.data(), TRAILER };
+      size_t lengths[3] = { c->snapshot ? 0 : f->header_size, f->size, c->snapshot ? 0 : sizeof(TRAILER) - 1 };
+      size_t skip = c->sent;
+      for (int i = 0; i < 3; ++i)
+      {
+        part_size += lengths[i];
+        if (skip >= lengths[i])
+        {
+          skip -= lengths[i];
+          continue;
+        }
+        iov[count].iov_base = const_cast<uint8_t*>(static_cast<const uint8_t*>(bases[i]) + skip);
+        iov[count].iov_len = lengths[i] - skip;
+        skip = 0;
+        ++count;
+      }
+    }
+
+    if (count == 0)
+    {
+      if (c->close_after)
+      {
+        close_client(c);
+        return;
+      }
+
+      // Done with this frame; go straight on to a newer one if there is one.
+      frame* f = c->streaming ? acquire_latest() : nullptr;
+      if (f != nullptr && f->sequence > c->last_sequence)
+      {
+        start_frame(c, f);
+        continue;
+      }
+      if (f != nullptr)
+      {
+        release(f);
+      }
+      set_writable(c, false);
+      return;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        set_writable(c, true);
+        return;
+      }
+      close_client(c);
+      return;
+    }
+
+    c->last_progress_ns = monotonic_ns();
+    size_t written = static_cast<size_t>(n);
+    size_t from_response = std::min(written, response_left);
+    c->response_sent += from_response;
+    c->sent += written - from_response;
+
+    if (c->current != nullptr && c->sent == part_size)
+    {
+      ++frames_sent;
+      release(c->current);
+      c->current = nullptr;
+      c->sent = 0;
+    }
+  }
+}
+
+void mjpeg_server::set_writable(client* c, bool writable)
+{
+  if (c->writable == writable)
+  {
+    return;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+  c->writable = writable;
+}
+
+void mjpeg_server::close_client(client* c)
+{
+  if (c->fd == -1)
+  {
+    return;
+  }
+  if (epoll_fd != -1)
+  {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, nullptr);
+  }
+  close(c->fd);
+  c->fd = -1;
+  if (c->current != nullptr)
+  {
+    release(c->current);
+    c->current = nullptr;
+  }
+}
@@ -0,0 +1,563 @@
+#include "pixel_format.h"
+
+#include <string>
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_FORMAT_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+// Packed 4:2:2 layouts: byte offsets of Y0, U and V inside each 4-byte macropixel.
+struct packed422Layout
+{
+  int y;
+  int u;
+  int v;
+};
+
+const packed422Layout YUYV_LAYOUT = { 0, 1, 3 };
+const packed422Layout UYVY_LAYOUT = { 1, 0, 2 };
+const packed422Layout YVYU_LAYOUT = { 0, 3, 1 };
+
+// BT.601 limited range in 6-bit fixed point; the 74.5 luma gain is applied as 74 plus a one-bit shift. The SIMD
+// kernels use exactly the same arithmetic (including the saturating 16-bit sums) so every path gives identical output.
+inline uint8_t clamp_u8(int v)
+{
+  return v < 0 ? 0 : (v > 255 ? 255 : static_cast<uint8_t>(v));
+}
+
+inline int16_t sat_s16(int v)
+{
+  return v > 32767 ? 32767 : (v < -32768 ? -32768 : static_cast<int16_t>(v));
+}
+
+inline void yuv_to_bgrx(int y, int u, int v, uint8_t* dst)
+{
+  int c = (y - 16) * 74 + ((y - 16) >> 1);
+  int d = u - 128;
+  int e = v - 128;
+  dst[0] = clamp_u8(sat_s16(sat_s16(c + 129 * d) + 32) >> 6);
+  dst[1] = clamp_u8((c - 25 * d - 52 * e + 32) >> 6);
+  dst[2] = clamp_u8((c + 102 * e + 32) >> 6);
+  dst[3] = 0xff;
+}
+
+void packed422_row_scalar(const uint8_t* src, uint8_t* dst, int x, int width, const packed422Layout& l)
+{
+  for (; x + 1 < width; x += 2)
+  {
+    const uint8_t* p = src + x * 2;
+    yuv_to_bgrx(p[l.y], p[l.u], p[l.v], dst + x * 4);
+    yuv_to_bgrx(p[l.y + 2], p[l.u], p[l.v], dst + x * 4 + 4);
+  }
+  if (x < width)
+  {
+    const uint8_t* p = src + x * 2;
+    yuv_to_bgrx(p[l.y], p[l.u], p[l.v], dst + x * 4);
+  }
+}
+
+void nv12_row_scalar(const uint8_t* y_row, const uint8_t* uv_row, uint8_t* dst, int x, int width)
+{
+  for (; x < width; ++x)
+  {
+    const uint8_t* uv = uv_row + (x & ~1);
+    yuv_to_bgrx(y_row[x], uv[0], uv[1], dst + x * 4);
+  }
+}
+
+void grey_row_scalar(const uint8_t* src, uint8_t* dst, int x, int width)
+{
+  for (; x < width; ++x)
+  {
+    uint8_t* p = dst + x * 4;
+    p[0] = p[1] = p[2] = src[x];
+    p[3] = 0xff;
+  }
+}
+
+void rgb24_row_scalar(const uint8_t* src, uint8_t* dst, int width)
+{
+  for (int x = 0; x < width; ++x)
+  {
+    const uint8_t* s = src + x * 3;
+    uint8_t* p = dst + x * 4;
+    p[0] = s[2];
+    p[1] = s[1];
+    p[2] = s[0];
+    p[3] = 0xff;
+  }
+}
+
+#ifdef PIXEL_FORMAT_X86
+
+// ---------------------------------------------------------------------------------------------------------------
+// SSE2: 16 pixels per iteration.
+
+// Splits 4 interleaved chroma pairs (one per 32-bit lane, first component in the low half) into two vectors where
+// each value is duplicated for the two pixels sharing it.
+inline void chroma_dup_sse2(__m128i pairs, __m128i& first, __m128i& second)
+{
+  const __m128i lo_mask = _mm_set1_epi32(0x0000ffff);
+  __m128i lo = _mm_and_si128(pairs, lo_mask);
+  __m128i hi = _mm_srli_epi32(pairs, 16);
+  first = _mm_or_si128(lo, _mm_slli_epi32(lo, 16));
+  second = _mm_or_si128(hi, _mm_slli_epi32(hi, 16));
+}
+
+// Computes 8 pixels of B, G and R as 16-bit values from 16-bit Y, U and V.
+inline void yuv_to_bgr16_sse2(__m128i y, __m128i u, __m128i v, __m128i& b, __m128i& g, __m128i& r)
+{
+  const __m128i c16 = _mm_set1_epi16(16);
+  const __m128i c128 = _mm_set1_epi16(128);
+  const __m128i round = _mm_set1_epi16(32);
+
+  __m128i y0 = _mm_sub_epi16(y, c16);
+  __m128i c = _mm_add_epi16(_mm_mullo_epi16(y0, _mm_set1_epi16(74)), _mm_srai_epi16(y0, 1));
+  __m128i d = _mm_sub_epi16(u, c128);
+  __m128i e = _mm_sub_epi16(v, c128);
+
+  b = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(129))), round), 6);
+  g = _mm_sub_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(25)));
+  g = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(g, _mm_mullo_epi16(e, _mm_set1_epi16(52))), round), 6);
+  r = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(102))), round), 6);
+}
+
+// Interleaves 16 B, G and R bytes into 16 BGRX pixels.
+inline void store_bgrx_sse2(__m128i b, __m128i g, __m128i r, uint8_t* dst)
+{
+  const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xff));
+  __m128i bg_lo = _mm_unpacklo_epi8(b, g);
+  __m128i bg_hi = _mm_unpackhi_epi8(b, g);
+  __m128i ra_lo = _mm_unpacklo_epi8(r, alpha);
+  __m128i ra_hi = _mm_unpackhi_epi8(r, alpha);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(bg_lo, ra_lo));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi16(bg_lo, ra_lo));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), _mm_unpacklo_epi16(bg_hi, ra_hi));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 48), _mm_unpackhi_epi16(bg_hi, ra_hi));
+}
+
+// Converts 16 pixels given as two halves of 16-bit luma and chroma pairs (U first unless swap_uv).
+inline void yuv16_to_bgrx_sse2(__m128i y0, __m128i y1, __m128i c0, __m128i c1, bool swap_uv, uint8_t* dst)
+{
+  __m128i u0, v0, u1, v1;
+  chroma_dup_sse2(c0, u0, v0);
+  chroma_dup_sse2(c1, u1, v1);
+  if (swap_uv)
+  {
+    __m128i t = u0;
+    u0 = v0;
+    v0 = t;
+    t = u1;
+    u1 = v1;
+    v1 = t;
+  }
+
+  __m128i b0, g0, r0, b1, g1, r1;
+  yuv_to_bgr16_sse2(y0, u0, v0, b0, g0, r0);
+  yuv_to_bgr16_sse2(y1, u1, v1, b1, g1, r1);
+  store_bgrx_sse2(_mm_packus_epi16(b0, b1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(r0, r1), dst);
+}
+
+int packed422_row_sse2(const uint8_t* src, uint8_t* dst, int width, const packed422Layout& l)
+{
+  const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+  const bool y_high = l.y == 1;
+  const bool swap_uv = l.v < l.u;
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2 + 16));
+    __m128i ya = y_high ? _mm_srli_epi16(a, 8) : _mm_and_si128(a, low_bytes);
+    __m128i yb = y_high ? _mm_srli_epi16(b, 8) : _mm_and_si128(b, low_bytes);
+    __m128i ca = y_high ? _mm_and_si128(a, low_bytes) : _mm_srli_epi16(a, 8);
+    __m128i cb = y_high ? _mm_and_si128(b, low_bytes) : _mm_srli_epi16(b, 8);
+    yuv16_to_bgrx_sse2(ya, yb, ca, cb, swap_uv, dst + x * 4);
+  }
+  return x;
+}
+
+int nv12_row_sse2(const uint8_t* y_row, const uint8_t* uv_row, uint8_t* dst, int width)
+{
+  const __m128i zero = _mm_setzero_si128();
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y_row + x));
+    __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv_row + x));
+    yuv16_to_bgrx_sse2(_mm_unpacklo_epi8(y, zero), _mm_unpackhi_epi8(y, zero), _mm_unpacklo_epi8(uv, zero),
+                       _mm_unpackhi_epi8(uv, zero), false, dst + x * 4);
+  }
+  return x;
+}
+
+int grey_row_sse2(const uint8_t* src, uint8_t* dst, int width)
+{
+  int x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    store_bgrx_sse2(y, y, y, dst + x * 4);
+  }
+  return x;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// AVX2: 32 pixels per iteration. The 256-bit unpack and pack instructions work per 128-bit lane, so the kernels
+// below mirror the SSE2 ones and the lanes are put back in pixel order with a cross-lane permute on store.
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET inline void chroma_dup_avx2(__m256i pairs, __m256i& first, __m256i& second)
+{
+  const __m256i lo_mask = _mm256_set1_epi32(0x0000ffff);
+  __m256i lo = _mm256_and_si256(pairs, lo_mask);
+  __m256i hi = _mm256_srli_epi32(pairs, 16);
+  first = _mm256_or_si256(lo, _mm256_slli_epi32(lo, 16));
+  second = _mm256_or_si256(hi, _mm256_slli_epi32(hi, 16));
+}
+
+AVX2_TARGET inline void yuv_to_bgr16_avx2(__m256i y, __m256i u, __m256i v, __m256i& b, __m256i& g, __m256i& r)
+{
+  const __m256i c16 = _mm256_set1_epi16(16);
+  const __m256i c128 = _mm256_set1_epi16(128);
+  const __m256i round = _mm256_set1_epi16(32);
+
+  __m256i y0 = _mm256_sub_epi16(y, c16);
+  __m256i c = _mm256_add_epi16(_mm256_mullo_epi16(y0, _mm256_set1_epi16(74)), _mm256_srai_epi16(y0, 1));
+  __m256i d = _mm256_sub_epi16(u, c128);
+  __m256i e = _mm256_sub_epi16(v, c128);
+
+  b = _mm256_srai_epi16(
+      _mm256_adds_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(129))), round), 6);
+  g = _mm256_sub_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(25)));
+  g = _mm256_srai_epi16(_mm256_add_epi16(_mm256_sub_epi16(g, _mm256_mullo_epi16(e, _mm256_set1_epi16(52))), round),
+                        6);
+  r = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(c, _mm256_mullo_epi16(e, _mm256_set1_epi16(102))), round),
+                        6);
+}
+
+// b, g and r hold pixels [0..7 | 8..15] in their low lane halves and [16..23 | 24..31] in the high halves, as
+// produced by _mm256_packus_epi16 of two per-lane vectors.
+AVX2_TARGET inline void store_bgrx_avx2(__m256i b, __m256i g, __m256i r, uint8_t* dst)
+{
+  const __m256i alpha = _mm256_set1_epi8(static_cast<char>(0xff));
+  __m256i bg_lo = _mm256_unpacklo_epi8(b, g);
+  __m256i bg_hi = _mm256_unpackhi_epi8(b, g);
+  __m256i ra_lo = _mm256_unpacklo_epi8(r, alpha);
+  __m256i ra_hi = _mm256_unpackhi_epi8(r, alpha);
+  __m256i p0 = _mm256_unpacklo_epi16(bg_lo, ra_lo);  // pixels 0..3   | 8..11
+  __m256i p1 = _mm256_unpackhi_epi16(bg_lo, ra_lo);  // pixels 4..7   | 12..15
+  __m256i p2 = _mm256_unpacklo_epi16(bg_hi, ra_hi);  // pixels 16..19 | 24..27
+  __m256i p3 = _mm256_unpackhi_epi16(bg_hi, ra_hi);  // pixels 20..23 | 28..31
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(p0, p1, 0x20));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 64), _mm256_permute2x128_si256(p2, p3, 0x20));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+}
+
+// y0/c0 cover pixels 0..7 and 8..15 (one group per lane), y1/c1 cover pixels 16..23 and 24..31.
+AVX2_TARGET inline void yuv32_to_bgrx_avx2(__m256i y0, __m256i y1, __m256i c0, __m256i c1, bool swap_uv,
+                                           uint8_t* dst)
+{
+  __m256i u0, v0, u1, v1;
+  chroma_dup_avx2(c0, u0, v0);
+  chroma_dup_avx2(c1, u1, v1);
+  if (swap_uv)
+  {
+    __m256i t = u0;
+    u0 = v0;
+    v0 = t;
+    t = u1;
+    u1 = v1;
+    v1 = t;
+  }
+
+  __m256i b0, g0, r0, b1, g1, r1;
+  yuv_to_bgr16_avx2(y0, u0, v0, b0, g0, r0);
+  yuv_to_bgr16_avx2(y1, u1, v1, b1, g1, r1);
+  store_bgrx_avx2(_mm256_packus_epi16(b0, b1), _mm256_packus_epi16(g0, g1), _mm256_packus_epi16(r0, r1), dst);
+}
+
+AVX2_TARGET int packed422_row_avx2(const uint8_t* src, uint8_t* dst, int width, const packed422Layout& l)
+{
+  const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+  const bool y_high = l.y == 1;
+  const bool swap_uv = l.v < l.u;
+
+  int x = 0;
+  for (; x + 32 <= width; x += 32)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 2));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 2 + 32));
+    __m256i ya = y_high ? _mm256_srli_epi16(a, 8) : _mm256_and_si256(a, low_bytes);
+    __m256i yb = y_high ? _mm256_srli_epi16(b, 8) : _mm256_and_si256(b, low_bytes);
+    __m256i ca = y_high ? _mm256_and_si256(a, low_bytes) : _mm256_srli_epi16(a, 8);
+    __m256i cb = y_high ? _mm256_and_si256(b, low_bytes) : _mm256_srli_epi16(b, 8);
+    yuv32_to_bgrx_avx2(ya, yb, ca, cb, swap_uv, dst + x * 4);
+  }
+  return x;
+}
+
+AVX2_TARGET int nv12_row_avx2(const uint8_t* y_row, const uint8_t* uv_row, uint8_t* dst, int width)
+{
+  int x = 0;
+  for (; x + 32 <= width; x += 32)
+  {
+    // Widen each 16-byte half separately so lane 0 holds pixels 0..7 / 16..23 and lane 1 holds 8..15 / 24..31,
+    // matching the lane order store_bgrx_avx2 expects.
+    __m128i y_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y_row + x));
+    __m128i y_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y_row + x + 16));
+    __m128i uv_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv_row + x));
+    __m128i uv_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv_row + x + 16));
+    __m256i y0 = _mm256_cvtepu8_epi16(y_a);
+    __m256i y1 = _mm256_cvtepu8_epi16(y_b);
+    __m256i c0 = _mm256_cvtepu8_epi16(uv_a);
+    __m256i c1 = _mm256_cvtepu8_epi16(uv_b);
+    yuv32_to_bgrx_avx2(y0, y1, c0, c1, false, dst + x * 4);
+  }
+  return x;
+}
+
+AVX2_TARGET int grey_row_avx2(const uint8_t* src, uint8_t* dst, int width)
+{
+  int x = 0;
+  for (; x + 32 <= width; x += 32)
+  {
+    // Load as [0..7, 16..23 | 8..15, 24..31] so the per-lane unpacks come out in the order store_bgrx_avx2 expects.
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x));
+    y = _mm256_permute4x64_epi64(y, 0xd8);
+    store_bgrx_avx2(y, y, y, dst + x * 4);
+  }
+  return x;
+}
+
+#undef AVX2_TARGET
+
+enum simdPath
+{
+  SIMD_SCALAR,
+  SIMD_SSE2,
+  SIMD_AVX2
+};
+
+simdPath detect_simd_path()
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2"))
+  {
+    return SIMD_SSE2;
+  }
+  return SIMD_SCALAR;
+}
+
+// Only changed by pixel_format_force_simd_path(), before any conversion runs.
+simdPath SIMD = detect_simd_path();
+
+#endif  // PIXEL_FORMAT_X86
+
+void packed422_row(const uint8_t* src, uint8_t* dst, int width, const packed422Layout& l)
+{
+  int x = 0;
+#ifdef PIXEL_FORMAT_X86
+  if (SIMD == SIMD_AVX2)
+  {
+    x = packed422_row_avx2(src, dst, width, l);
+  }
+  else if (SIMD == SIMD_SSE2)
+  {
+    x = packed422_row_sse2(src, dst, width, l);
+  }
+#endif
+  packed422_row_scalar(src, dst, x, width, l);
+}
+
+void nv12_row(const uint8_t* y_row, const uint8_t* uv_row, uint8_t* dst, int width)
+{
+  int x = 0;
+#ifdef PIXEL_FORMAT_X86
+  if (SIMD == SIMD_AVX2)
+  {
+    x = nv12_row_avx2(y_row, uv_row, dst, width);
+  }
+  else if (SIMD == SIMD_SSE2)
+  {
+    x = nv12_row_sse2(y_row, uv_row, dst, width);
+  }
+#endif
+  nv12_row_scalar(y_row, uv_row, dst, x, width);
+}
+
+void grey_row(const uint8_t* src, uint8_t* dst, int width)
+{
+  int x = 0;
+#ifdef PIXEL_FORMAT_X86
+  if (SIMD == SIMD_AVX2)
+  {
+    x = grey_row_avx2(src, dst, width);
+  }
+  else if (SIMD == SIMD_SSE2)
+  {
+    x = grey_row_sse2(src, dst, width);
+  }
+#endif
+  grey_row_scalar(src, dst, x, width);
+}
+
+bool convert_packed422(const uint8_t* src, size_t src_size, int width, int height, int src_stride, uint8_t* dst,
+                       int dst_stride, const packed422Layout& l)
+{
+  // An odd last pixel still reads the chroma of its whole macropixel.
+  int row_bytes = (width + 1) / 2 * 4;
+  if (src_stride < row_bytes || src_size < static_cast<size_t>(src_stride) * (height - 1) + row_bytes)
+  {
+    return false;
+  }
+  for (int y = 0; y < height; ++y)
+  {
+    packed422_row(src + static_cast<size_t>(y) * src_stride, dst + static_cast<size_t>(y) * dst_stride, width, l);
+  }
+  return true;
+}
+
+bool convert_nv12(const uint8_t* src, size_t src_size, int width, int height, int src_stride, uint8_t* dst,
+                  int dst_stride)
+{
+  size_t luma_size = static_cast<size_t>(src_stride) * height;
+  int chroma_bytes = (width + 1) & ~1;
+  if (src_stride < chroma_bytes ||
+      src_size < luma_size + static_cast<size_t>(src_stride) * ((height - 1) / 2) + chroma_bytes)
+  {
+    return false;
+  }
+  const uint8_t* uv_plane = src + luma_size;
+  for (int y = 0; y < height; ++y)
+  {
+    nv12_row(src + static_cast<size_t>(y) * src_stride, uv_plane + static_cast<size_t>(y / 2) * src_stride,
+             dst + static_cast<size_t>(y) * dst_stride, width);
+  }
+  return true;
+}
+
+bool convert_grey(const uint8_t* src, size_t src_size, int width, int height, int src_stride, uint8_t* dst,
+                  int dst_stride)
+{
+  if (src_stride < width || src_size < static_cast<size_t>(src_stride) * (height - 1) + width)
+  {
+    return false;
+  }
+  for (int y = 0; y < height; ++y)
+  {
+    grey_row(src + static_cast<size_t>(y) * src_stride, dst + static_cast<size_t>(y) * dst_stride, width);
+  }
+  return true;
+}
+
+bool convert_rgb24(const uint8_t* src, size_t src_size, int width, int height, int src_stride, uint8_t* dst,
+                   int dst_stride)
+{
+  if (src_stride < width * 3 || src_size < static_cast<size_t>(src_stride) * (height - 1) + width * 3)
+  {
+    return false;
+  }
+  for (int y = 0; y < height; ++y)
+  {
+    rgb24_row_scalar(src + static_cast<size_t>(y) * src_stride, dst + static_cast<size_t>(y) * dst_stride, width);
+  }
+  return true;
+}
+}  // namespace
+
+bool pixel_format_supported(uint32_t fourcc)
+{
+  switch (fourcc)
+  {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_YVYU:
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_GREY:
+    case V4L2_PIX_FMT_RGB24:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool convert_to_rgb32(uint32_t fourcc, const uint8_t* src, size_t src_size, int width, int height, int src_stride,
+                      uint8_t* dst, int dst_stride)
+{
+  if (src == nullptr || dst == nullptr || width <= 0 || height <= 0 || dst_stride < width * 4)
+  {
+    return false;
+  }
+
+  switch (fourcc)
+  {
+    case V4L2_PIX_FMT_YUYV:
+      return convert_packed422(src, src_size, width, height, src_stride, dst, dst_stride, YUYV_LAYOUT);
+    case V4L2_PIX_FMT_UYVY:
+      return convert_packed422(src, src_size, width, height, src_stride, dst, dst_stride, UYVY_LAYOUT);
+    case V4L2_PIX_FMT_YVYU:
+      return convert_packed422(src, src_size, width, height, src_stride, dst, dst_stride, YVYU_LAYOUT);
+    case V4L2_PIX_FMT_NV12:
+      return convert_nv12(src, src_size, width, height, src_stride, dst, dst_stride);
+    case V4L2_PIX_FMT_GREY:
+      return convert_grey(src, src_size, width, height, src_stride, dst, dst_stride);
+    case V4L2_PIX_FMT_RGB24:
+      return convert_rgb24(src, src_size, width, height, src_stride, dst, dst_stride);
+    default:
+      return false;
+  }
+}
+
+bool pixel_format_force_simd_path(const char* name)
+{
+  std::string path = name;
+  if (path == "scalar")
+  {
+#ifdef PIXEL_FORMAT_X86
+    SIMD = SIMD_SCALAR;
+#endif
+    return true;
+  }
+#ifdef PIXEL_FORMAT_X86
+  if (path == "sse2" && __builtin_cpu_supports("sse2"))
+  {
+    SIMD = SIMD_SSE2;
+    return true;
+  }
+  if (path == "avx2" && __builtin_cpu_supports("avx2"))
+  {
+    SIMD = SIMD_AVX2;
+    return true;
+  }
+#endif
+  return false;
+}
+
+const char* pixel_format_simd_path()
+{
+#ifdef PIXEL_FORMAT_X86
+  switch (SIMD)
+  {
+    case SIMD_AVX2:
+      return "avx2";
+    case SIMD_SSE2:
+      return "sse2";
+    default:
+      break;
+  }
+#endif
+  return "scalar";
+}
@@ -0,0 +1,290 @@
+#include "pretrigger_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include "frame_stats.h"
+#include "debug.h"
+
+namespace
+{
+// A flush whose camera stopped delivering frames gives up this long after its window ends.
+const int64_t FLUSH_GRACE_NS = 1000000000LL;
+}  // namespace
+
+pretrigger_buffer::pretrigger_buffer()
+  : fps(0)
+  , window_ns(0)
+  , arena_size(0)
+  , write_pos(0)
+  , first(0)
+  , count(0)
+  , bytes_used(0)
+  , flush_next(0)
+  , flush_until_ns(0)
+  , is_armed(false)
+  , is_flushing(false)
+  , frames_evicted(0)
+  , frames_rejected(0)
+  , frames_lost(0)
+{
+  memset(&format, 0, sizeof(format));
+}
+
+pretrigger_buffer::~pretrigger_buffer()
+{
+  disarm();
+}
+
+bool pretrigger_buffer::arm(const struct v4l2_pix_format& stream_format, double stream_fps, double seconds,
+                            size_t arena_bytes)
+{
+  disarm();
+  if (seconds <= 0 || arena_bytes == 0)
+  {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  format = stream_format;
+  fps = stream_fps > 0 ? stream_fps : 30;
+  window_ns = static_cast<int64_t>(seconds * 1e9);
+
+  if (arena_size != arena_bytes)
+  {
+    arena.reset(new (std::nothrow) uint8_t[arena_bytes]);
+    arena_size = arena ? arena_bytes : 0;
+    if (!arena)
+    {
+      CERR_ENDL("Failed to allocate " << arena_bytes << " bytes for the pre-trigger buffer");
+      return false;
+    }
+  }
+
+  // Twice the nominal rate leaves room for cameras that run faster than they advertise.
+  index.assign(std::max<size_t>(64, static_cast<size_t>(seconds * fps * 2)), entry());
+  scratch.resize(std::max<size_t>(format.sizeimage, 1 << 20));
+  write_pos = 0;
+  first = 0;
+  count = 0;
+  bytes_used = 0;
+  frames_evicted = 0;
+  frames_rejected = 0;
+  frames_lost = 0;
+
+  is_armed = true;
+  return true;
+}
+
+void pretrigger_buffer::disarm()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_armed = false;
+  }
+  frame_added.notify_one();
+  if (flush_thread.joinable())
+  {
+    flush_thread.join();
+  }
+}
+
+bool pretrigger_buffer::armed() const
+{
+  return is_armed;
+}
+
+void pretrigger_buffer::push(const rawFrame& frame)
+{
+  if (!is_armed)
+  {
+    return;
+  }
+
+  size_t offset;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count == index.size())
+    {
+      evict_oldest();
+    }
+    if (!reserve(frame.bytesused, offset))
+    {
+      return;
+    }
+  }
+
+  // The reserved bytes belong to no published frame, so neither side touches them until the frame is published.
+  memcpy(arena.get() + offset, frame.data, frame.bytesused);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    entry& e = index[(first + count) % index.size()];
+    e.offset = offset;
+    e.size = frame.bytesused;
+    e.timestamp_ns = frame.timestamp_ns;
+    e.dequeue_ns = frame.dequeue_ns;
+    e.sequence = frame.sequence;
+    ++count;
+    bytes_used += frame.bytesused;
+
+    while (count > 1 && frame.dequeue_ns - index[first % index.size()].dequeue_ns > window_ns)
+    {
+      evict_oldest();
+    }
+  }
+  frame_added.notify_one();
+}
+
+bool pretrigger_buffer::reserve(size_t size, size_t& offset)
+{
+  if (size > arena_size)
+  {
+    ++frames_rejected;
+    return false;
+  }
+
+  // Frames sit back to back in arrival order and wrap to the start of the arena when the end is too short, so the
+  // free space is either [write_pos, end) plus [0, oldest) or just [write_pos, oldest).
+  for (;;)
+  {
+    if (count == 0)
+    {
+      write_pos = 0;
+      break;
+    }
+
+    size_t oldest = index[first % index.size()].offset;
+    if (write_pos > oldest)
+    {
+      if (arena_size - write_pos >= size)
+      {
+        break;
+      }
+      write_pos = 0;
+      continue;
+    }
+    if (oldest - write_pos >= size)
+    {
+      break;
+    }
+    evict_oldest();
+  }
+
+  offset = write_pos;
+  write_pos += size;
+  return true;
+}
+
+void pretrigger_buffer::evict_oldest()
+{
+  bytes_used -= index[first % index.size()].size;
+  ++first;
+  --count;
+  ++frames_evicted;
+}
+
+bool pretrigger_buffer::trigger(const std::string& path, double post_seconds)
+{
+  if (!is_armed)
+  {
+    return false;
+  }
+
+  int64_t until = monotonic_ns() + static_cast<int64_t>(post_seconds * 1e9);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (is_flushing)
+    {
+      flush_until_ns = std::max(flush_until_ns, until);
+      return true;
+    }
+  }
+
+  // The previous flush has finished writing frames but may still be closing its file.
+  if (flush_thread.joinable())
+  {
+    flush_thread.join();
+  }
+
+  if (!output.start(path, format, fps, 64))
+  {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  flush_next = first;
+  flush_until_ns = until;
+  is_flushing = true;
+  flush_thread = std::thread(&pretrigger_buffer::flush_loop, this);
+  return true;
+}
+
+bool pretrigger_buffer::flushing() const
+{
+  return is_flushing;
+}
+
+pretriggerStats pretrigger_buffer::get_stats()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  pretriggerStats stats;
+  stats.frames_buffered = count;
+  stats.bytes_buffered = bytes_used;
+  stats.frames_evicted = frames_evicted;
+  stats.frames_rejected = frames_rejected;
+  stats.frames_lost = frames_lost;
+  stats.flushing = is_flushing;
+  return stats;
+}
+
+void pretrigger_buffer::flush_loop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;)
+  {
+    if (flush_next < first)
+    {
+      // Capture outran the disk and reused the space of frames this flush had not written yet.
+      frames_lost += first - flush_next;
+      flush_next = first;
+    }
+
+    if (flush_next < first + count)
+    {
+      const entry& e = index[flush_next % index.size()];
+      if (e.dequeue_ns > flush_until_ns)
+      {
+        break;
+      }
+      if (scratch.size() < e.size)
+      {
+        scratch.resize(e.size);
+      }
+      memcpy(scratch.data(), arena.get() + e.offset, e.size);
+      size_t size = e.size;
+      int64_t timestamp_ns = e.timestamp_ns;
+      uint32_t sequence = e.sequence;
+      ++flush_next;
+
+      lock.unlock();
+      output.push_wait(scratch.data(), size, timestamp_ns, sequence);
+      lock.lock();
+      continue;
+    }
+
+    if (!is_armed || monotonic_ns() > flush_until_ns + FLUSH_GRACE_NS)
+    {
+      break;
+    }
+    frame_added.wait_for(lock, std::chrono::milliseconds(100));
+  }
+  is_flushing = false;
+  lock.unlock();
+
+  output.stop();
+  recorderStats stats = output.get_stats();
+  COUT_ENDL("Pre-trigger flush wrote " << stats.frames_written << " frames (" << stats.bytes_written << " bytes)");
+}
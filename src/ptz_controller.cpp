@@ -0,0 +1,460 @@
+#include "ptz_controller.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "frame_stats.h"
+#include "trace.h"
+#include "debug.h"
+
+namespace
+{
+// Tick interval bounds. The interval is twice the measured batch latency within these limits.
+const int64_t MIN_TICK_NS = 10000000LL;
+const int64_t MAX_TICK_NS = 200000000LL;
+
+// Full deflection sweeps an absolute range in this many seconds.
+const double FULL_RANGE_SECONDS = 4.0;
+
+struct ptzIds
+{
+  uint32_t speed;
+  uint32_t relative;
+  uint32_t absolute;
+};
+
+const ptzIds PTZ_IDS[ptz_controller::AXES] = {
+  { V4L2_CID_PAN_SPEED, V4L2_CID_PAN_RELATIVE, V4L2_CID_PAN_ABSOLUTE },
+  { V4L2_CID_TILT_SPEED, V4L2_CID_TILT_RELATIVE, V4L2_CID_TILT_ABSOLUTE },
+  { V4L2_CID_ZOOM_CONTINUOUS, V4L2_CID_ZOOM_RELATIVE, V4L2_CID_ZOOM_ABSOLUTE },
+};
+
+const controlInfo* find_writable(const std::vector<controlInfo>& table, uint32_t id)
+{
+  for (const auto& info : table)
+  {
+    if (info.id == id)
+    {
+      return info.flags & (V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY) ? nullptr : &info;
+    }
+  }
+  return nullptr;
+}
+}  // namespace
+
+ptz_controller::ptz_controller(usb_cam* camera, Joystick* joystick)
+  : camera(camera)
+  , joystick(joystick)
+  , deadzone(0.1)
+  , expo(0.6)
+  , preset_button(-1)
+  , store_request(-1)
+  , recall_request(-1)
+  , latency_ns(0)
+  , is_running(false)
+  , wake_fd(-1)
+{
+  // Left stick for pan and tilt (up is negative on most pads), right stick vertical for zoom.
+  set_axis(PAN, 0, false);
+  set_axis(TILT, 1, true);
+  set_axis(ZOOM, 4, true);
+  pressed_ns.fill(0);
+}
+
+ptz_controller::~ptz_controller()
+{
+  stop();
+}
+
+void ptz_controller::set_axis(int ptz_axis, int joystick_axis, bool invert)
+{
+  if (ptz_axis >= 0 && ptz_axis < AXES)
+  {
+    axes[ptz_axis].joystick_axis = joystick_axis;
+    axes[ptz_axis].invert = invert;
+  }
+}
+
+void ptz_controller::set_response(double deadzone, double expo)
+{
+  this->deadzone = std::min(std::max(deadzone, 0.0), 0.95);
+  this->expo = std::min(std::max(expo, 0.0), 1.0);
+}
+
+void ptz_controller::set_preset_buttons(int first_button)
+{
+  preset_button = first_button;
+}
+
+void ptz_controller::set_value_callback(std::function<void(uint32_t id, int32_t value)> callback)
+{
+  m_callback = callback;
+}
+
+ptz_controller::axisMode ptz_controller::mode(int ptz_axis) const
+{
+  return ptz_axis >= 0 && ptz_axis < AXES ? axes[ptz_axis].mode : PTZ_NONE;
+}
+
+double ptz_controller::control_latency_ms() const
+{
+  return latency_ns / 1e6;
+}
+
+bool ptz_controller::running() const
+{
+  return is_running;
+}
+
+double ptz_controller::shape(int value, double deadzone, double expo)
+{
+  double x = std::min(std::abs(value) / 32767.0, 1.0);
+  if (x <= deadzone)
+  {
+    return 0;
+  }
+  // Rescale so the output starts from zero at the deadzone edge, then blend linear and cubic.
+  x = (x - deadzone) / (1 - deadzone);
+  x = (1 - expo) * x + expo * x * x * x;
+  return value < 0 ? -x : x;
+}
+
+void ptz_controller::detect_controls()
+{
+  const std::vector<controlInfo>& table = camera->controls();
+  for (int i = 0; i < AXES; ++i)
+  {
+    axisControl& axis = axes[i];
+    axis.mode = PTZ_NONE;
+    axis.id = 0;
+    axis.position = 0;
+    axis.moving = false;
+    axis.sent = 0;
+
+    const controlInfo* absolute = find_writable(table, PTZ_IDS[i].absolute);
+    axis.absolute_id = absolute ? absolute->id : 0;
+    double span = absolute ? static_cast<double>(absolute->maximum) - absolute->minimum : 0;
+
+    const controlInfo* info = nullptr;
+    if ((info = find_writable(table, PTZ_IDS[i].speed)) != nullptr)
+    {
+      axis.mode = PTZ_SPEED;
+    }
+    else if ((info = find_writable(table, PTZ_IDS[i].relative)) != nullptr)
+    {
+      axis.mode = PTZ_RELATIVE;
+      axis.rate = span > 0 ? span / FULL_RANGE_SECONDS : info->maximum;
+    }
+    else if ((info = absolute) != nullptr)
+    {
+      axis.mode = PTZ_ABSOLUTE;
+      axis.rate = span / FULL_RANGE_SECONDS;
+    }
+
+    if (info != nullptr)
+    {
+      axis.id = info->id;
+      axis.minimum = static_cast<int32_t>(info->minimum);
+      axis.maximum = static_cast<int32_t>(info->maximum);
+    }
+  }
+}
+
+void ptz_controller::start()
+{
+  if (is_running || !camera->streaming)
+  {
+    return;
+  }
+
+  detect_controls();
+  bool any = false;
+  for (const auto& axis : axes)
+  {
+    any = any || axis.mode != PTZ_NONE;
+  }
+  if (!any)
+  {
+    COUT_ENDL("Camera has no pan, tilt or zoom controls");
+    return;
+  }
+
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd == -1)
+  {
+    CERR_ENDL("Failed to create PTZ wakeup eventfd: " << strerror(errno));
+    return;
+  }
+
+  // Drop edges left over from a previous stream before enabling the queue again.
+  joystickEvent stale;
+  while (joystick->pollEvent(stale))
+  {
+    continue;
+  }
+  joystick->enableEventQueue(preset_button >= 0);
+
+  is_running = true;
+  worker = std::thread(&ptz_controller::run, this);
+}
+
+void ptz_controller::stop()
+{
+  if (!is_running)
+  {
+    return;
+  }
+
+  is_running = false;
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) == -1)
+  {
+    CERR_ENDL("Failed to wake PTZ thread: " << strerror(errno));
+  }
+  worker.join();
+  close(wake_fd);
+  wake_fd = -1;
+  joystick->enableEventQueue(false);
+}
+
+bool ptz_controller::store_preset(int preset)
+{
+  if (preset < 0 || preset >= PRESETS || !is_running)
+  {
+    return false;
+  }
+  store_request = preset;
+  return true;
+}
+
+bool ptz_controller::recall_preset(int preset)
+{
+  if (preset < 0 || preset >= PRESETS || !is_running)
+  {
+    return false;
+  }
+  recall_request = preset;
+  return true;
+}
+
+void ptz_controller::sync_position(axisControl& axis)
+{
+  std::map<uint32_t, int32_t> values;
+  if (camera->get_controls(std::vector<uint32_t>(1, axis.id), values) && values.count(axis.id))
+  {
+    axis.sent = values[axis.id];
+    axis.position = axis.sent;
+  }
+}
+
+void ptz_controller::send()
+{
+  if (batch.empty())
+  {
+    return;
+  }
+
+  int64_t start = monotonic_ns();
+  camera->set_controls(batch);
+  int64_t elapsed = monotonic_ns() - start;
+
+  // Exponential moving average over roughly the last eight batches.
+  int64_t average = latency_ns;
+  latency_ns = average == 0 ? elapsed : average + (elapsed - average) / 8;
+
+  if (m_callback)
+  {
+    for (const auto& value : batch)
+    {
+      for (const auto& axis : axes)
+      {
+        if (value.first == axis.absolute_id)
+        {
+          m_callback(value.first, value.second);
+        }
+      }
+    }
+  }
+  batch.clear();
+}
+
+void ptz_controller::stop_motion()
+{
+  for (auto& axis : axes)
+  {
+    if (axis.mode == PTZ_SPEED && axis.sent != 0)
+    {
+      batch.push_back(std::make_pair(axis.id, 0));
+      axis.sent = 0;
+    }
+  }
+  send();
+}
+
+void ptz_controller::handle_buttons(int64_t now_ns)
+{
+  joystickEvent event;
+  while (joystick->pollEvent(event))
+  {
+    int preset = event.number - preset_button;
+    if (event.type != joystickEvent::BUTTON || preset < 0 || preset >= PRESETS)
+    {
+      continue;
+    }
+
+    if (event.value)
+    {
+      pressed_ns[preset] = now_ns;
+    }
+    else if (pressed_ns[preset] != 0)
+    {
+      bool held = now_ns - pressed_ns[preset] >= PRESET_HOLD_MS * 1000000LL;
+      (held ? store_request : recall_request) = preset;
+      pressed_ns[preset] = 0;
+    }
+  }
+}
+
+void ptz_controller::handle_presets()
+{
+  int preset = store_request.exchange(-1);
+  if (preset >= 0)
+  {
+    std::vector<uint32_t> ids;
+    for (const auto& axis : axes)
+    {
+      if (axis.absolute_id != 0)
+      {
+        ids.push_back(axis.absolute_id);
+      }
+    }
+
+    std::map<uint32_t, int32_t> values;
+    if (!ids.empty() && camera->get_controls(ids, values))
+    {
+      for (int i = 0; i < AXES; ++i)
+      {
+        presets[preset].position[i] = values.count(axes[i].absolute_id) ? values[axes[i].absolute_id] : 0;
+      }
+      presets[preset].valid = true;
+      COUT_ENDL("Stored PTZ preset " << preset + 1);
+    }
+  }
+
+  preset = recall_request.exchange(-1);
+  if (preset >= 0 && presets[preset].valid)
+  {
+    for (int i = 0; i < AXES; ++i)
+    {
+      axisControl& axis = axes[i];
+      if (axis.absolute_id == 0)
+      {
+        continue;
+      }
+      batch.push_back(std::make_pair(axis.absolute_id, presets[preset].position[i]));
+      if (axis.mode == PTZ_ABSOLUTE)
+      {
+        axis.position = axis.sent = presets[preset].position[i];
+      }
+    }
+    send();
+  }
+}
+
+void ptz_controller::run()
+{
+  TRACE_THREAD_NAME("ptz");
+  batch.reserve(2 * AXES);
+  joystickState state;
+  int64_t last_ns = monotonic_ns();
+
+  while (is_running)
+  {
+    int64_t interval = std::min(std::max(2 * latency_ns.load(), MIN_TICK_NS), MAX_TICK_NS);
+    struct pollfd wake = { wake_fd, POLLIN, 0 };
+    if (poll(&wake, 1, static_cast<int>(interval / 1000000)) > 0)
+    {
+      break;
+    }
+
+    int64_t now = monotonic_ns();
+    double dt = (now - last_ns) / 1e9;
+    last_ns = now;
+
+    if (preset_button >= 0)
+    {
+      handle_buttons(now);
+    }
+    handle_presets();
+
+    joystick->getState(state);
+    for (auto& axis : axes)
+    {
+      if (axis.mode == PTZ_NONE)
+      {
+        continue;
+      }
+
+      int raw = state.connected && axis.joystick_axis >= 0 && axis.joystick_axis < state.axis_count
+                    ? state.axis[axis.joystick_axis]
+                    : 0;
+      double velocity = shape(raw, deadzone, expo) * (axis.invert ? -1 : 1);
+
+      if (axis.mode == PTZ_SPEED)
+      {
+        int32_t target = static_cast<int32_t>(std::lround(velocity * (velocity > 0 ? axis.maximum : -axis.minimum)));
+        if (target != axis.sent)
+        {
+          batch.push_back(std::make_pair(axis.id, target));
+          axis.sent = target;
+        }
+        continue;
+      }
+
+      if (velocity == 0)
+      {
+        axis.moving = false;
+        axis.position = axis.mode == PTZ_RELATIVE ? 0 : axis.position;
+        continue;
+      }
+
+      if (axis.mode == PTZ_RELATIVE)
+      {
+        // Carry the fractional part over so slow moves still add up.
+        axis.position += velocity * axis.rate * dt;
+        int32_t step = static_cast<int32_t>(axis.position);
+        step = std::min(std::max(step, axis.minimum), axis.maximum);
+        if (step != 0)
+        {
+          batch.push_back(std::make_pair(axis.id, step));
+          axis.position -= step;
+        }
+        continue;
+      }
+
+      // Absolute: start each gesture from where the camera is, the sliders may have moved it since.
+      if (!axis.moving)
+      {
+        sync_position(axis);
+        axis.moving = true;
+      }
+      axis.position = std::min(std::max(axis.position + velocity * axis.rate * dt, static_cast<double>(axis.minimum)),
+                               static_cast<double>(axis.maximum));
+      int32_t target = static_cast<int32_t>(std::lround(axis.position));
+      if (target != axis.sent)
+      {
+        batch.push_back(std::make_pair(axis.id, target));
+        axis.sent = target;
+      }
+    }
+    send();
+  }
+
+  stop_motion();
+}
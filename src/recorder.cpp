@@ -0,0 +1,663 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frame_file.h"
+#include "debug.h"
+
+namespace
+{
+// Output is staged in this many bytes and written in whole, page-aligned chunks.
+const size_t WRITE_CHUNK = 4 << 20;
+const size_t PAGE = 4096;
+
+// Start a new AVI file before the RIFF sizes approach what AVI 1.0 readers accept.
+const uint64_t MAX_AVI_BYTES = 1000ull << 20;
+
+void put16(std::vector<uint8_t>& out, uint16_t value)
+{
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+void put32(std::vector<uint8_t>& out, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    out.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+void put_fourcc(std::vector<uint8_t>& out, const char* fourcc)
+{
+  out.insert(out.end(), fourcc, fourcc + 4);
+}
+
+void le32(uint8_t* out, uint32_t value)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    out[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+// "rec.avi" -> "rec.001.avi" for the second segment and so on.
+std::string segment_path(const std::string& path, int segment)
+{
+  if (segment == 0)
+  {
+    return path;
+  }
+  char suffix[16];
+  std::snprintf(suffix, sizeof(suffix), ".%03d", segment);
+  size_t dot = path.rfind('.');
+  size_t slash = path.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+  {
+    return path + suffix;
+  }
+  return path.substr(0, dot) + suffix + path.substr(dot);
+}
+}  // namespace
+
+// Append-only file that turns many small appends into few large, aligned write() calls. Data already written can be
+// patched in place with pwrite(), which is how container headers get their final sizes.
+class aligned_file
+{
+public:
+  aligned_file() : fd(-1), buffer(nullptr), used(0), flushed(0)
+  {
+  }
+
+  ~aligned_file()
+  {
+    close();
+    std::free(buffer);
+  }
+
+  bool open(const std::string& path)
+  {
+    close();
+    if (buffer == nullptr && posix_memalign(reinterpret_cast<void**>(&buffer), PAGE, WRITE_CHUNK) != 0)
+    {
+      buffer = nullptr;
+      CERR_ENDL("Failed to allocate record buffer");
+      return false;
+    }
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+      CERR_ENDL("Failed to open " << path << " for recording: " << strerror(errno));
+      return false;
+    }
+    used = 0;
+    flushed = 0;
+    return true;
+  }
+
+  bool append(const void* data, size_t size)
+  {
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    while (size > 0)
+    {
+      size_t n = std::min(size, WRITE_CHUNK - used);
+      memcpy(buffer + used, src, n);
+      used += n;
+      src += n;
+      size -= n;
+      if (used == WRITE_CHUNK && !write_out(WRITE_CHUNK))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool patch(uint64_t offset, const void* data, size_t size)
+  {
+    // Still staged: patch the buffer, it goes out with the next write.
+    if (offset >= flushed)
+    {
+      memcpy(buffer + (offset - flushed), data, size);
+      return true;
+    }
+    return pwrite(fd, data, size, offset) == static_cast<ssize_t>(size);
+  }
+
+  uint64_t position() const
+  {
+    return flushed + used;
+  }
+
+  bool close()
+  {
+    if (fd == -1)
+    {
+      return true;
+    }
+    bool ok = used == 0 || write_out(used);
+    ::close(fd);
+    fd = -1;
+    return ok;
+  }
+
+private:
+  aligned_file(const aligned_file&);
+  aligned_file& operator=(const aligned_file&);
+
+  bool write_out(size_t size)
+  {
+    size_t done = 0;
+    while (done < size)
+    {
+      ssize_t n = ::write(fd, buffer + done, size - done);
+      if (n == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        CERR_ENDL("Failed to write recording: " << strerror(errno));
+        return false;
+      }
+      done += n;
+    }
+    flushed += size;
+    used = 0;
+    return true;
+  }
+
+  int fd;
+  uint8_t* buffer;
+  size_t used;
+  uint64_t flushed;
+};
+
+class container_writer
+{
+public:
+  virtual ~container_writer()
+  {
+  }
+  virtual bool write(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence) = 0;
+  virtual bool finish() = 0;
+};
+
+namespace
+{
+// mkvmerge timestamp format v2: one presentation time in milliseconds per line.
+class timestamp_sidecar
+{
+public:
+  timestamp_sidecar() : file(nullptr), first_ns(0)
+  {
+  }
+
+  ~timestamp_sidecar()
+  {
+    close();
+  }
+
+  bool open(const std::string& media_path)
+  {
+    close();
+    file = std::fopen((media_path + ".timestamps.txt").c_str(), "w");
+    if (file == nullptr)
+    {
+      CERR_ENDL("Failed to open timestamp file for " << media_path << ": " << strerror(errno));
+      return false;
+    }
+    std::fprintf(file, "# timestamp format v2\n");
+    first_ns = -1;
+    return true;
+  }
+
+  void add(int64_t timestamp_ns)
+  {
+    if (first_ns < 0)
+    {
+      first_ns = timestamp_ns;
+    }
+    std::fprintf(file, "%.3f\n", (timestamp_ns - first_ns) / 1e6);
+  }
+
+  void close()
+  {
+    if (file != nullptr)
+    {
+      std::fclose(file);
+      file = nullptr;
+    }
+  }
+
+private:
+  std::FILE* file;
+  int64_t first_ns;
+};
+
+class avi_writer : public container_writer
+{
+public:
+  avi_writer(const std::string& path, const struct v4l2_pix_format& format, double fps)
+    : path(path), format(format), fps(fps > 0 ? fps : 30), segment(0), frames(0), max_frame(0), first_ns(0), last_ns(0)
+  {
+  }
+
+  bool open()
+  {
+    std::string file_path = segment_path(path, segment);
+    if (!file.open(file_path) || !timestamps.open(file_path))
+    {
+      return false;
+    }
+    frames = 0;
+    max_frame = 0;
+    index.clear();
+
+    std::vector<uint8_t> header = build_header(fps, 0, 0);
+    return file.append(header.data(), header.size());
+  }
+
+  bool write(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t) override
+  {
+    if (file.position() + size + 8 + (index.size() + 16) * 4 > MAX_AVI_BYTES)
+    {
+      if (!finish())
+      {
+        return false;
+      }
+      ++segment;
+      if (!open())
+      {
+        return false;
+      }
+    }
+
+    if (frames == 0)
+    {
+      first_ns = timestamp_ns;
+    }
+    last_ns = timestamp_ns;
+
+    // idx1 offsets are relative to the "movi" fourcc.
+    uint64_t offset = file.position() - MOVI_FOURCC_OFFSET;
+    index.push_back(0x63643030);  // "00dc"
+    index.push_back(0x10);        // AVIIF_KEYFRAME; every JPEG stands alone.
+    index.push_back(static_cast<uint32_t>(offset));
+    index.push_back(static_cast<uint32_t>(size));
+
+    uint8_t chunk[8] = { '0', '0', 'd', 'c' };
+    le32(chunk + 4, static_cast<uint32_t>(size));
+    static const uint8_t pad = 0;
+    if (!file.append(chunk, sizeof(chunk)) || !file.append(data, size) || ((size & 1) && !file.append(&pad, 1)))
+    {
+      return false;
+    }
+
+    timestamps.add(timestamp_ns);
+    max_frame = std::max(max_frame, static_cast<uint32_t>(size));
+    ++frames;
+    return true;
+  }
+
+  bool finish() override
+  {
+    uint64_t movi_end = file.position();
+
+    std::vector<uint8_t> idx1;
+    put_fourcc(idx1, "idx1");
+    put32(idx1, static_cast<uint32_t>(index.size() * 4));
+    bool ok = file.append(idx1.data(), idx1.size()) &&
+              file.append(index.data(), index.size() * sizeof(uint32_t));
+    uint64_t riff_end = file.position();
+
+    // Replace the nominal rate with the measured one so players keep real time on average.
+    double measured = fps;
+    if (frames > 1 && last_ns > first_ns)
+    {
+      measured = (frames - 1) * 1e9 / (last_ns - first_ns);
+    }
+
+    std::vector<uint8_t> header = build_header(measured, frames, max_frame);
+    le32(&header[4], static_cast<uint32_t>(riff_end - 8));
+    le32(&header[MOVI_LIST_OFFSET + 4], static_cast<uint32_t>(movi_end - MOVI_LIST_OFFSET - 8));
+    ok = ok && file.patch(0, header.data(), header.size());
+    ok = file.close() && ok;
+    timestamps.close();
+    return ok;
+  }
+
+private:
+  static const size_t MOVI_LIST_OFFSET = 212;
+  static const size_t MOVI_FOURCC_OFFSET = 220;
+
+  std::vector<uint8_t> build_header(double rate, uint32_t total_frames, uint32_t max_frame_size) const
+  {
+    uint32_t width = format.width;
+    uint32_t height = format.height;
+    uint32_t scale = 1000;
+    uint32_t rate_scaled = static_cast<uint32_t>(rate * scale + 0.5);
+
+    std::vector<uint8_t> h;
+    put_fourcc(h, "RIFF");
+    put32(h, 0);  // Patched on finish.
+    put_fourcc(h, "AVI ");
+
+    put_fourcc(h, "LIST");
+    put32(h, 192);
+    put_fourcc(h, "hdrl");
+
+    put_fourcc(h, "avih");
+    put32(h, 56);
+    put32(h, static_cast<uint32_t>(1e6 / rate + 0.5));  // dwMicroSecPerFrame
+    put32(h, static_cast<uint32_t>(max_frame_size * rate));
+    put32(h, 0);
+    put32(h, 0x10);  // AVIF_HASINDEX
+    put32(h, total_frames);
+    put32(h, 0);
+    put32(h, 1);  // dwStreams
+    put32(h, max_frame_size);
+    put32(h, width);
+    put32(h, height);
+    for (int i = 0; i < 4; ++i)
+    {
+      put32(h, 0);
+    }
+
+    put_fourcc(h, "LIST");
+    put32(h, 116);
+    put_fourcc(h, "strl");
+
+    put_fourcc(h, "strh");
+    put32(h, 56);
+    put_fourcc(h, "vids");
+    put_fourcc(h, "MJPG");
+    put32(h, 0);
+    put16(h, 0);
+    put16(h, 0);
+    put32(h, 0);
+    put32(h, scale);
+    put32(h, rate_scaled);
+    put32(h, 0);
+    put32(h, total_frames);  // dwLength
+    put32(h, max_frame_size);
+    put32(h, 0xffffffff);  // dwQuality: default
+    put32(h, 0);
+    put16(h, 0);
+    put16(h, 0);
+    put16(h, static_cast<uint16_t>(width));
+    put16(h, static_cast<uint16_t>(height));
+
+    put_fourcc(h, "strf");
+    put32(h, 40);
+    put32(h, 40);
+    put32(h, width);
+    put32(h, height);
+    put16(h, 1);
+    put16(h, 24);
+    put_fourcc(h, "MJPG");
+    put32(h, width * height * 3);
+    put32(h, 0);
+    put32(h, 0);
+    put32(h, 0);
+    put32(h, 0);
+
+    put_fourcc(h, "LIST");
+    put32(h, 0);  // Patched on finish.
+    put_fourcc(h, "movi");
+    return h;
+  }
+
+  std::string path;
+  struct v4l2_pix_format format;
+  double fps;
+  int segment;
+  uint32_t frames;
+  uint32_t max_frame;
+  int64_t first_ns;
+  int64_t last_ns;
+  std::vector<uint32_t> index;
+  aligned_file file;
+  timestamp_sidecar timestamps;
+};
+
+// H.264 from UVC cameras is already an Annex B byte stream with in-band SPS/PPS, so buffers are appended as-is.
+class elementary_stream_writer : public container_writer
+{
+public:
+  bool open(const std::string& path)
+  {
+    return file.open(path) && timestamps.open(path);
+  }
+
+  bool write(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t) override
+  {
+    timestamps.add(timestamp_ns);
+    return file.append(data, size);
+  }
+
+  bool finish() override
+  {
+    timestamps.close();
+    return file.close();
+  }
+
+private:
+  aligned_file file;
+  timestamp_sidecar timestamps;
+};
+
+class frame_dump_writer : public container_writer
+{
+public:
+  bool open(const std::string& path, const struct v4l2_pix_format& format)
+  {
+    return writer.open(path, format.pixelformat, format.width, format.height, format.bytesperline);
+  }
+
+  bool write(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence) override
+  {
+    return writer.write_frame(data, size, timestamp_ns, sequence);
+  }
+
+  bool finish() override
+  {
+    writer.close();
+    return true;
+  }
+
+private:
+  frame_file_writer writer;
+};
+}  // namespace
+
+recorder::recorder() : head(0), tail(0), running(false), frames_written(0), frames_dropped(0), bytes_written(0)
+{
+}
+
+recorder::~recorder()
+{
+  stop();
+}
+
+bool recorder::start(const std::string& path, const struct v4l2_pix_format& format, double fps, size_t queue_frames)
+{
+  stop();
+
+  if (format.pixelformat == V4L2_PIX_FMT_MJPEG)
+  {
+    std::unique_ptr<avi_writer> avi(new avi_writer(path, format, fps));
+    if (!avi->open())
+    {
+      return false;
+    }
+    container = std::move(avi);
+  }
+  else if (format.pixelformat == V4L2_PIX_FMT_H264)
+  {
+    std::unique_ptr<elementary_stream_writer> es(new elementary_stream_writer());
+    if (!es->open(path))
+    {
+      return false;
+    }
+    container = std::move(es);
+  }
+  else
+  {
+    std::unique_ptr<frame_dump_writer> dump(new frame_dump_writer());
+    if (!dump->open(path, format))
+    {
+      return false;
+    }
+    container = std::move(dump);
+  }
+
+  // Every slot is sized for the largest buffer the driver can hand out, so steady-state recording does not allocate.
+  slots.assign(queue_frames < 2 ? 2 : queue_frames, slot());
+  for (auto& s : slots)
+  {
+    s.data.resize(format.sizeimage);
+    s.size = 0;
+  }
+  head = 0;
+  tail = 0;
+  frames_written = 0;
+  frames_dropped = 0;
+  bytes_written = 0;
+
+  running = true;
+  writer_thread = std::thread(&recorder::writer_loop, this);
+  return true;
+}
+
+void recorder::stop()
+{
+  if (!running)
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  frame_ready.notify_one();
+  slot_free.notify_all();
+  writer_thread.join();
+
+  if (!container->finish())
+  {
+    CERR_ENDL("Recording did not finish cleanly");
+  }
+  container.reset();
+}
+
+bool recorder::recording() const
+{
+  return running;
+}
+
+bool recorder::push(const rawFrame& frame)
+{
+  return push(frame.data, frame.bytesused, frame.timestamp_ns, frame.sequence);
+}
+
+bool recorder::push(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence)
+{
+  size_t index;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running || tail - head == slots.size())
+    {
+      if (running)
+      {
+        ++frames_dropped;
+      }
+      return false;
+    }
+    index = tail % slots.size();
+  }
+
+  fill_slot(index, data, size, timestamp_ns, sequence);
+  return true;
+}
+
+bool recorder::push_wait(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence)
+{
+  size_t index;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    slot_free.wait(lock, [this]() { return !running || tail - head < slots.size(); });
+    if (!running)
+    {
+      return false;
+    }
+    index = tail % slots.size();
+  }
+
+  fill_slot(index, data, size, timestamp_ns, sequence);
+  return true;
+}
+
+void recorder::fill_slot(size_t index, const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence)
+{
+  // The slot at tail belongs to the producer until tail moves, so the copy happens outside the lock.
+  slot& s = slots[index];
+  if (s.data.size() < size)
+  {
+    s.data.resize(size);
+  }
+  memcpy(s.data.data(), data, size);
+  s.size = size;
+  s.timestamp_ns = timestamp_ns;
+  s.sequence = sequence;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++tail;
+  }
+  frame_ready.notify_one();
+}
+
+recorderStats recorder::get_stats()
+{
+  recorderStats stats;
+  stats.frames_written = frames_written;
+  stats.frames_dropped = frames_dropped;
+  stats.bytes_written = bytes_written;
+  return stats;
+}
+
+void recorder::writer_loop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;)
+  {
+    frame_ready.wait(lock, [this]() { return !running || head != tail; });
+    if (head == tail)
+    {
+      // Stopped and drained.
+      break;
+    }
+
+    slot& s = slots[head % slots.size()];
+    lock.unlock();
+
+    if (container->write(s.data.data(), s.size, s.timestamp_ns, s.sequence))
+    {
+      ++frames_written;
+      bytes_written += s.size;
+    }
+
+    lock.lock();
+    ++head;
+    slot_free.notify_one();
+  }
+}
@@ -0,0 +1,251 @@
+#include "replay_source.h"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+replay_source::replay_source()
+  : m_pacing(REPLAY_RECORDED)
+  , m_loop(false)
+  , m_fps(0)
+  , m_pass_ns(0)
+  , m_pass_start_ns(0)
+  , m_next(0)
+  , m_delivered(0)
+  , m_sequence_base(0)
+  , m_deadline_ns(0)
+  , m_finished(false)
+  , m_timer_fd(-1)
+{
+}
+
+replay_source::~replay_source()
+{
+  stop_stream();
+}
+
+void replay_source::set_pacing(replayPacing pacing)
+{
+  m_pacing = pacing;
+}
+
+void replay_source::set_loop(bool loop)
+{
+  m_loop = loop;
+}
+
+bool replay_source::parse_pacing(const std::string& text, replayPacing& pacing)
+{
+  if (text == "recorded")
+  {
+    pacing = REPLAY_RECORDED;
+  }
+  else if (text == "fps")
+  {
+    pacing = REPLAY_FIXED_FPS;
+  }
+  else if (text == "max")
+  {
+    pacing = REPLAY_UNTHROTTLED;
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+bool replay_source::open_stream(const m_deviceConfig& config)
+{
+  if (!m_file.open(config.path))
+  {
+    return false;
+  }
+
+  const std::vector<frameFileEntry>& frames = m_file.frames();
+  if (frames.empty())
+  {
+    CERR_ENDL("Frame file has no frames: " << config.path);
+    m_file.close();
+    return false;
+  }
+
+  m_fps = config.fps;
+  if (m_pacing == REPLAY_FIXED_FPS && !(m_fps > 0))
+  {
+    CERR_ENDL("Fixed rate replay needs a frame rate above 0");
+    m_file.close();
+    return false;
+  }
+
+  const frameFileHeader& header = m_file.header();
+  if (!frame_decoder::supported(header.fourcc))
+  {
+    CERR_ENDL("Frame file has an unsupported pixel format: " << config.path);
+  }
+
+  // Driver clocks can step backwards across a restart; such frames are due together with the one before.
+  m_offsets.resize(frames.size());
+  size_t largest = 0;
+  for (size_t i = 0; i < frames.size(); ++i)
+  {
+    int64_t offset = frames[i].timestamp_ns - frames[0].timestamp_ns;
+    m_offsets[i] = i > 0 && offset < m_offsets[i - 1] ? m_offsets[i - 1] : offset;
+    largest = frames[i].size > largest ? frames[i].size : largest;
+  }
+  int64_t interval_ns = frames.size() > 1 ? m_offsets.back() / static_cast<int64_t>(frames.size() - 1) :
+                                            (m_fps > 0 ? static_cast<int64_t>(1e9 / m_fps) : 0);
+  m_pass_ns = m_offsets.back() + interval_ns;
+  if (m_loop && m_pacing == REPLAY_RECORDED && m_pass_ns <= 0)
+  {
+    // Every pass would be due at once and the loop would spin; a one-frame file needs config.fps to space it.
+    CERR_ENDL("Frame file has no recorded duration to loop at: " << config.path);
+    m_file.close();
+    return false;
+  }
+
+  m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (m_timer_fd == -1)
+  {
+    CERR_ENDL("Failed to create replay timer: " << strerror(errno));
+    m_file.close();
+    return false;
+  }
+
+  struct v4l2_pix_format format;
+  memset(&format, 0, sizeof(format));
+  format.width = header.width;
+  format.height = header.height;
+  format.pixelformat = header.fourcc;
+  format.field = V4L2_FIELD_NONE;
+  format.bytesperline = header.bytesperline;
+  format.sizeimage = largest;
+  begin_stream(format);
+
+  m_next = 0;
+  m_delivered = 0;
+  m_sequence_base = 0;
+  m_finished = false;
+  m_pass_start_ns = monotonic_ns();
+  m_deadline_ns = next_deadline();
+  if (!arm_timer(m_deadline_ns))
+  {
+    close(m_timer_fd);
+    m_timer_fd = -1;
+    m_file.close();
+    return false;
+  }
+
+  streaming = true;
+  return true;
+}
+
+int replay_source::device_fd() const
+{
+  return m_timer_fd;
+}
+
+bool replay_source::service(short revents)
+{
+  if (revents & (POLLERR | POLLHUP | POLLNVAL))
+  {
+    CERR_ENDL("Replay timer reported an error, stopping replay");
+    return false;
+  }
+  if (!(revents & POLLIN))
+  {
+    return true;
+  }
+
+  uint64_t expirations;
+  if (read(m_timer_fd, &expirations, sizeof(expirations)) == -1)
+  {
+    if (errno == EAGAIN)
+    {
+      return true;
+    }
+    CERR_ENDL("Failed to read replay timer: " << strerror(errno));
+    return false;
+  }
+
+  const std::vector<frameFileEntry>& frames = m_file.frames();
+  const frameFileEntry& entry = frames[m_next];
+
+  rawFrame raw;
+  raw.data = entry.data;
+  raw.bytesused = entry.size;
+  raw.index = static_cast<uint32_t>(m_next);
+  raw.dmabuf_fd = -1;
+  raw.sequence = m_sequence_base + (entry.sequence - frames[0].sequence);
+  raw.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+  raw.dequeue_ns = monotonic_ns();
+  // Stamped with when the frame was due, like a driver stamps capture time; latency then includes timer slack.
+  raw.timestamp_ns = m_pacing == REPLAY_UNTHROTTLED ? raw.dequeue_ns : m_deadline_ns;
+  deliver(raw);
+
+  ++m_delivered;
+  if (++m_next == frames.size())
+  {
+    if (!m_loop)
+    {
+      COUT_ENDL("Replay finished after " << m_delivered << " frames");
+      m_finished = true;
+      return false;
+    }
+    m_next = 0;
+    m_sequence_base = raw.sequence + 1;
+    // Fixed rate deadlines count every frame delivered since the stream started, so only recorded pacing restarts
+    // its clock for the next pass.
+    if (m_pacing == REPLAY_RECORDED)
+    {
+      m_pass_start_ns += m_pass_ns;
+    }
+  }
+
+  m_deadline_ns = next_deadline();
+  return arm_timer(m_deadline_ns);
+}
+
+int64_t replay_source::next_deadline() const
+{
+  switch (m_pacing)
+  {
+    case REPLAY_RECORDED:
+      return m_pass_start_ns + m_offsets[m_next];
+    case REPLAY_FIXED_FPS:
+      // From the frame count rather than by adding up intervals, so rounding never accumulates.
+      return m_pass_start_ns + static_cast<int64_t>(m_delivered * (1e9 / m_fps));
+    case REPLAY_UNTHROTTLED:
+      break;
+  }
+  return 0;
+}
+
+bool replay_source::arm_timer(int64_t deadline_ns)
+{
+  // An absolute deadline that has already passed fires at once; a zero it_value would disarm the timer instead.
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = deadline_ns > 0 ? deadline_ns / 1000000000LL : 0;
+  spec.it_value.tv_nsec = deadline_ns > 0 ? deadline_ns % 1000000000LL : 1;
+  if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1)
+  {
+    CERR_ENDL("Failed to arm replay timer: " << strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool replay_source::finished() const
+{
+  return m_finished;
+}
+
+void replay_source::close_stream()
+{
+  m_file.close();
+  close(m_timer_fd);
+  m_timer_fd = -1;
+}
@@ -0,0 +1,160 @@
+#include "shm_publisher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include "debug.h"
+
+shm_publisher::shm_publisher()
+  : ring(nullptr), mapping_size(0), published(0), frames_published(0), frames_oversized(0)
+{
+  memset(&pix_format, 0, sizeof(pix_format));
+}
+
+shm_publisher::~shm_publisher()
+{
+  close();
+}
+
+bool shm_publisher::open(const std::string& name, const struct v4l2_pix_format& format, size_t slot_count)
+{
+  close();
+  if (name.empty() || name[0] != '/' || name.find('/', 1) != std::string::npos || slot_count == 0)
+  {
+    CERR_ENDL("Invalid shared memory name: " << name);
+    return false;
+  }
+
+  // Compressed formats report the largest buffer the driver can deliver in sizeimage.
+  size_t slot_size = format.sizeimage ? format.sizeimage : static_cast<size_t>(format.bytesperline) * format.height;
+  size_t slot_stride = (shmFrameSlot::HEADER_SIZE + slot_size + PAGE - 1) / PAGE * PAGE;
+  size_t size = PAGE + slot_count * slot_stride;
+
+  // A previous ring under this name may still be mapped by readers; unlinking leaves their mapping intact and gives
+  // this stream a fresh object with its own layout.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd == -1)
+  {
+    CERR_ENDL("Failed to create shared memory " << name << ": " << strerror(errno));
+    return false;
+  }
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+  {
+    mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int error = errno;
+  ::close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    CERR_ENDL("Failed to map shared memory " << name << ": " << strerror(error));
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // The object is zero-filled, so every slot starts with an even lock and published = 0.
+  ring = new (mapping) shmFrameRingHeader();
+  ring->version = shmFrameRingHeader::VERSION;
+  ring->slot_count = static_cast<uint32_t>(slot_count);
+  ring->slot_size = slot_size;
+  ring->slot_stride = slot_stride;
+  ring->data_offset = PAGE;
+  ring->published.store(0, std::memory_order_relaxed);
+  ring->closed.store(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < slot_count; ++i)
+  {
+    new (slot_at(i)) shmFrameSlot();
+  }
+  // Readers check the magic first, so it goes in last.
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(ring->magic, "V4L2SHM1", 8);
+
+  shm_name = name;
+  mapping_size = size;
+  pix_format = format;
+  published = 0;
+  frames_published = 0;
+  frames_oversized = 0;
+  COUT_ENDL("Publishing frames to shared memory " << name << " (" << slot_count << " x " << slot_size << " bytes)");
+  return true;
+}
+
+void shm_publisher::close()
+{
+  if (ring == nullptr)
+  {
+    return;
+  }
+  ring->closed.store(1, std::memory_order_release);
+  munmap(ring, mapping_size);
+  shm_unlink(shm_name.c_str());
+  ring = nullptr;
+  mapping_size = 0;
+  shm_name.clear();
+}
+
+bool shm_publisher::is_open() const
+{
+  return ring != nullptr;
+}
+
+const std::string& shm_publisher::name() const
+{
+  return shm_name;
+}
+
+shmFrameSlot* shm_publisher::slot_at(uint64_t index) const
+{
+  return reinterpret_cast<shmFrameSlot*>(reinterpret_cast<uint8_t*>(ring) + ring->data_offset +
+                                         index * ring->slot_stride);
+}
+
+bool shm_publisher::publish(const rawFrame& frame)
+{
+  return publish(frame.data, frame.bytesused, frame.timestamp_ns, frame.sequence);
+}
+
+bool shm_publisher::publish(const uint8_t* data, size_t size, int64_t timestamp_ns, uint32_t sequence)
+{
+  if (ring == nullptr)
+  {
+    return false;
+  }
+  if (size > ring->slot_size)
+  {
+    ++frames_oversized;
+    return false;
+  }
+
+  shmFrameSlot* slot = slot_at(published % ring->slot_count);
+
+  // Sequence lock: odd while the slot is being written, so readers of the previous frame in it can tell.
+  uint64_t lock = slot->lock.load(std::memory_order_relaxed);
+  slot->lock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->frame_number.store(published + 1, std::memory_order_relaxed);
+  slot->timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+  slot->sequence.store(sequence, std::memory_order_relaxed);
+  slot->fourcc.store(pix_format.pixelformat, std::memory_order_relaxed);
+  slot->width.store(pix_format.width, std::memory_order_relaxed);
+  slot->height.store(pix_format.height, std::memory_order_relaxed);
+  slot->bytesperline.store(pix_format.bytesperline, std::memory_order_relaxed);
+  slot->bytesused.store(static_cast<uint32_t>(size), std::memory_order_relaxed);
+  memcpy(reinterpret_cast<uint8_t*>(slot) + shmFrameSlot::HEADER_SIZE, data, size);
+
+  slot->lock.store(lock + 2, std::memory_order_release);
+  ring->published.store(++published, std::memory_order_release);
+  ++frames_published;
+  return true;
+}
+
+shmPublisherStats shm_publisher::get_stats() const
+{
+  shmPublisherStats stats;
+  stats.frames_published = frames_published;
+  stats.frames_oversized = frames_oversized;
+  return stats;
+}
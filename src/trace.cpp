@@ -0,0 +1,206 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "debug.h"
+
+std::atomic<bool> tracer::is_enabled(true);
+thread_local traceRing* tracer::local_ring = nullptr;
+thread_local int32_t tracer::local_tid = 0;
+
+namespace
+{
+// Hands the thread's ring back when the thread exits, so short-lived threads (one per stream) do not each keep 512
+// KiB. The spans stay in the ring until a new thread overwrites them.
+struct ringRelease
+{
+  traceRing* ring = nullptr;
+
+  ~ringRelease()
+  {
+    if (ring != nullptr)
+    {
+      ring->in_use.store(false, std::memory_order_release);
+    }
+  }
+};
+
+thread_local ringRelease ring_release;
+
+struct dumpedEvent
+{
+  const char* name;
+  int64_t begin_ns;
+  int64_t end_ns;
+  int32_t tid;
+};
+
+void write_json_string(std::FILE* file, const char* text)
+{
+  std::fputc('"', file);
+  for (const char* p = text; *p != '\0'; ++p)
+  {
+    if (*p == '"' || *p == '\\')
+    {
+      std::fputc('\\', file);
+    }
+    if (static_cast<unsigned char>(*p) >= 0x20)
+    {
+      std::fputc(*p, file);
+    }
+  }
+  std::fputc('"', file);
+}
+}  // namespace
+
+tracer::tracer()
+{
+}
+
+tracer& tracer::instance()
+{
+  static tracer* trace = new tracer();
+  return *trace;
+}
+
+void tracer::set_enabled(bool enabled)
+{
+  is_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void tracer::set_thread_name(const char* name)
+{
+  if (local_ring == nullptr)
+  {
+    instance().attach_thread();
+  }
+  std::lock_guard<std::mutex> lock(instance().mutex);
+  instance().thread_names[local_tid] = name;
+}
+
+traceRing* tracer::attach_thread()
+{
+  local_tid = static_cast<int32_t>(syscall(SYS_gettid));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  traceRing* ring = nullptr;
+  for (traceRing* candidate : rings)
+  {
+    bool idle = false;
+    if (candidate->in_use.compare_exchange_strong(idle, true, std::memory_order_acq_rel))
+    {
+      ring = candidate;
+      break;
+    }
+  }
+  if (ring == nullptr)
+  {
+    // Zero-initialized: no spans yet.
+    ring = new traceRing();
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->in_use.store(true, std::memory_order_relaxed);
+    rings.push_back(ring);
+  }
+
+  local_ring = ring;
+  ring_release.ring = ring;
+  return ring;
+}
+
+bool tracer::dump(const std::string& path)
+{
+  std::vector<dumpedEvent> events;
+  std::map<int32_t, std::string> names;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    names = thread_names;
+    for (traceRing* ring : rings)
+    {
+      uint64_t end = ring->head.load(std::memory_order_acquire);
+      uint64_t begin = end > traceRing::RING_EVENTS ? end - traceRing::RING_EVENTS : 0;
+      size_t first = events.size();
+      for (uint64_t i = begin; i < end; ++i)
+      {
+        const traceEvent& event = ring->events[i & (traceRing::RING_EVENTS - 1)];
+        dumpedEvent copy = { event.name.load(std::memory_order_relaxed),
+                             event.begin_ns.load(std::memory_order_relaxed),
+                             event.end_ns.load(std::memory_order_relaxed), event.tid.load(std::memory_order_relaxed) };
+        events.push_back(copy);
+      }
+
+      // The owner kept writing while we copied: drop whatever it may have overwritten, including the slot of a span
+      // it is writing right now.
+      uint64_t now = ring->head.load(std::memory_order_acquire);
+      uint64_t valid_from = now + 1 > traceRing::RING_EVENTS ? now + 1 - traceRing::RING_EVENTS : 0;
+      if (valid_from > begin)
+      {
+        size_t overwritten = static_cast<size_t>(std::min<uint64_t>(valid_from - begin, end - begin));
+        events.erase(events.begin() + first, events.begin() + first + overwritten);
+      }
+    }
+  }
+
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (file == nullptr)
+  {
+    CERR_ENDL("Failed to write trace " << path << ": " << strerror(errno));
+    return false;
+  }
+
+  int pid = static_cast<int>(getpid());
+  std::fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  bool first = true;
+  for (const auto& name : names)
+  {
+    std::fprintf(file, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+                 first ? "" : ",\n", pid, name.first);
+    write_json_string(file, name.second.c_str());
+    std::fprintf(file, "}}");
+    first = false;
+  }
+  for (const dumpedEvent& event : events)
+  {
+    if (event.name == nullptr)
+    {
+      continue;
+    }
+    std::fprintf(file, "%s{\"ph\": \"X\", \"name\": ", first ? "" : ",\n");
+    write_json_string(file, event.name);
+    std::fprintf(file, ", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", pid, event.tid,
+                 event.begin_ns / 1e3, (event.end_ns - event.begin_ns) / 1e3);
+    first = false;
+  }
+  std::fprintf(file, "\n]}\n");
+  bool ok = std::fclose(file) == 0;
+  if (ok)
+  {
+    COUT_ENDL("Wrote " << events.size() << " trace spans to " << path);
+  }
+  return ok;
+}
+
+void tracer::dump_at_exit(const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (exit_path.empty())
+  {
+    std::atexit(&tracer::dump_exit_handler);
+  }
+  exit_path = path;
+}
+
+void tracer::dump_exit_handler()
+{
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(instance().mutex);
+    path = instance().exit_path;
+  }
+  instance().dump(path);
+}
@@ -1,63 +1,29 @@
 #include "usb_camera.h"
-
-usb_cam::usb_cam() : streaming(false), m_fd(-1)
+#include "device_registry.h"
+#include "trace.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+usb_cam::usb_cam() : m_memory(MEMORY_MMAP), m_fd(-1)
 {
 }
 
 usb_cam::~usb_cam()
 {
+  stop_stream();
 }
 
 std::vector<deviceData> usb_cam::find_device()
 {
-  std::vector<deviceData> devices;
-  std::string videoPath = "/dev/";
-  std::regex videoRegex("video[0-9]+");
-
-  DIR* dir = opendir(videoPath.c_str());
-  if (dir == nullptr)
-  {
-    CERR_ENDL("Failed to open /dev directory");
-    return devices;
-  }
-
-  struct dirent* entry;
-  while ((entry = readdir(dir)) != nullptr)
-  {
-    std::string filename(entry->d_name);
-
-    if (std::regex_match(filename, videoRegex))
-    {
-      std::string devicePath = videoPath + filename;
-
-      int m_fd = open(devicePath.c_str(), O_RDWR | O_NONBLOCK);
-      if (m_fd == -1)
-      {
-        CERR_ENDL("Failed to open device: " << devicePath);
-        std::cerr << "Failed to open device: " << devicePath << std::endl;
-        continue;
-      }
-
-      struct v4l2_capability cap;
-      if (ioctl(m_fd, VIDIOC_QUERYCAP, &cap) == -1)
-      {
-        CERR_ENDL("Failed to query device capabilities: " << devicePath);
-        close(m_fd);
-        continue;
-      }
-
-      deviceData device;
-      device.path = devicePath;
-      device.device_name = std::string((char*)cap.card);
-
-      devices.push_back(device);
-
-      close(m_fd);
-    }
-  }
-
-  closedir(dir);
-  return devices;
+  return device_registry::enumerate();
 }
 
 int usb_cam::xioctl(int fd, int request, void* arg)
@@ -70,6 +36,32 @@ int usb_cam::xioctl(int fd, int request, void* arg)
   return r;
 }
 
+bool usb_cam::query_identity(int fd, const std::string& devicePath, deviceIdentity& identity)
+{
+  struct v4l2_capability cap;
+  if (xioctl(fd, VIDIOC_QUERYCAP, &cap) == -1)
+  {
+    CERR_ENDL("Failed to get device capabilities. Error: " << strerror(errno));
+    return false;
+  }
+
+  identity.driver = (char*)cap.driver;
+  identity.bus_info = (char*)cap.bus_info;
+  identity.card = (char*)cap.card;
+  identity.version = cap.version;
+
+  // The firmware revision of a USB camera is its bcdDevice, next to the interface the video node hangs off.
+  char resolved[PATH_MAX];
+  if (realpath(devicePath.c_str(), resolved) != nullptr)
+  {
+    std::string name(resolved);
+    name = name.substr(name.rfind('/') + 1);
+    std::ifstream bcd(("/sys/class/video4linux/" + name + "/device/../bcdDevice").c_str());
+    std::getline(bcd, identity.firmware);
+  }
+  return true;
+}
+
 m_deviceInfo usb_cam::get_device_info(const std::string& devicePath)
 {
   m_deviceInfo devInfo;
@@ -81,75 +73,131 @@ m_deviceInfo usb_cam::get_device_info(const std::string& devicePath)
     return devInfo;
   }
 
-  struct v4l2_capability cap;
-  if (xioctl(fd, VIDIOC_QUERYCAP, &cap) == -1)
+  deviceIdentity identity;
+  if (!query_identity(fd, devicePath, identity))
   {
-    CERR_ENDL("Failed to get device capabilities. Error: " << strerror(errno));
     close(fd);
     return devInfo;
   }
 
-  devInfo.device_name = (char*)cap.card;
-  devInfo.driver = (char*)cap.driver;
-  devInfo.bus_info = (char*)cap.bus_info;
-
-  struct v4l2_fmtdesc fmt;
-  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  fmt.index = 0;
+  devInfo.device_name = identity.card;
+  devInfo.driver = identity.driver;
+  devInfo.bus_info = identity.bus_info;
+  devInfo.version = identity.version;
 
-  while (xioctl(fd, VIDIOC_ENUM_FMT, &fmt) != -1)
+  // Enumerating sizes round-trips to the camera for every entry, so only do it for devices we have not seen.
+  if (!m_capabilities.lookup_formats(identity, devInfo.format_info))
   {
-    devInfo.formats.push_back((char*)fmt.description);
+    struct v4l2_fmtdesc fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    struct v4l2_frmsizeenum frmsize;
-    frmsize.pixel_format = fmt.pixelformat;
-    frmsize.index = 0;
-
-    while (xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmsize) != -1)
+    while (xioctl(fd, VIDIOC_ENUM_FMT, &fmt) != -1)
     {
-      ResolutionInfo resInfo;
-      if (frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
-      {
-        resInfo.resolution = std::make_pair(frmsize.discrete.width, frmsize.discrete.height);
+      FormatInfo format;
+      format.fourcc = fmt.pixelformat;
+      format.description = (char*)fmt.description;
 
-        struct v4l2_frmivalenum frmival;
-        frmival.pixel_format = fmt.pixelformat;
-        frmival.width = frmsize.discrete.width;
-        frmival.height = frmsize.discrete.height;
-        frmival.index = 0;
+      struct v4l2_frmsizeenum frmsize;
+      memset(&frmsize, 0, sizeof(frmsize));
+      frmsize.pixel_format = fmt.pixelformat;
 
-        while (xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival) != -1)
+      while (xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmsize) != -1)
+      {
+        if (frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
         {
-          if (frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
-          {
-            float fps = (float)frmival.discrete.denominator / frmival.discrete.numerator;
-            resInfo.fps.push_back(fps);
-          }
-          frmival.index++;
+          format.sizes.push_back(std::make_pair(frmsize.discrete.width, frmsize.discrete.height));
+          frmsize.index++;
+          continue;
         }
 
-        if (!resInfo.fps.empty())
-        {
-          devInfo.resolution_info.push_back(resInfo);
-        }
+        // Stepwise and continuous ranges are reported once, at index 0.
+        format.size_type = frmsize.type;
+        format.stepwise = frmsize.stepwise;
+        break;
       }
-      frmsize.index++;
+
+      devInfo.format_info.push_back(format);
+      fmt.index++;
     }
 
-    fmt.index++;
+    m_capabilities.store_formats(identity, devInfo.format_info);
+  }
+
+  for (const auto& format : devInfo.format_info)
+  {
+    devInfo.formats.push_back(format.description);
   }
 
   close(fd);
   return devInfo;
 }
 
-void usb_cam::start_stream(const m_deviceConfig& config)
+std::vector<float> usb_cam::get_frame_rates(const std::string& devicePath, uint32_t fourcc, int width, int height)
+{
+  std::vector<float> rates;
+
+  int fd = open(devicePath.c_str(), O_RDWR);
+  if (fd == -1)
+  {
+    CERR_ENDL("Failed to open device: " << devicePath);
+    return rates;
+  }
+
+  deviceIdentity identity;
+  if (!query_identity(fd, devicePath, identity) || m_capabilities.lookup_rates(identity, fourcc, width, height, rates))
+  {
+    close(fd);
+    return rates;
+  }
+
+  struct v4l2_frmivalenum frmival;
+  memset(&frmival, 0, sizeof(frmival));
+  frmival.pixel_format = fourcc;
+  frmival.width = width;
+  frmival.height = height;
+
+  while (xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival) != -1)
+  {
+    if (frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+    {
+      rates.push_back((float)frmival.discrete.denominator / frmival.discrete.numerator);
+      frmival.index++;
+      continue;
+    }
+
+    // A stepwise or continuous interval range: offer the common rates it covers plus both ends.
+    float max_fps = (float)frmival.stepwise.min.denominator / frmival.stepwise.min.numerator;
+    float min_fps = (float)frmival.stepwise.max.denominator / frmival.stepwise.max.numerator;
+    static const float common[] = { 120, 90, 60, 50, 30, 25, 24, 20, 15, 10, 5 };
+    rates.push_back(max_fps);
+    for (float fps : common)
+    {
+      if (fps < max_fps && fps > min_fps)
+      {
+        rates.push_back(fps);
+      }
+    }
+    if (min_fps < max_fps)
+    {
+      rates.push_back(min_fps);
+    }
+    break;
+  }
+
+  close(fd);
+  m_capabilities.store_rates(identity, fourcc, width, height, rates);
+  return rates;
+}
+
+bool usb_cam::open_stream(const m_deviceConfig& config)
 {
-  m_fd = open(config.path.c_str(), O_RDWR);
+  // Non-blocking so the capture thread only ever waits in poll(), where a stop request can wake it.
+  m_fd = open(config.path.c_str(), O_RDWR | O_NONBLOCK);
   if (m_fd == -1)
   {
     CERR_ENDL("Failed to open device: " << config.path);
-    return;
+    return false;
   }
 
   // Set video format
@@ -159,7 +207,11 @@ void usb_cam::start_stream(const m_deviceConfig& config)
   fmt.fmt.pix.width = config.resolution.first;
   fmt.fmt.pix.height = config.resolution.second;
 
-  if (config.format == "MJPEG" || config.format == "Motion-JPEG")
+  if (config.fourcc != 0)
+  {
+    fmt.fmt.pix.pixelformat = config.fourcc;
+  }
+  else if (config.format == "MJPEG" || config.format == "Motion-JPEG")
   {
     fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
   }
@@ -191,11 +243,17 @@ void usb_cam::start_stream(const m_deviceConfig& config)
   {
     fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YVYU;
   }
+  else if (config.format.size() == 4)
+  {
+    // Any other fourcc code, e.g. "MJPG" or "RGBP".
+    fmt.fmt.pix.pixelformat = v4l2_fourcc(config.format[0], config.format[1], config.format[2], config.format[3]);
+  }
   else
   {
     CERR_ENDL("Unsupported format: " << config.format);
     close(m_fd);
-    return;
+    m_fd = -1;
+    return false;
   }
 
   fmt.fmt.pix.field = V4L2_FIELD_INTERLACED;
@@ -204,150 +262,326 @@ void usb_cam::start_stream(const m_deviceConfig& config)
   {
     CERR_ENDL("Failed to set format");
     close(m_fd);
-    return;
+    m_fd = -1;
+    return false;
+  }
+
+  // The driver may adjust the size, stride or even the format, so decode with what it actually picked.
+  begin_stream(fmt.fmt.pix);
+  if (!frame_decoder::supported(m_pixfmt.pixelformat))
+  {
+    CERR_ENDL("Driver selected an unsupported pixel format for: " << config.format);
   }
 
   // Set frame rate
   struct v4l2_streamparm streamparm;
   memset(&streamparm, 0, sizeof(streamparm));
   streamparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  streamparm.parm.capture.timeperframe.numerator = 1;
-  streamparm.parm.capture.timeperframe.denominator = static_cast<int>(config.fps);
+  // In milliframes so NTSC rates such as 29.97 survive; the driver picks the nearest interval it supports.
+  streamparm.parm.capture.timeperframe.numerator = 1000;
+  streamparm.parm.capture.timeperframe.denominator = static_cast<int>(config.fps * 1000 + 0.5f);
 
   if (xioctl(m_fd, VIDIOC_S_PARM, &streamparm) == -1)
   {
     CERR_ENDL("Failed to set frame rate");
     close(m_fd);
-    return;
+    m_fd = -1;
+    return false;
   }
 
+  if (!init_buffers(config))
+  {
+    release_buffers();
+    close(m_fd);
+    m_fd = -1;
+    return false;
+  }
+
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (xioctl(m_fd, VIDIOC_STREAMON, &type) == -1)
+  {
+    CERR_ENDL("Failed to start streaming");
+    release_buffers();
+    close(m_fd);
+    m_fd = -1;
+    return false;
+  }
+
+  load_controls();
+  subscribe_events();
+  streaming = true;
+  return true;
+}
+
+bool usb_cam::init_buffers(const m_deviceConfig& config)
+{
+  m_memory = config.memory;
+  uint32_t v4l2_memory = m_memory == MEMORY_USERPTR ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+
   struct v4l2_requestbuffers req;
   memset(&req, 0, sizeof(req));
-  req.count = 4;
+  req.count = config.buffer_count < MIN_BUFFER_COUNT ? MIN_BUFFER_COUNT : config.buffer_count;
+  req.count = req.count > MAX_BUFFER_COUNT ? MAX_BUFFER_COUNT : req.count;
   req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  req.memory = V4L2_MEMORY_MMAP;
+  req.memory = v4l2_memory;
 
   if (xioctl(m_fd, VIDIOC_REQBUFS, &req) == -1)
   {
-    CERR_ENDL("Failed to request buffers");
-    close(m_fd);
-    return;
+    CERR_ENDL("Failed to request buffers: " << strerror(errno));
+    return false;
   }
 
-  buffers.resize(req.count);
-  buffer_lengths.resize(req.count);
+  // The driver may grant a different count than requested.
+  buffers.assign(req.count, nullptr);
+  buffer_lengths.assign(req.count, 0);
+  dmabuf_fds.assign(req.count, -1);
+
+  const size_t page_size = sysconf(_SC_PAGESIZE);
 
-  for (int i = 0; i < req.count; ++i)
+  for (uint32_t i = 0; i < req.count; ++i)
   {
     struct v4l2_buffer buf;
     memset(&buf, 0, sizeof(buf));
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
+    buf.memory = v4l2_memory;
     buf.index = i;
 
-    if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1)
+    if (m_memory == MEMORY_USERPTR)
     {
-      CERR_ENDL("Failed to query buffer");
-      close(m_fd);
-      return;
+      // Our own page-aligned pool; the driver DMAs straight into it.
+      size_t length = (m_pixfmt.sizeimage + page_size - 1) / page_size * page_size;
+      if (posix_memalign(&buffers[i], page_size, length) != 0)
+      {
+        buffers[i] = nullptr;
+        CERR_ENDL("Failed to allocate user pointer buffer");
+        return false;
+      }
+      buffer_lengths[i] = length;
+      buf.m.userptr = reinterpret_cast<unsigned long>(buffers[i]);
+      buf.length = length;
     }
+    else
+    {
+      if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1)
+      {
+        CERR_ENDL("Failed to query buffer");
+        return false;
+      }
 
-    buffers[i] = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
-    buffer_lengths[i] = buf.length;
+      void* data = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+      if (data == MAP_FAILED)
+      {
+        CERR_ENDL("Failed to map buffer");
+        return false;
+      }
+      buffers[i] = data;
+      buffer_lengths[i] = buf.length;
 
-    if (buffers[i] == MAP_FAILED)
-    {
-      CERR_ENDL("Failed to map buffer");
-      close(m_fd);
-      return;
+      if (m_memory == MEMORY_DMABUF)
+      {
+        struct v4l2_exportbuffer expbuf;
+        memset(&expbuf, 0, sizeof(expbuf));
+        expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        expbuf.index = i;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+        if (xioctl(m_fd, VIDIOC_EXPBUF, &expbuf) == -1)
+        {
+          CERR_ENDL("Failed to export buffer as DMABUF: " << strerror(errno));
+          return false;
+        }
+        dmabuf_fds[i] = expbuf.fd;
+      }
     }
 
     if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1)
     {
       CERR_ENDL("Failed to queue buffer");
-      close(m_fd);
-      return;
+      return false;
     }
   }
 
-  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  if (xioctl(m_fd, VIDIOC_STREAMON, &type) == -1)
+  return true;
+}
+
+void usb_cam::release_buffers()
+{
+  for (size_t i = 0; i < buffers.size(); ++i)
   {
-    CERR_ENDL("Failed to start streaming");
-    close(m_fd);
-    return;
+    if (dmabuf_fds[i] != -1)
+    {
+      close(dmabuf_fds[i]);
+    }
+    if (buffers[i] == nullptr)
+    {
+      continue;
+    }
+    if (m_memory == MEMORY_USERPTR)
+    {
+      free(buffers[i]);
+    }
+    else
+    {
+      munmap(buffers[i], buffer_lengths[i]);
+    }
   }
 
-  streaming = true;
+  buffers.clear();
+  buffer_lengths.clear();
+  dmabuf_fds.clear();
 
-  stream_thread = std::thread([this, config]() {
-    while (streaming)
-    {
-      struct v4l2_buffer buf;
-      memset(&buf, 0, sizeof(buf));
-      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory = V4L2_MEMORY_MMAP;
+  if (m_fd != -1)
+  {
+    // Give the buffers back to the driver so the next REQBUFS can pick a different count or memory type.
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = m_memory == MEMORY_USERPTR ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+    xioctl(m_fd, VIDIOC_REQBUFS, &req);
+  }
+}
 
-      if (xioctl(m_fd, VIDIOC_DQBUF, &buf) == -1)
-      {
-        CERR_ENDL("Failed to dequeue buffer");
-        break;
-      }
+int usb_cam::device_fd() const
+{
+  return m_fd;
+}
 
-      cv::Mat img(cv::Size(config.resolution.first, config.resolution.second), CV_8UC3);
-      img = cv::imdecode(cv::Mat(1, buf.bytesused, CV_8UC1, buffers[buf.index]), cv::IMREAD_COLOR);
-      m_image = img.clone();
+bool usb_cam::service(short revents)
+{
+  if (revents & (POLLERR | POLLHUP | POLLNVAL))
+  {
+    CERR_ENDL("Device reported an error, stopping capture");
+    return false;
+  }
 
-      if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1)
-      {
-        CERR_ENDL("Failed to queue buffer");
-        break;
-      }
-    }
+  if ((revents & POLLPRI) && !handle_events())
+  {
+    return false;
+  }
 
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    xioctl(m_fd, VIDIOC_STREAMOFF, &type);
-    close(m_fd);
-  });
+  if ((revents & POLLIN) && !dequeue_frame())
+  {
+    return false;
+  }
+  return true;
 }
 
-void usb_cam::stop_stream()
+bool usb_cam::dequeue_frame()
 {
-  if (!streaming)
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = m_memory == MEMORY_USERPTR ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+
+  int dequeued;
+  {
+    TRACE_SCOPE("DQBUF");
+    dequeued = xioctl(m_fd, VIDIOC_DQBUF, &buf);
+  }
+  if (dequeued == -1)
   {
-    return;
+    if (errno == EAGAIN)
+    {
+      return true;
+    }
+    CERR_ENDL("Failed to dequeue buffer: " << strerror(errno));
+    return false;
   }
 
-  streaming = false;
+  if (buf.index >= buffers.size())
+  {
+    CERR_ENDL("Driver returned an unknown buffer index: " << buf.index);
+    return false;
+  }
+
+  rawFrame raw;
+  raw.data = static_cast<const uint8_t*>(buffers[buf.index]);
+  raw.bytesused = buf.bytesused;
+  raw.index = buf.index;
+  raw.dmabuf_fd = dmabuf_fds[buf.index];
+  raw.sequence = buf.sequence;
+  raw.flags = buf.flags;
+  raw.timestamp_ns = static_cast<int64_t>(buf.timestamp.tv_sec) * 1000000000LL + buf.timestamp.tv_usec * 1000LL;
+  raw.dequeue_ns = monotonic_ns();
+  deliver(raw);
 
-  if (stream_thread.joinable())
+  int queued;
   {
-    stream_thread.join();
+    TRACE_SCOPE("QBUF");
+    queued = xioctl(m_fd, VIDIOC_QBUF, &buf);
+  }
+  if (queued == -1)
+  {
+    CERR_ENDL("Failed to queue buffer: " << strerror(errno));
+    return false;
   }
+  return true;
+}
 
-  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  if (xioctl(m_fd, VIDIOC_STREAMOFF, &type) == -1)
+void usb_cam::subscribe_events()
+{
+  struct v4l2_event_subscription sub;
+  memset(&sub, 0, sizeof(sub));
+  sub.type = V4L2_EVENT_SOURCE_CHANGE;
+  if (xioctl(m_fd, VIDIOC_SUBSCRIBE_EVENT, &sub) == -1)
   {
-    CERR_ENDL("Failed to stop streaming");
+    COUT_ENDL("Source change events are not supported by this device");
   }
 
-  for (size_t i = 0; i < buffers.size(); ++i)
+  // Control events are per control, so subscribe to every control the device exposes.
+  for (const auto& control : m_controls)
   {
-    if (buffers[i] != MAP_FAILED)
+    if (!(control.flags & V4L2_CTRL_FLAG_DISABLED))
     {
-      munmap(buffers[i], buffer_lengths[i]);
+      memset(&sub, 0, sizeof(sub));
+      sub.type = V4L2_EVENT_CTRL;
+      sub.id = control.id;
+      xioctl(m_fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
     }
   }
+}
 
-  buffers.clear();
-  buffer_lengths.clear();
-  m_image.release();
+bool usb_cam::handle_events()
+{
+  struct v4l2_event ev;
+  memset(&ev, 0, sizeof(ev));
+  while (xioctl(m_fd, VIDIOC_DQEVENT, &ev) == 0)
+  {
+    if (m_event_callback)
+    {
+      m_event_callback(ev);
+    }
 
-  if (m_fd != -1)
+    if (ev.type == V4L2_EVENT_SOURCE_CHANGE && (ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION))
+    {
+      // The negotiated format is no longer valid; the owner has to restart the stream.
+      COUT_ENDL("Source resolution changed, stopping capture");
+      return false;
+    }
+
+    if (ev.pending == 0)
+    {
+      break;
+    }
+  }
+  return true;
+}
+
+void usb_cam::set_event_callback(std::function<void(const struct v4l2_event&)> callback)
+{
+  m_event_callback = callback;
+}
+
+void usb_cam::close_stream()
+{
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (xioctl(m_fd, VIDIOC_STREAMOFF, &type) == -1)
   {
-    close(m_fd);
-    m_fd = -1;
+    CERR_ENDL("Failed to stop streaming");
   }
+
+  release_buffers();
+  close(m_fd);
+  m_fd = -1;
 }
 
 int usb_cam::set_control(int control_id, int value)
@@ -358,9 +592,10 @@ int usb_cam::set_control(int control_id, int value)
 
   std::string control_name = get_control_name(control_id);
 
+  TRACE_SCOPE("S_CTRL");
   if (xioctl(m_fd, VIDIOC_S_CTRL, &control) == -1)
   {
-    CERR_ENDL("Failed to set control (" << control_name << ", ID: " << control_id << "): " << strerror(errno));
+    WARN_ENDL("Failed to set control (" << control_name << ", ID: " << control_id << "): " << strerror(errno));
     return -1;
   }
 
@@ -374,69 +609,246 @@ int usb_cam::get_control(int control_id)
 
   std::string control_name = get_control_name(control_id);
 
+  TRACE_SCOPE("G_CTRL");
   if (xioctl(m_fd, VIDIOC_G_CTRL, &control) == -1)
   {
-    CERR_ENDL("Failed to get control (" << control_name << ", ID: " << control_id << "): " << strerror(errno));
+    WARN_ENDL("Failed to get control (" << control_name << ", ID: " << control_id << "): " << strerror(errno));
     return -1;
   }
 
   return control.value;
 }
 
-bool usb_cam::query_control(int control_id, v4l2_queryctrl& queryctrl)
+void usb_cam::load_controls()
 {
-  memset(&queryctrl, 0, sizeof(queryctrl));
-  queryctrl.id = control_id;
+  m_controls.clear();
 
-  std::string control_name = get_control_name(control_id);
-
-  if (ioctl(m_fd, VIDIOC_QUERYCTRL, &queryctrl) == -1)
+  struct v4l2_queryctrl queryctrl;
+  memset(&queryctrl, 0, sizeof(queryctrl));
+  queryctrl.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+  while (xioctl(m_fd, VIDIOC_QUERYCTRL, &queryctrl) == 0)
   {
-    if (errno != EINVAL)
+    if (queryctrl.type != V4L2_CTRL_TYPE_CTRL_CLASS)
     {
-      CERR_ENDL("Failed to query control (" << control_name << ", ID: " << control_id << "): " << strerror(errno));
+      controlInfo control;
+      control.id = queryctrl.id;
+      control.type = queryctrl.type;
+      control.name = (char*)queryctrl.name;
+      control.minimum = queryctrl.minimum;
+      control.maximum = queryctrl.maximum;
+      control.step = queryctrl.step;
+      control.default_value = queryctrl.default_value;
+      control.flags = queryctrl.flags;
+
+      if (queryctrl.type == V4L2_CTRL_TYPE_MENU || queryctrl.type == V4L2_CTRL_TYPE_INTEGER_MENU)
+      {
+        struct v4l2_querymenu querymenu;
+        for (int32_t i = queryctrl.minimum; i <= queryctrl.maximum; ++i)
+        {
+          memset(&querymenu, 0, sizeof(querymenu));
+          querymenu.id = queryctrl.id;
+          querymenu.index = i;
+          if (xioctl(m_fd, VIDIOC_QUERYMENU, &querymenu) == 0)
+          {
+            if (queryctrl.type == V4L2_CTRL_TYPE_MENU)
+            {
+              control.menu.push_back(std::make_pair(static_cast<int64_t>(i), std::string((char*)querymenu.name)));
+            }
+            else
+            {
+              control.menu.push_back(std::make_pair(static_cast<int64_t>(i), std::to_string(querymenu.value)));
+            }
+          }
+        }
+      }
+      m_controls.push_back(control);
     }
-    else
+    queryctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+  }
+}
+
+const controlInfo* usb_cam::find_control(uint32_t id) const
+{
+  for (const auto& control : m_controls)
+  {
+    if (control.id == id)
     {
-      CERR_ENDL("Control (" << control_name << ", ID: " << control_id << ") is not supported.");
+      return &control;
     }
+  }
+  return nullptr;
+}
+
+const std::vector<controlInfo>& usb_cam::controls() const
+{
+  return m_controls;
+}
+
+bool usb_cam::query_control(int control_id, v4l2_queryctrl& queryctrl)
+{
+  memset(&queryctrl, 0, sizeof(queryctrl));
+  queryctrl.id = control_id;
+
+  const controlInfo* control = find_control(control_id);
+  if (control == nullptr)
+  {
+    // Routine: the GUI asks for every control it has a slider for.
+    DEBUG_ENDL("Control (" << get_control_name(control_id) << ", ID: " << control_id << ") is not supported.");
     queryctrl.flags |= V4L2_CTRL_FLAG_DISABLED;
     return false;
   }
-  else if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
+
+  queryctrl.type = control->type;
+  strncpy((char*)queryctrl.name, control->name.c_str(), sizeof(queryctrl.name) - 1);
+  queryctrl.minimum = control->minimum;
+  queryctrl.maximum = control->maximum;
+  queryctrl.step = control->step;
+  queryctrl.default_value = control->default_value;
+  queryctrl.flags = control->flags;
+
+  if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
   {
-    CERR_ENDL("Control (" << control_name << ", ID: " << control_id << ") is disabled.");
+    DEBUG_ENDL("Control (" << control->name << ", ID: " << control_id << ") is disabled.");
     return false;
   }
   return true;
 }
 
-void usb_cam::reset_controls_to_default()
+namespace
 {
-  struct v4l2_queryctrl queryctrl;
-  memset(&queryctrl, 0, sizeof(queryctrl));
+// Controls that fit in v4l2_ext_control::value and can be read back.
+bool is_value_control(const controlInfo& control)
+{
+  switch (control.type)
+  {
+    case V4L2_CTRL_TYPE_INTEGER:
+    case V4L2_CTRL_TYPE_BOOLEAN:
+    case V4L2_CTRL_TYPE_MENU:
+    case V4L2_CTRL_TYPE_INTEGER_MENU:
+    case V4L2_CTRL_TYPE_BITMASK:
+      return !(control.flags & V4L2_CTRL_FLAG_DISABLED);
+    default:
+      return false;
+  }
+}
+}  // namespace
 
-  for (queryctrl.id = V4L2_CID_BASE; queryctrl.id < V4L2_CID_LASTP1; queryctrl.id++)
+bool usb_cam::get_controls(const std::vector<uint32_t>& ids, std::map<uint32_t, int32_t>& values)
+{
+  std::vector<struct v4l2_ext_control> batch;
+  for (uint32_t id : ids)
   {
-    if (ioctl(m_fd, VIDIOC_QUERYCTRL, &queryctrl) == 0)
+    const controlInfo* control = find_control(id);
+    if (control != nullptr && is_value_control(*control) && !(control->flags & V4L2_CTRL_FLAG_WRITE_ONLY))
     {
-      if (!(queryctrl.flags & V4L2_CTRL_FLAG_DISABLED))
-      {
-        set_control(queryctrl.id, queryctrl.default_value);
-      }
+      struct v4l2_ext_control ctrl;
+      memset(&ctrl, 0, sizeof(ctrl));
+      ctrl.id = id;
+      batch.push_back(ctrl);
     }
   }
+  if (batch.empty())
+  {
+    return true;
+  }
 
-  for (queryctrl.id = V4L2_CID_PRIVATE_BASE; queryctrl.id < V4L2_CID_PRIVATE_BASE + 20; queryctrl.id++)
+  struct v4l2_ext_controls ext;
+  memset(&ext, 0, sizeof(ext));
+  ext.which = V4L2_CTRL_WHICH_CUR_VAL;
+  ext.count = batch.size();
+  ext.controls = batch.data();
+
+  TRACE_SCOPE("G_EXT_CTRLS");
+  if (xioctl(m_fd, VIDIOC_G_EXT_CTRLS, &ext) == 0)
   {
-    if (ioctl(m_fd, VIDIOC_QUERYCTRL, &queryctrl) == 0)
+    for (const auto& ctrl : batch)
     {
-      if (!(queryctrl.flags & V4L2_CTRL_FLAG_DISABLED))
-      {
-        set_control(queryctrl.id, queryctrl.default_value);
-      }
+      values[ctrl.id] = ctrl.value;
+    }
+    return true;
+  }
+
+  // Some drivers refuse mixed control classes or a single inactive control; fall back to one at a time.
+  bool ok = true;
+  for (const auto& ctrl : batch)
+  {
+    struct v4l2_control single;
+    single.id = ctrl.id;
+    if (xioctl(m_fd, VIDIOC_G_CTRL, &single) == 0)
+    {
+      values[ctrl.id] = single.value;
+    }
+    else
+    {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool usb_cam::set_controls(const std::vector<std::pair<uint32_t, int32_t>>& values)
+{
+  std::vector<struct v4l2_ext_control> batch;
+  for (const auto& item : values)
+  {
+    const controlInfo* control = find_control(item.first);
+    if (control != nullptr && is_value_control(*control) && !(control->flags & V4L2_CTRL_FLAG_READ_ONLY))
+    {
+      struct v4l2_ext_control ctrl;
+      memset(&ctrl, 0, sizeof(ctrl));
+      ctrl.id = item.first;
+      ctrl.value = item.second;
+      batch.push_back(ctrl);
+    }
+  }
+  if (batch.empty())
+  {
+    return true;
+  }
+
+  struct v4l2_ext_controls ext;
+  memset(&ext, 0, sizeof(ext));
+  ext.which = V4L2_CTRL_WHICH_CUR_VAL;
+  ext.count = batch.size();
+  ext.controls = batch.data();
+
+  TRACE_SCOPE("S_EXT_CTRLS");
+  if (xioctl(m_fd, VIDIOC_S_EXT_CTRLS, &ext) == 0)
+  {
+    return true;
+  }
+
+  // The batch is all-or-nothing, and a control made inactive by another one (manual exposure while auto exposure is
+  // on, for one) rejects it. Apply what can be applied, in order.
+  bool ok = true;
+  for (const auto& ctrl : batch)
+  {
+    struct v4l2_control single;
+    single.id = ctrl.id;
+    single.value = ctrl.value;
+    if (xioctl(m_fd, VIDIOC_S_CTRL, &single) == -1)
+    {
+      ok = false;
     }
   }
+  return ok;
+}
+
+void usb_cam::reset_controls_to_default()
+{
+  std::vector<std::pair<uint32_t, int32_t>> defaults;
+  for (const auto& control : m_controls)
+  {
+    if (!(control.flags & (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_INACTIVE)))
+    {
+      defaults.push_back(std::make_pair(control.id, control.default_value));
+    }
+  }
+
+  if (!set_controls(defaults))
+  {
+    CERR_ENDL("Some controls could not be reset to their default");
+  }
 }
 
 std::string usb_cam::get_control_name(int control_id)
@@ -0,0 +1,108 @@
+#include "video_widget.h"
+
+#include <QPainter>
+
+#include "trace.h"
+
+VideoWidget::VideoWidget(QWidget* parent) : QFrame(parent), fast_scaling(false), frame_unpainted(false)
+{
+  // Every pixel outside the frame is painted in paintEvent, so Qt need not clear the background first.
+  setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+void VideoWidget::setFrame(const QImage& image)
+{
+  bool size_changed = image.size() != frame.size();
+  frame = image;
+  frame_unpainted = true;
+  if (size_changed)
+  {
+    updateTargetRect();
+  }
+  update();
+}
+
+void VideoWidget::setOverlayText(const QString& text)
+{
+  overlay_text = text;
+}
+
+void VideoWidget::setFastScaling(bool fast)
+{
+  fast_scaling = fast;
+  update();
+}
+
+void VideoWidget::clear()
+{
+  frame = QImage();
+  overlay_text.clear();
+  target_rect = QRect();
+  frame_unpainted = false;
+  update();
+}
+
+QSize VideoWidget::targetSize() const
+{
+  return target_rect.size();
+}
+
+void VideoWidget::resizeEvent(QResizeEvent* event)
+{
+  QFrame::resizeEvent(event);
+  updateTargetRect();
+}
+
+void VideoWidget::updateTargetRect()
+{
+  QRect area = contentsRect();
+  if (frame.isNull() || area.isEmpty())
+  {
+    target_rect = QRect();
+    return;
+  }
+
+  QSize size = frame.size().scaled(area.size(), Qt::KeepAspectRatio);
+  target_rect = QRect(QPoint(0, 0), size);
+  target_rect.moveCenter(area.center());
+}
+
+void VideoWidget::paintEvent(QPaintEvent* event)
+{
+  TRACE_SCOPE("paint");
+  QPainter painter(this);
+  painter.fillRect(contentsRect(), palette().window());
+
+  bool painted = false;
+  if (!frame.isNull() && !target_rect.isEmpty())
+  {
+    if (frame.size() == target_rect.size())
+    {
+      painter.drawImage(target_rect.topLeft(), frame);
+    }
+    else
+    {
+      painter.setRenderHint(QPainter::SmoothPixmapTransform, !fast_scaling);
+      painter.drawImage(target_rect, frame);
+    }
+    painted = frame_unpainted;
+    frame_unpainted = false;
+
+    if (!overlay_text.isEmpty())
+    {
+      QRect bounds = target_rect.adjusted(8, 8, -8, -8);
+      QRect box = painter.boundingRect(bounds, Qt::AlignLeft, overlay_text);
+      painter.fillRect(box.adjusted(-4, -4, 4, 4), QColor(0, 0, 0, 160));
+      painter.setPen(Qt::white);
+      painter.drawText(box, Qt::AlignLeft, overlay_text);
+    }
+  }
+
+  painter.end();
+  QFrame::paintEvent(event);
+
+  if (painted)
+  {
+    emit framePainted();
+  }
+}